@@ -9,188 +9,1414 @@
 
 #ifndef AVL_h
 #define AVL_h
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <random>
+#include <set>
+#include <shared_mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "Testing.h"
+#include "Benchmark.h"
+#include "Hashing.h"
+#include "Reclamation.h"
 
 namespace avl {
 
-template<class T>
+// Children are 32-bit pool indices rather than pointers and the height is a
+// byte (an AVL tree of 2^32 nodes is under 48 high). With the value first,
+// a node is 16 bytes for int values and 24 for 8-byte ones, where two
+// pointers and an int height took 24 and 32. Index 0 means no child.
+template<class T, bool SIZED = false>
 struct Node {
-    struct Node<T>* lc;
-    struct Node<T>* rc;
     T data;
-    int h;
-    Node(T val, int height): data(val), h(height), lc(nullptr), rc(nullptr) {}
+    uint32_t lc;
+    uint32_t rc;
+    int8_t h;
+    Node(const T& val): data(val), lc(0), rc(0), h(1) {}
 };
 
+// with order statistics on, every node also counts its subtree
 template<class T>
-class AVL {
-    Node<T>* root;
+struct Node<T, true> {
+    T data;
+    uint32_t lc;
+    uint32_t rc;
+    uint32_t size;
+    int8_t h;
+    Node(const T& val): data(val), lc(0), rc(0), size(1), h(1) {}
+};
+
+// Hands out nodes from fixed-size slabs and keeps freed ones on a freelist,
+// like linkedlist::NodePool, but addresses them by index. Slabs are only
+// released together, when the pool goes away.
+template<class T, bool SIZED = false>
+class NodePool {
+    using NodeT = Node<T, SIZED>;
+
+    static const uint32_t SLAB_BITS = 10;
+    static const uint32_t SLAB_SIZE = 1u << SLAB_BITS;
+
+    union Cell {
+        uint32_t nextFree;
+        alignas(NodeT) unsigned char storage[sizeof(NodeT)];
+    };
+
+    std::vector<std::unique_ptr<Cell[]>> slabs;
+    uint32_t freeList;
+    // cells ever handed out, the unused index 0 included
+    uint32_t used;
+
+    Cell& cell(uint32_t i){
+        return slabs[i >> SLAB_BITS][i & (SLAB_SIZE - 1)];
+    }
+
 public:
-    AVL(): root(nullptr) {}
-    
-//    Rotations Start
-    
-    Node<T>* LL_Rotation(Node<T>* p){
-        Node<T>* pl = p->lc;
-        Node<T>* plr = p->lc->rc;
-        
-        pl->rc = p;
-        p->lc=plr;
-        
-        p->h = _height(p);
-        pl->h = _height(pl);
-        
-        if(root == p){
-            root = pl;
-        }
-        return pl;
-    }
-    
-    Node<T>* RR_Rotation(Node<T>* p){
-        Node<T>* pr = p->rc;
-        Node<T>* prl = p->rc->lc;
-        
-        pr->lc = p;
-        p->rc = prl;
-        
-        p->h = _height(p);
-        pr->h = _height(pr);
-        
-        if(root == p){
-            root = pr;
-        }
-        return pr;
-    }
-    
-    Node<T>* LR_Rotation(Node<T>* p){
-        Node<T>* pl = p->lc;
-        Node<T>* plr = pl->rc;
-        p->lc = plr->lc;
-        pl->rc = plr->rc;
-        
-        plr->lc = pl;
-        plr->rc = p;
-        
-        p->h = _height(p);
-        pl->h = _height(pl);
-        plr->h = _height(plr);
-        
-        if(root == p){
-            root = plr;
-        }
-        
-        return plr;
-    }
-    
-    Node<T>* RL_Rotation(Node<T>* p){
-        Node<T>* pr = p->rc;
-        Node<T>* prl = pr->lc;
-        
-        p->rc = prl->rc;
-        pr->lc = prl->lc;
-        
-        prl->lc = p;
-        prl->rc = pr;
-        
-        p->h = _height(p);
-        pr->h = _height(pr);
-        prl->h = _height(prl);
-        
-        if(root == p){
-            root = prl;
-        }
-        
-        return prl;
-    }
-    
-    
-    
-    
-//    Rotations End
-    
-    int _height(Node<T>* n){
-        if(!n){
-            return 0;
+    NodePool(): freeList(0), used(1) {}
+    NodePool(const NodePool&) = delete;
+    NodePool& operator=(const NodePool&) = delete;
+
+    size_t getSlabCount(){
+        return slabs.size();
+    }
+
+    size_t getMemoryUsage(){
+        return slabs.size() * SLAB_SIZE * sizeof(Cell);
+    }
+
+    NodeT& at(uint32_t i){
+        return *std::launder(reinterpret_cast<NodeT*>(cell(i).storage));
+    }
+
+    uint32_t acquire(const T& val){
+        uint32_t i;
+        if(freeList){
+            i = freeList;
+            freeList = cell(i).nextFree;
+        }else{
+            if(used == UINT32_MAX){
+                throw std::length_error("avl::NodePool: out of node indices");
+            }
+            if((used >> SLAB_BITS) == slabs.size()){
+                slabs.push_back(std::unique_ptr<Cell[]>(new Cell[SLAB_SIZE]));
+            }
+            i = used;
+            used += 1;
         }
-        int hl = (n->lc) ? n->lc->h:0;
-        int hr = (n->rc) ? n->rc->h:0;
-        return 1 + std::max(hl, hr);
+        new (cell(i).storage) NodeT(val);
+        return i;
     }
-    
-    int balanceFactor(Node<T>* n){
-        if(!n){
+
+    void release(uint32_t i){
+        at(i).~NodeT();
+        cell(i).nextFree = freeList;
+        freeList = i;
+    }
+
+    // drops every slab at once; the nodes in them must already be destroyed
+    void clear(){
+        slabs.clear();
+        freeList = 0;
+        used = 1;
+    }
+};
+
+// hands out cache-line aligned arrays
+template<class T>
+struct LineAllocator {
+    using value_type = T;
+    static constexpr std::align_val_t ALIGN{64};
+
+    LineAllocator() = default;
+    template<class U>
+    LineAllocator(const LineAllocator<U>&) {}
+
+    T* allocate(size_t n){
+        return static_cast<T*>(::operator new(n * sizeof(T), ALIGN));
+    }
+
+    void deallocate(T* p, size_t){
+        ::operator delete(p, ALIGN);
+    }
+
+    template<class U>
+    bool operator==(const LineAllocator<U>&) const { return true; }
+    template<class U>
+    bool operator!=(const LineAllocator<U>&) const { return false; }
+};
+
+// An immutable sorted set in Eytzinger order, made by AVL::freeze(): the
+// keys of a complete binary tree stored level by level, the root at 1 and
+// the children of k at 2k and 2k + 1, so there are no links at all. A
+// search reads one key per level and steps down with arithmetic instead
+// of a branch. The descendants of k a few levels down are adjacent, and
+// with the array line-aligned they fill exactly the line at k * STRIDE,
+// which is prefetched while the levels in between are read.
+template<class T>
+class EytzingerSet {
+    // keys per cache line; the prefetch looks log2(STRIDE) levels ahead
+    static constexpr size_t STRIDE = sizeof(T) < 64 ? 64 / sizeof(T) : 1;
+
+    // keys[0] is unused
+    std::vector<T, LineAllocator<T>> keys;
+    size_t n;
+
+    // an in-order walk of the implicit tree visits the slots in key order
+    template<class It>
+    void fill(It& it, size_t k){
+        if(k <= n){
+            fill(it, 2 * k);
+            keys[k] = *it;
+            ++it;
+            fill(it, 2 * k + 1);
+        }
+    }
+
+    // slot of the first key not below val, or 0 if there is none
+    size_t search(const T& val) const {
+        const T* b = keys.data();
+        size_t k = 1;
+        while(k <= n){
+            hashing::prefetch(b + k * STRIDE);
+            k = 2 * k + (size_t) (b[k] < val);
+        }
+        // after the answer the path only went right, then fell off; the
+        // trailing ones and one more bit undo those steps
+        return k >> (__builtin_ctzll(~(unsigned long long) k) + 1);
+    }
+
+public:
+    EytzingerSet(): keys(1), n(0) {}
+
+    // the keys in [first, first + count), which must be strictly increasing
+    template<class It>
+    EytzingerSet(It first, size_t count): keys(count + 1), n(count) {
+        fill(first, 1);
+    }
+
+    size_t getCurrentMembers() const {
+        return n;
+    }
+
+    // bytes in the key array
+    size_t getMemoryUsage() const {
+        return keys.capacity() * sizeof(T);
+    }
+
+    const T* find(const T& val) const {
+        size_t k = search(val);
+        return (k && !(val < keys[k])) ? &keys[k] : nullptr;
+    }
+
+    // the first key not below val, or nullptr if every key is below it
+    const T* lowerBound(const T& val) const {
+        size_t k = search(val);
+        return k ? &keys[k] : nullptr;
+    }
+};
+
+// AVL set. insert and erase are iterative: the links they pass are kept on
+// a fixed-size stack, and on the way back up each node has its height and
+// balance worked out once, stopping as soon as a subtree height is unchanged.
+//
+// With ORDER_STATS every node also keeps its subtree size, which adds
+// rank, select and countRange in O(log n). Sizes are refreshed wherever
+// heights are, and the rest of the path back to the root gets +1 or -1.
+//
+// join, split, buildFromSorted and the set operations follow Blelloch,
+// Ferizovic and Sun, "Just Join for Parallel Ordered Sets": join is the only
+// place that rebalances and everything else is written in terms of it. They
+// move nodes between trees, so trees can share one pool (see sharePool).
+// A pool is not synchronized: trees sharing one belong to one thread at a
+// time, and the only parallel code is inside the set operations, where the
+// nodes are already allocated and each thread works on subtrees of its own.
+template<class T, bool ORDER_STATS = false>
+class AVL {
+    using NodeT = Node<T, ORDER_STATS>;
+    using PoolT = NodePool<T, ORDER_STATS>;
+
+    // an AVL tree of height h has at least fib(h + 2) - 1 nodes, so 2^32
+    // nodes fit in height 46
+    static const size_t MAX_HEIGHT = 64;
+
+    // subtrees at least this high (a few thousand nodes and up) are worth
+    // handing to another thread
+    static const int PARALLEL_HEIGHT = 16;
+
+    // split and join leave the key count to be worked out on demand
+    static const size_t UNCOUNTED = SIZE_MAX;
+
+    std::shared_ptr<PoolT> pool;
+    uint32_t root;
+    size_t currentMembers;
+
+    NodeT& node(uint32_t i){
+        return pool->at(i);
+    }
+
+    int height(uint32_t i){
+        return i ? node(i).h : 0;
+    }
+
+    uint32_t size(uint32_t i){
+        if constexpr (ORDER_STATS){
+            return i ? node(i).size : 0;
+        }else{
             return 0;
         }
-        return _height(n->lc) - _height(n->rc);
     }
-    
-    void insert(T val) {
-        if(!root){
-            root = new Node<T>(val, 1);
-            return;
+
+    void resize(NodeT& n){
+        if constexpr (ORDER_STATS){
+            n.size = 1 + size(n.lc) + size(n.rc);
+        }
+    }
+
+    void update(uint32_t i){
+        NodeT& n = node(i);
+        n.h = (int8_t) (1 + std::max(height(n.lc), height(n.rc)));
+        resize(n);
+    }
+
+    uint32_t rotateRight(uint32_t i){
+        NodeT& n = node(i);
+        uint32_t l = n.lc;
+        n.lc = node(l).rc;
+        node(l).rc = i;
+        update(i);
+        update(l);
+        return l;
+    }
+
+    uint32_t rotateLeft(uint32_t i){
+        NodeT& n = node(i);
+        uint32_t r = n.rc;
+        n.rc = node(r).lc;
+        node(r).lc = i;
+        update(i);
+        update(r);
+        return r;
+    }
+
+    // Restores the balance of the subtree at *link with a single or double
+    // rotation (the LL/LR/RR/RL cases) and returns whether its height changed.
+    bool rebalance(uint32_t* link){
+        uint32_t i = *link;
+        NodeT& n = node(i);
+        int before = n.h;
+        int hl = height(n.lc);
+        int hr = height(n.rc);
+        if(hl - hr == 2){
+            NodeT& l = node(n.lc);
+            if(height(l.lc) < height(l.rc)){
+                n.lc = rotateLeft(n.lc);
+            }
+            *link = rotateRight(i);
+        }else if(hr - hl == 2){
+            NodeT& r = node(n.rc);
+            if(height(r.rc) < height(r.lc)){
+                n.rc = rotateRight(n.rc);
+            }
+            *link = rotateLeft(i);
+        }else{
+            n.h = (int8_t) (1 + std::max(hl, hr));
+            resize(n);
         }
-        root = insert(root, val);
+        return node(*link).h != before;
     }
-    
-    Node<T>* insert(Node<T>* t, T val){
+
+    // rebalances up the path until a height stays the same; above that
+    // point only subtree sizes change, by delta
+    void retrace(uint32_t** path, size_t depth, int delta){
+        while(depth > 0 && rebalance(path[depth - 1])){
+            depth -= 1;
+        }
+        if constexpr (ORDER_STATS){
+            for(size_t d = 0; d + 1 < depth; d++){
+                node(*path[d]).size += delta;
+            }
+        }
+    }
+
+    // the tree of l, then node k, then r, where l's keys are all below k's
+    // and r's all above; O(difference in height)
+    uint32_t join(uint32_t l, uint32_t k, uint32_t r){
+        int hl = height(l);
+        int hr = height(r);
+        if(hl > hr + 1){
+            return joinRight(l, k, r);
+        }
+        if(hr > hl + 1){
+            return joinLeft(l, k, r);
+        }
+        NodeT& n = node(k);
+        n.lc = l;
+        n.rc = r;
+        update(k);
+        return k;
+    }
+
+    // l is the taller: follow its right spine down to a subtree no more than
+    // one higher than r, hang k there and rotate on the way back up
+    uint32_t joinRight(uint32_t l, uint32_t k, uint32_t r){
+        NodeT& n = node(l);
+        uint32_t c = n.rc;
+        if(height(c) <= height(r) + 1){
+            NodeT& m = node(k);
+            m.lc = c;
+            m.rc = r;
+            update(k);
+            n.rc = k;
+            if(height(k) > height(n.lc) + 1){
+                n.rc = rotateRight(k);
+                return rotateLeft(l);
+            }
+            update(l);
+            return l;
+        }
+        n.rc = joinRight(c, k, r);
+        if(height(n.rc) > height(n.lc) + 1){
+            return rotateLeft(l);
+        }
+        update(l);
+        return l;
+    }
+
+    uint32_t joinLeft(uint32_t l, uint32_t k, uint32_t r){
+        NodeT& n = node(r);
+        uint32_t c = n.lc;
+        if(height(c) <= height(l) + 1){
+            NodeT& m = node(k);
+            m.lc = l;
+            m.rc = c;
+            update(k);
+            n.lc = k;
+            if(height(k) > height(n.rc) + 1){
+                n.lc = rotateLeft(k);
+                return rotateRight(r);
+            }
+            update(r);
+            return r;
+        }
+        n.lc = joinLeft(l, k, c);
+        if(height(n.lc) > height(n.rc) + 1){
+            return rotateRight(r);
+        }
+        update(r);
+        return r;
+    }
+
+    // detaches the largest node of t and returns it, with the rest in rest
+    uint32_t splitLast(uint32_t t, uint32_t& rest){
+        NodeT& n = node(t);
+        if(!n.rc){
+            rest = n.lc;
+            return t;
+        }
+        uint32_t l = n.lc;
+        uint32_t restRight;
+        uint32_t last = splitLast(n.rc, restRight);
+        rest = join(l, t, restRight);
+        return last;
+    }
+
+    // l then r, with no node in between
+    uint32_t join2(uint32_t l, uint32_t r){
+        if(!l){
+            return r;
+        }
+        uint32_t rest;
+        uint32_t k = splitLast(l, rest);
+        return join(rest, k, r);
+    }
+
+    // splits t into the keys below key and those above it; the node holding
+    // key, if there is one, comes back detached in match. O(log n)
+    void split(uint32_t t, const T& key, uint32_t& less, uint32_t& match, uint32_t& greater){
         if(!t){
-            return new Node<T>(val, 1);
+            less = match = greater = 0;
+            return;
+        }
+        NodeT& n = node(t);
+        uint32_t l = n.lc;
+        uint32_t r = n.rc;
+        uint32_t mid;
+        if(key < n.data){
+            split(l, key, less, match, mid);
+            greater = join(mid, t, r);
+        }else if(n.data < key){
+            split(r, key, mid, match, greater);
+            less = join(l, t, mid);
+        }else{
+            n.lc = n.rc = 0;
+            update(t);
+            less = l;
+            match = t;
+            greater = r;
         }
-        
-        if(val < t->data){
-            t->lc = insert(t->lc, val);
-        }else if(val > t->data){
-            t->rc = insert(t->rc, val);
+    }
+
+    // Runs left and right, left on a thread of its own when the budget has
+    // one to spare and the work is big enough; the budget is split between
+    // the halves. Nodes a half drops are collected apart and merged after.
+    template<class L, class R>
+    static void forkJoin(size_t threads, bool big, std::vector<uint32_t>& dropped, L&& left, R&& right){
+        if(threads > 1 && big){
+            std::vector<uint32_t> leftDropped;
+            std::thread worker([&]{ left(threads / 2, leftDropped); });
+            right(threads - threads / 2, dropped);
+            worker.join();
+            dropped.insert(dropped.end(), leftDropped.begin(), leftDropped.end());
         }else{
+            left(threads, dropped);
+            right(threads, dropped);
+        }
+    }
+
+    // The set operations take two subtrees of the same pool and reuse their
+    // nodes for the result. Nodes left over (duplicates, removed keys) are
+    // detached and put in dropped, as subtree roots, to be freed once all
+    // threads are done, since the pool is not safe to share.
+
+    uint32_t unite(uint32_t a, uint32_t b, size_t threads, std::vector<uint32_t>& dropped){
+        if(!a || !b){
+            return a ? a : b;
+        }
+        bool big = std::max(height(a), height(b)) >= PARALLEL_HEIGHT;
+        NodeT& n = node(a);
+        uint32_t l = n.lc;
+        uint32_t r = n.rc;
+        uint32_t less, match, greater;
+        split(b, n.data, less, match, greater);
+        if(match){
+            dropped.push_back(match);
+        }
+        uint32_t left, right;
+        forkJoin(threads, big, dropped,
+            [&](size_t t, std::vector<uint32_t>& d){ left = unite(l, less, t, d); },
+            [&](size_t t, std::vector<uint32_t>& d){ right = unite(r, greater, t, d); });
+        return join(left, a, right);
+    }
+
+    uint32_t intersect(uint32_t a, uint32_t b, size_t threads, std::vector<uint32_t>& dropped){
+        if(!a || !b){
+            if(a || b){
+                dropped.push_back(a ? a : b);
+            }
+            return 0;
+        }
+        bool big = std::max(height(a), height(b)) >= PARALLEL_HEIGHT;
+        NodeT& n = node(a);
+        uint32_t l = n.lc;
+        uint32_t r = n.rc;
+        uint32_t less, match, greater;
+        split(b, n.data, less, match, greater);
+        uint32_t left, right;
+        forkJoin(threads, big, dropped,
+            [&](size_t t, std::vector<uint32_t>& d){ left = intersect(l, less, t, d); },
+            [&](size_t t, std::vector<uint32_t>& d){ right = intersect(r, greater, t, d); });
+        if(match){
+            dropped.push_back(match);
+            return join(left, a, right);
+        }
+        n.lc = n.rc = 0;
+        dropped.push_back(a);
+        return join2(left, right);
+    }
+
+    // the keys of a that are not in b
+    uint32_t subtract(uint32_t a, uint32_t b, size_t threads, std::vector<uint32_t>& dropped){
+        if(!a || !b){
+            if(b){
+                dropped.push_back(b);
+            }
+            return a;
+        }
+        bool big = std::max(height(a), height(b)) >= PARALLEL_HEIGHT;
+        NodeT& n = node(b);
+        uint32_t l = n.lc;
+        uint32_t r = n.rc;
+        uint32_t less, match, greater;
+        split(a, n.data, less, match, greater);
+        n.lc = n.rc = 0;
+        dropped.push_back(b);
+        if(match){
+            dropped.push_back(match);
+        }
+        uint32_t left, right;
+        forkJoin(threads, big, dropped,
+            [&](size_t t, std::vector<uint32_t>& d){ left = subtract(less, l, t, d); },
+            [&](size_t t, std::vector<uint32_t>& d){ right = subtract(greater, r, t, d); });
+        return join2(left, right);
+    }
+
+    // links the nodes ids[lo, hi), which hold increasing keys, into a
+    // perfectly balanced subtree
+    uint32_t link(const std::vector<uint32_t>& ids, size_t lo, size_t hi, size_t threads){
+        if(lo == hi){
+            return 0;
+        }
+        size_t mid = lo + (hi - lo) / 2;
+        uint32_t l, r;
+        std::vector<uint32_t> none;
+        forkJoin(threads, hi - lo >= ((size_t) 1 << PARALLEL_HEIGHT), none,
+            [&](size_t t, std::vector<uint32_t>&){ l = link(ids, lo, mid, t); },
+            [&](size_t t, std::vector<uint32_t>&){ r = link(ids, mid + 1, hi, t); });
+        uint32_t i = ids[mid];
+        NodeT& n = node(i);
+        n.lc = l;
+        n.rc = r;
+        update(i);
+        return i;
+    }
+
+    // gives every node of the given subtrees back to the pool and returns
+    // how many there were
+    size_t releaseAll(std::vector<uint32_t> stack){
+        size_t count = 0;
+        while(!stack.empty()){
+            uint32_t i = stack.back();
+            stack.pop_back();
+            if(node(i).lc) stack.push_back(node(i).lc);
+            if(node(i).rc) stack.push_back(node(i).rc);
+            pool->release(i);
+            count += 1;
+        }
+        return count;
+    }
+
+    size_t countNodes(uint32_t t){
+        size_t count = 0;
+        std::vector<uint32_t> stack;
+        if(t) stack.push_back(t);
+        while(!stack.empty()){
+            uint32_t i = stack.back();
+            stack.pop_back();
+            if(node(i).lc) stack.push_back(node(i).lc);
+            if(node(i).rc) stack.push_back(node(i).rc);
+            count += 1;
+        }
+        return count;
+    }
+
+    // appends the keys in order
+    void collect(std::vector<T>& out){
+        std::vector<uint32_t> stack;
+        uint32_t t = root;
+        while(t || !stack.empty()){
+            while(t){
+                stack.push_back(t);
+                t = node(t).lc;
+            }
+            t = stack.back();
+            stack.pop_back();
+            out.push_back(node(t).data);
+            t = node(t).rc;
+        }
+    }
+
+    // Takes other's keys as a subtree of this tree's pool and leaves other
+    // empty: its nodes as they are if the pool is shared, else copies built
+    // in O(m) from an in-order walk. count is how many keys came over.
+    uint32_t adopt(AVL& other, size_t threads, size_t& count){
+        count = other.currentMembers;
+        uint32_t t = other.root;
+        if(other.pool == pool){
+            other.root = 0;
+            other.currentMembers = 0;
             return t;
         }
-        
-        t->h = _height(t);
-        
-        if(balanceFactor(t) == 2 && balanceFactor(t->lc)==1){
-            // LL rotation
-            return LL_Rotation(t);
-        }
-        
-        
-        if(balanceFactor(t) == 2 && balanceFactor(t->lc)==-1){
-            // LR rotation
-            return LR_Rotation(t);
-        }
-//        
-        if(balanceFactor(t) == -2 && balanceFactor(t->rc)==-1){
-            // RR rotation
-            return RR_Rotation(t);
-        }
-//        
-        if(balanceFactor(t) == -2 && balanceFactor(t->rc)==1){
-            // RL rotation
-            return RL_Rotation(t);
-        }
-        
-        return t;
-    }
-    
+        std::vector<T> values;
+        other.collect(values);
+        other.destroyAll();
+        count = values.size();
+        return build(values.begin(), values.end(), threads);
+    }
+
+    // a balanced subtree of fresh nodes for the increasing keys in [first, last)
+    template<class It>
+    uint32_t build(It first, It last, size_t threads){
+        std::vector<uint32_t> ids;
+        ids.reserve((size_t) std::distance(first, last));
+        try{
+            for(It it = first; it != last; ++it){
+                ids.push_back(pool->acquire(*it));
+            }
+        }catch(...){
+            for(uint32_t i : ids){
+                pool->release(i);
+            }
+            throw;
+        }
+        return link(ids, 0, ids.size(), threads);
+    }
+
+    // the set operations: b's keys are merged into this tree by op
+    template<class Op>
+    void combine(AVL& other, size_t threads, Op op){
+        size_t count;
+        uint32_t b = adopt(other, threads, count);
+        std::vector<uint32_t> dropped;
+        root = (this->*op)(root, b, threads, dropped);
+        size_t released = releaseAll(std::move(dropped));
+        if(currentMembers == UNCOUNTED || count == UNCOUNTED){
+            currentMembers = UNCOUNTED;
+        }else{
+            currentMembers = currentMembers + count - released;
+        }
+    }
+
+    // runs the destructors, iteratively; trivially destructible values
+    // need nothing and the slabs go back in one go
+    void destroyAll(){
+        if(pool.use_count() > 1){
+            // other trees still have nodes in the pool
+            if(root){
+                releaseAll({root});
+            }
+            root = 0;
+            currentMembers = 0;
+            return;
+        }
+        if(!std::is_trivially_destructible<T>::value && root){
+            std::vector<uint32_t> stack{root};
+            while(!stack.empty()){
+                uint32_t i = stack.back();
+                stack.pop_back();
+                if(node(i).lc) stack.push_back(node(i).lc);
+                if(node(i).rc) stack.push_back(node(i).rc);
+                node(i).~NodeT();
+            }
+        }
+        pool->clear();
+        root = 0;
+        currentMembers = 0;
+    }
+
+    bool checkNode(uint32_t i, const T* lo, const T* hi, int& h, size_t& count){
+        if(!i){
+            h = 0;
+            count = 0;
+            return true;
+        }
+        NodeT& n = node(i);
+        if((lo && !(*lo < n.data)) || (hi && !(n.data < *hi))){
+            return false;
+        }
+        int hl, hr;
+        size_t cl, cr;
+        if(!checkNode(n.lc, lo, &n.data, hl, cl) || !checkNode(n.rc, &n.data, hi, hr, cr)){
+            return false;
+        }
+        h = 1 + std::max(hl, hr);
+        count = 1 + cl + cr;
+        if(ORDER_STATS && size(i) != count){
+            return false;
+        }
+        return n.h == h && hl - hr <= 1 && hr - hl <= 1;
+    }
+
+    void _printTree(uint32_t i, std::string indent = "") {
+        if(i){
+            std::cout << indent << node(i).data << " (h:" << (int) node(i).h << ")" << std::endl;
+            _printTree(node(i).lc, indent + "  ");
+            _printTree(node(i).rc, indent + "  ");
+        }
+    }
+
+public:
+    AVL(): pool(std::make_shared<PoolT>()), root(0), currentMembers(0) {}
+
+    AVL(const AVL&) = delete;
+    AVL& operator=(const AVL&) = delete;
+
+    ~AVL(){
+        destroyAll();
+    }
+
+    size_t getCurrentMembers(){
+        if constexpr (ORDER_STATS){
+            return size(root);
+        }
+        if(currentMembers == UNCOUNTED){
+            currentMembers = countNodes(root);
+        }
+        return currentMembers;
+    }
+
+    size_t getHeight(){
+        return (size_t) height(root);
+    }
+
+    size_t getSlabCount(){
+        return pool->getSlabCount();
+    }
+
+    // bytes of node slabs in the pool, which may be shared
+    size_t getMemoryUsage(){
+        return pool->getMemoryUsage();
+    }
+
+    // an immutable copy of the keys laid out for fast lookups
+    EytzingerSet<T> freeze(){
+        std::vector<T> sorted;
+        sorted.reserve(getCurrentMembers());
+        collect(sorted);
+        return EytzingerSet<T>(sorted.begin(), sorted.size());
+    }
+
+    // returns false if val was already there
+    bool insert(const T& val) {
+        uint32_t* path[MAX_HEIGHT];
+        size_t depth = 0;
+        uint32_t* link = &root;
+        while(*link){
+            NodeT& n = node(*link);
+            path[depth++] = link;
+            if(val < n.data){
+                link = &n.lc;
+            }else if(n.data < val){
+                link = &n.rc;
+            }else{
+                return false;
+            }
+        }
+        uint32_t fresh = pool->acquire(val);
+        *link = fresh;
+        if(currentMembers != UNCOUNTED){
+            currentMembers += 1;
+        }
+        retrace(path, depth, 1);
+        return true;
+    }
+
+    bool erase(const T& val) {
+        uint32_t* path[MAX_HEIGHT];
+        size_t depth = 0;
+        uint32_t* link = &root;
+        while(*link){
+            NodeT& n = node(*link);
+            if(val < n.data){
+                path[depth++] = link;
+                link = &n.lc;
+            }else if(n.data < val){
+                path[depth++] = link;
+                link = &n.rc;
+            }else{
+                break;
+            }
+        }
+        if(!*link){
+            return false;
+        }
+        NodeT& n = node(*link);
+        uint32_t victim = *link;
+        if(n.lc && n.rc){
+            // the in-order successor gives up its value and is unlinked instead
+            path[depth++] = link;
+            uint32_t* s = &n.rc;
+            while(node(*s).lc){
+                path[depth++] = s;
+                s = &node(*s).lc;
+            }
+            victim = *s;
+            n.data = std::move(node(victim).data);
+            *s = node(victim).rc;
+        }else{
+            *link = n.lc ? n.lc : n.rc;
+        }
+        pool->release(victim);
+        if(currentMembers != UNCOUNTED){
+            currentMembers -= 1;
+        }
+        retrace(path, depth, -1);
+        return true;
+    }
+
+    const T* find(const T& val){
+        uint32_t i = root;
+        while(i){
+            NodeT& n = node(i);
+            if(val < n.data){
+                i = n.lc;
+            }else if(n.data < val){
+                i = n.rc;
+            }else{
+                return &n.data;
+            }
+        }
+        return nullptr;
+    }
+
+    bool reset(){
+        try{
+            destroyAll();
+            return true;
+        }catch(...){
+            return false;
+        }
+    }
+
+    // Empties this tree and has it take nodes from other's pool from now
+    // on, so that join, split and the set operations between the two move
+    // nodes instead of copying them.
+    void sharePool(AVL& other){
+        destroyAll();
+        pool = other.pool;
+    }
+
+    // Replaces the contents with the keys in [first, last), in O(n) on up to
+    // threads threads. The keys must be strictly increasing; if they are
+    // not, returns false and leaves the tree empty.
+    template<class It>
+    bool buildFromSorted(It first, It last, size_t threads = 1){
+        destroyAll();
+        if(std::adjacent_find(first, last, [](const T& a, const T& b){ return !(a < b); }) != last){
+            return false;
+        }
+        root = build(first, last, std::max(threads, (size_t) 1));
+        currentMembers = (size_t) std::distance(first, last);
+        return true;
+    }
+
+    // Moves the keys not below key into greater, which is emptied first and
+    // shares this tree's pool afterwards. O(log n); the key counts of both
+    // are worked out again the next time they are asked for.
+    void split(const T& key, AVL& greater){
+        if(&greater == this){
+            return;
+        }
+        greater.sharePool(*this);
+        uint32_t less, match, more;
+        split(root, key, less, match, more);
+        if(match){
+            more = join(0, match, more);
+        }
+        root = less;
+        greater.root = more;
+        currentMembers = UNCOUNTED;
+        greater.currentMembers = UNCOUNTED;
+    }
+
+    // Appends the keys of right, which must all be above this tree's, and
+    // leaves right empty. O(log n) when the trees share a pool, else right's
+    // keys are copied over first. Returns false, changing nothing, if the
+    // key ranges overlap.
+    bool join(AVL& right){
+        if(&right == this){
+            return false;
+        }
+        if(root && right.root){
+            uint32_t hi = root;
+            while(node(hi).rc) hi = node(hi).rc;
+            uint32_t lo = right.root;
+            while(right.node(lo).lc) lo = right.node(lo).lc;
+            if(!(node(hi).data < right.node(lo).data)){
+                return false;
+            }
+        }
+        size_t count;
+        uint32_t t = adopt(right, 1, count);
+        root = join2(root, t);
+        if(count == UNCOUNTED){
+            currentMembers = UNCOUNTED;
+        }else if(currentMembers != UNCOUNTED){
+            currentMembers += count;
+        }
+        return true;
+    }
+
+    // The set operations leave the result in this tree and other empty.
+    // Their recursive halves run on up to threads threads. Work is
+    // O(m log(n / m + 1)) for sizes m <= n, plus O(m) to copy other's keys
+    // over when the pools differ.
+    void setUnion(AVL& other, size_t threads = 1){
+        if(&other != this){
+            combine(other, std::max(threads, (size_t) 1), &AVL::unite);
+        }
+    }
+
+    void setIntersection(AVL& other, size_t threads = 1){
+        if(&other != this){
+            combine(other, std::max(threads, (size_t) 1), &AVL::intersect);
+        }
+    }
+
+    // removes other's keys from this tree
+    void setDifference(AVL& other, size_t threads = 1){
+        if(&other == this){
+            destroyAll();
+        }else{
+            combine(other, std::max(threads, (size_t) 1), &AVL::subtract);
+        }
+    }
+
+    // number of keys less than val
+    size_t rank(const T& val){
+        static_assert(ORDER_STATS, "rank needs AVL<T, true>");
+        size_t r = 0;
+        uint32_t i = root;
+        while(i){
+            NodeT& n = node(i);
+            if(val < n.data){
+                i = n.lc;
+            }else if(n.data < val){
+                r += size(n.lc) + 1;
+                i = n.rc;
+            }else{
+                return r + size(n.lc);
+            }
+        }
+        return r;
+    }
+
+    // the k-th smallest key, counting from 0, or nullptr if there are not
+    // that many
+    const T* select(size_t k){
+        static_assert(ORDER_STATS, "select needs AVL<T, true>");
+        uint32_t i = root;
+        while(i){
+            NodeT& n = node(i);
+            size_t left = size(n.lc);
+            if(k < left){
+                i = n.lc;
+            }else if(k > left){
+                k -= left + 1;
+                i = n.rc;
+            }else{
+                return &n.data;
+            }
+        }
+        return nullptr;
+    }
+
+    // number of keys in [lo, hi)
+    size_t countRange(const T& lo, const T& hi){
+        static_assert(ORDER_STATS, "countRange needs AVL<T, true>");
+        return (lo < hi) ? rank(hi) - rank(lo) : 0;
+    }
+
+    // order, stored heights (and sizes) and balance of every node, for the tests
+    bool checkInvariants(){
+        int h;
+        size_t count;
+        return checkNode(root, nullptr, nullptr, h, count) && count == getCurrentMembers();
+    }
+
     void printTree() {
         _printTree(root);
     }
-    
-    void _printTree(Node<T>* n, std::string indent = "") {
-        if(n){
-            std::cout << indent << n->data << " (h:" << n->h << ")" << std::endl;
-            _printTree(n->lc, indent + "  ");
-            _printTree(n->rc, indent + "  ");
+};
+
+// A persistent AVL set for one writer and many readers that never block.
+// insert and erase leave every published node as it is: they copy the path
+// from the root down, and any node a rotation touches, then publish the
+// new root with one atomic store. A Snapshot keeps the version it started
+// on whole, whatever is written after; replaced nodes are retired to an
+// epoch domain and freed once no snapshot can reach them.
+//
+// This is a class of its own rather than a mode of AVL: AVL's pool grows a
+// slab table that readers could not follow safely and hands freed nodes
+// straight back out, so nodes here are plain heap allocations. Writers
+// must be serialized by the caller.
+template<class T>
+class PersistentAVL {
+    struct Node {
+        T data;
+        const Node* lc;
+        const Node* rc;
+        int8_t h;
+        // made by the write in progress, so not yet visible to readers and
+        // still free to change in place
+        bool fresh;
+    };
+
+    static const size_t MAX_HEIGHT = 64;
+
+    std::atomic<const Node*> root;
+    reclaim::EpochDomain epochs;
+    size_t currentMembers;
+    // the nodes the write in progress has made, and those it replaces
+    std::vector<Node*> made;
+    std::vector<const Node*> replaced;
+
+    static int height(const Node* n){
+        return n ? n->h : 0;
+    }
+
+    static void update(Node* n){
+        n->h = (int8_t) (1 + std::max(height(n->lc), height(n->rc)));
+    }
+
+    static void destroy(void* p){
+        delete static_cast<Node*>(p);
+    }
+
+    Node* make(const T& val){
+        Node* n = new Node{val, nullptr, nullptr, 1, true};
+        made.push_back(n);
+        return n;
+    }
+
+    // n itself if this write made it, else a copy standing in for it
+    Node* own(const Node* n){
+        if(n->fresh){
+            return const_cast<Node*>(n);
+        }
+        Node* copy = new Node(*n);
+        copy->fresh = true;
+        made.push_back(copy);
+        replaced.push_back(n);
+        return copy;
+    }
+
+    Node* rotateRight(Node* n){
+        Node* l = own(n->lc);
+        n->lc = l->rc;
+        l->rc = n;
+        update(n);
+        update(l);
+        return l;
+    }
+
+    Node* rotateLeft(Node* n){
+        Node* r = own(n->rc);
+        n->rc = r->lc;
+        r->lc = n;
+        update(n);
+        update(r);
+        return r;
+    }
+
+    // the LL/LR/RR/RL cases of AVL::rebalance, on copies
+    Node* rebalance(Node* n){
+        int hl = height(n->lc);
+        int hr = height(n->rc);
+        if(hl - hr == 2){
+            const Node* l = n->lc;
+            if(height(l->lc) < height(l->rc)){
+                n->lc = rotateLeft(own(l));
+            }
+            return rotateRight(n);
+        }
+        if(hr - hl == 2){
+            const Node* r = n->rc;
+            if(height(r->rc) < height(r->lc)){
+                n->rc = rotateRight(own(r));
+            }
+            return rotateLeft(n);
+        }
+        update(n);
+        return n;
+    }
+
+    // copies path[0, depth) bottom up, hanging child under the last one, and
+    // publishes the new root. Everything that can throw happens before the
+    // store; from there on the write cannot be abandoned.
+    void commit(const Node** path, const bool* right, size_t depth, const Node* child){
+        for(size_t i = depth; i-- > 0;){
+            Node* n = own(path[i]);
+            (right[i] ? n->rc : n->lc) = child;
+            child = rebalance(n);
+        }
+        epochs.reserve(replaced.size());
+        for(Node* n : made){
+            n->fresh = false;
+        }
+        made.clear();
+        root.store(child, std::memory_order_seq_cst);
+        for(const Node* n : replaced){
+            epochs.retire(const_cast<Node*>(n), destroy);
+        }
+        replaced.clear();
+    }
+
+    // drops a write that failed before publishing; once commit has stored
+    // the root, made is empty and this frees nothing
+    void abandon(){
+        for(Node* n : made){
+            delete n;
+        }
+        made.clear();
+        replaced.clear();
+    }
+
+    static bool checkNode(const Node* n, const T* lo, const T* hi, int& h, size_t& count){
+        if(!n){
+            h = 0;
+            count = 0;
+            return true;
+        }
+        if((lo && !(*lo < n->data)) || (hi && !(n->data < *hi))){
+            return false;
         }
+        int hl, hr;
+        size_t cl, cr;
+        if(!checkNode(n->lc, lo, &n->data, hl, cl) || !checkNode(n->rc, &n->data, hi, hr, cr)){
+            return false;
+        }
+        h = 1 + std::max(hl, hr);
+        count = 1 + cl + cr;
+        return n->h == h && hl - hr <= 1 && hr - hl <= 1;
+    }
+
+public:
+    class Reader;
+
+    // One version of the set, readable for as long as the handle lives.
+    class Snapshot {
+        Reader* reader;
+        const Node* top;
+
+        Snapshot(Reader* r, const Node* t): reader(r), top(t) {}
+        friend class Reader;
+
+    public:
+        Snapshot(const Snapshot&) = delete;
+        Snapshot& operator=(const Snapshot&) = delete;
+
+        Snapshot(Snapshot&& other) noexcept: reader(other.reader), top(other.top) {
+            other.reader = nullptr;
+        }
+
+        ~Snapshot(){
+            if(reader){
+                reader->unpin();
+            }
+        }
+
+        const T* find(const T& val) const {
+            const Node* n = top;
+            while(n){
+                if(val < n->data){
+                    n = n->lc;
+                }else if(n->data < val){
+                    n = n->rc;
+                }else{
+                    return &n->data;
+                }
+            }
+            return nullptr;
+        }
+
+        // the first key not below val, or nullptr
+        const T* lowerBound(const T& val) const {
+            const T* best = nullptr;
+            const Node* n = top;
+            while(n){
+                if(n->data < val){
+                    n = n->rc;
+                }else{
+                    best = &n->data;
+                    n = n->lc;
+                }
+            }
+            return best;
+        }
+
+        // calls f on every key in order
+        template<class F>
+        void forEach(F&& f) const {
+            const Node* stack[MAX_HEIGHT];
+            size_t depth = 0;
+            const Node* n = top;
+            while(n || depth > 0){
+                while(n){
+                    stack[depth++] = n;
+                    n = n->lc;
+                }
+                n = stack[--depth];
+                f(n->data);
+                n = n->rc;
+            }
+        }
+
+        size_t getHeight() const {
+            return (size_t) height(top);
+        }
+
+        bool checkInvariants() const {
+            int h;
+            size_t count;
+            return checkNode(top, nullptr, nullptr, h, count);
+        }
+    };
+
+    // A reader thread's epoch slot, claimed for as long as the Reader lives.
+    // Its snapshots may overlap; the slot stays announced until the last
+    // one goes.
+    class Reader {
+        PersistentAVL& tree;
+        size_t slot;
+        size_t pins;
+
+        void unpin(){
+            pins -= 1;
+            if(pins == 0){
+                tree.epochs.exit(slot);
+            }
+        }
+
+        friend class Snapshot;
+
+    public:
+        // throws std::length_error past EpochDomain::MAX_READERS readers
+        explicit Reader(PersistentAVL& t): tree(t), slot(t.epochs.claim()), pins(0) {}
+
+        Reader(const Reader&) = delete;
+        Reader& operator=(const Reader&) = delete;
+
+        ~Reader(){
+            tree.epochs.unclaim(slot);
+        }
+
+        Snapshot snapshot(){
+            if(pins == 0){
+                tree.epochs.enter(slot);
+            }
+            pins += 1;
+            return Snapshot(this, tree.root.load(std::memory_order_seq_cst));
+        }
+    };
+
+    PersistentAVL(): root(nullptr), currentMembers(0) {}
+
+    PersistentAVL(const PersistentAVL&) = delete;
+    PersistentAVL& operator=(const PersistentAVL&) = delete;
+
+    // every Reader must be gone by now
+    ~PersistentAVL(){
+        std::vector<const Node*> stack;
+        const Node* top = root.load(std::memory_order_relaxed);
+        if(top) stack.push_back(top);
+        while(!stack.empty()){
+            const Node* n = stack.back();
+            stack.pop_back();
+            if(n->lc) stack.push_back(n->lc);
+            if(n->rc) stack.push_back(n->rc);
+            delete n;
+        }
+    }
+
+    size_t getCurrentMembers(){
+        return currentMembers;
+    }
+
+    // retired nodes still waiting for readers to move on
+    size_t getPendingReclaim(){
+        return epochs.getPending();
+    }
+
+    // frees what it can now instead of at the next batch of writes
+    size_t collect(){
+        return epochs.collect();
+    }
+
+    // returns false if val was already there
+    bool insert(const T& val){
+        const Node* path[MAX_HEIGHT];
+        bool right[MAX_HEIGHT];
+        size_t depth = 0;
+        const Node* n = root.load(std::memory_order_relaxed);
+        while(n){
+            if(val < n->data){
+                path[depth] = n;
+                right[depth++] = false;
+                n = n->lc;
+            }else if(n->data < val){
+                path[depth] = n;
+                right[depth++] = true;
+                n = n->rc;
+            }else{
+                return false;
+            }
+        }
+        try{
+            commit(path, right, depth, make(val));
+        }catch(...){
+            abandon();
+            throw;
+        }
+        currentMembers += 1;
+        return true;
+    }
+
+    bool erase(const T& val){
+        const Node* path[MAX_HEIGHT];
+        bool right[MAX_HEIGHT];
+        size_t depth = 0;
+        const Node* n = root.load(std::memory_order_relaxed);
+        while(n){
+            if(val < n->data){
+                path[depth] = n;
+                right[depth++] = false;
+                n = n->lc;
+            }else if(n->data < val){
+                path[depth] = n;
+                right[depth++] = true;
+                n = n->rc;
+            }else{
+                break;
+            }
+        }
+        if(!n){
+            return false;
+        }
+        try{
+            if(n->lc && n->rc){
+                // the copy of n takes the in-order successor's value, and the
+                // successor is unlinked instead
+                size_t target = depth;
+                path[depth] = n;
+                right[depth++] = true;
+                const Node* s = n->rc;
+                while(s->lc){
+                    path[depth] = s;
+                    right[depth++] = false;
+                    s = s->lc;
+                }
+                Node* copy = own(n);
+                copy->data = s->data;
+                path[target] = copy;
+                replaced.push_back(s);
+                commit(path, right, depth, s->rc);
+            }else{
+                replaced.push_back(n);
+                commit(path, right, depth, n->lc ? n->lc : n->rc);
+            }
+        }catch(...){
+            abandon();
+            throw;
+        }
+        currentMembers -= 1;
+        return true;
+    }
+
+    // the current version, for the writer's thread
+    bool checkInvariants(){
+        int h;
+        size_t count;
+        return checkNode(root.load(std::memory_order_relaxed), nullptr, nullptr, h, count) && count == currentMembers;
     }
-        
-    
 };
 
 void testDoubleRotation(){
-    
+
     std::cout << std::string(40, '-') << "\n";
     std::cout << "Testing double Rotations >> (20, 10, 5)" << std::endl;
     std::cout << std::string(40, '-') << "\n";
-    
+
     AVL tree = AVL<int>();
     tree.insert(20);
     tree.insert(10);
@@ -202,11 +1428,11 @@ void testDoubleRotation(){
 }
 
 void testLL(){
-    
+
     std::cout << std::string(40, '-') << "\n";
     std::cout << "Testing LL Rotations >> (20, 10, 5)" << std::endl;
     std::cout << std::string(40, '-') << "\n";
-    
+
     AVL tree = AVL<int>();
     tree.insert(20);
     tree.insert(10);
@@ -216,11 +1442,11 @@ void testLL(){
 }
 
 void testRR(){
-    
+
     std::cout << std::string(40, '-') << "\n";
     std::cout << "Testing RR Rotations >> (20, 30, 40)" << std::endl;
     std::cout << std::string(40, '-') << "\n";
-    
+
     AVL tree = AVL<int>();
     tree.insert(20);
     tree.insert(30);
@@ -230,11 +1456,11 @@ void testRR(){
 }
 
 void testLR(){
-    
+
     std::cout << std::string(40, '-') << "\n";
     std::cout << "Testing LR Rotations >> (20, 10, 15)" << std::endl;
     std::cout << std::string(40, '-') << "\n";
-    
+
     AVL tree = AVL<int>();
     tree.insert(20);
     tree.insert(10);
@@ -244,11 +1470,11 @@ void testLR(){
 }
 
 void testRL(){
-    
+
     std::cout << std::string(40, '-') << "\n";
     std::cout << "Testing RL Rotations >> (20, 30, 25)" << std::endl;
     std::cout << std::string(40, '-') << "\n";
-    
+
     AVL tree = AVL<int>();
     tree.insert(20);
     tree.insert(30);
@@ -257,6 +1483,429 @@ void testRL(){
     std::cout << std::string(40, '-') << "\n\n";
 }
 
+bool testInsertAndFind() {
+    AVL<int> tree;
+    // sorted input is the worst case for an unbalanced tree
+    for(int i = 0; i < 100000; i++) {
+        if(!tree.insert(i)) return false;
+    }
+    if(tree.insert(500) || tree.getCurrentMembers() != 100000) return false;
+    // an AVL tree of n nodes is under 1.45 log2(n) high
+    if(tree.getHeight() > 25 || !tree.checkInvariants()) return false;
+    for(int i = 0; i < 100000; i++) {
+        const int* found = tree.find(i);
+        if(!found || *found != i) return false;
+    }
+    return tree.find(-1) == nullptr && tree.find(100000) == nullptr;
+}
+
+bool testErase() {
+    AVL<std::string> tree;
+    std::set<std::string> reference;
+    std::mt19937 rng(6);
+    for(int i = 0; i < 40000; i++) {
+        std::string key = std::to_string(rng() % 5000);
+        if(rng() % 2 == 0) {
+            if(tree.erase(key) != (reference.erase(key) == 1)) return false;
+        } else {
+            if(tree.insert(key) != reference.insert(key).second) return false;
+        }
+    }
+    if(!tree.checkInvariants() || tree.getCurrentMembers() != reference.size()) return false;
+    for(int i = 0; i < 5000; i++) {
+        std::string key = std::to_string(i);
+        if((tree.find(key) != nullptr) != (reference.count(key) == 1)) return false;
+    }
+    for(const std::string& key : reference) {
+        if(!tree.erase(key)) return false;
+    }
+    return tree.getCurrentMembers() == 0 && tree.getHeight() == 0 && tree.checkInvariants();
+}
+
+bool testChurn() {
+    // erased nodes are reused, so a steady working set keeps its slabs
+    AVL<uint64_t> tree;
+    std::vector<uint64_t> live;
+    std::mt19937_64 rng(7);
+    for(int i = 0; i < 10000; i++) {
+        live.push_back(rng());
+        tree.insert(live.back());
+    }
+    size_t slabs = tree.getSlabCount();
+    for(int i = 0; i < 200000; i++) {
+        size_t victim = rng() % live.size();
+        if(!tree.erase(live[victim])) return false;
+        live[victim] = rng();
+        tree.insert(live[victim]);
+    }
+    return tree.getSlabCount() == slabs && tree.getCurrentMembers() == live.size() && tree.checkInvariants();
+}
+
+bool testReset() {
+    AVL<std::string> tree;
+    for(int i = 0; i < 5000; i++) {
+        tree.insert(std::to_string(i));
+    }
+    if(!tree.reset()) return false;
+    if(tree.getCurrentMembers() != 0 || tree.getSlabCount() != 0 || tree.find("1") != nullptr) return false;
+    tree.insert("one");
+    return *tree.find("one") == "one";
+}
+
+bool testOrderStatistics() {
+    AVL<int, true> tree;
+    std::set<int> reference;
+    std::mt19937 rng(8);
+    for(int i = 0; i < 30000; i++) {
+        int key = (int) (rng() % 4000);
+        if(rng() % 3 == 0) {
+            tree.erase(key);
+            reference.erase(key);
+        } else {
+            tree.insert(key);
+            reference.insert(key);
+        }
+    }
+    // sizes are checked alongside heights
+    if(!tree.checkInvariants()) return false;
+    std::vector<int> sorted(reference.begin(), reference.end());
+    for(size_t k = 0; k < sorted.size(); k++) {
+        const int* found = tree.select(k);
+        if(!found || *found != sorted[k] || tree.rank(sorted[k]) != k) return false;
+    }
+    if(tree.select(sorted.size()) != nullptr) return false;
+    for(int round = 0; round < 1000; round++) {
+        int lo = (int) (rng() % 4200) - 100;
+        int hi = lo + (int) (rng() % 1000);
+        size_t expected = (size_t) std::distance(reference.lower_bound(lo), reference.lower_bound(hi));
+        if(tree.countRange(lo, hi) != expected) return false;
+    }
+    return tree.countRange(10, 10) == 0 && tree.countRange(10, 5) == 0 && tree.rank(-1) == 0;
+}
+
+bool testBuildFromSorted() {
+    for(size_t threads : {(size_t) 1, (size_t) 4}) {
+        for(int n : {0, 1, 2, 3, 100, 1023, 1024, 70000}) {
+            std::vector<int> keys;
+            for(int i = 0; i < n; i++) keys.push_back(3 * i);
+            AVL<int> tree;
+            if(!tree.buildFromSorted(keys.begin(), keys.end(), threads)) return false;
+            // perfectly balanced: the least height n keys can have
+            size_t minHeight = 0;
+            while(((size_t) 1 << minHeight) <= (size_t) n) minHeight++;
+            if(tree.getHeight() != minHeight || !tree.checkInvariants()) return false;
+            for(int k : keys) {
+                if(!tree.find(k) || tree.find(k + 1)) return false;
+            }
+            if(!tree.insert(-1) || tree.erase(0) != (n > 0) || !tree.checkInvariants()) return false;
+        }
+    }
+    AVL<std::string> tree;
+    tree.insert("stale");
+    std::vector<std::string> unsorted{"a", "c", "b"};
+    std::vector<std::string> duplicated{"a", "b", "b"};
+    if(tree.buildFromSorted(unsorted.begin(), unsorted.end()) || tree.getCurrentMembers() != 0) return false;
+    if(tree.buildFromSorted(duplicated.begin(), duplicated.end()) || tree.find("a")) return false;
+    return tree.checkInvariants();
+}
+
+template<bool ORDER_STATS>
+bool checkSplitAndJoin() {
+    std::vector<int> keys;
+    for(int i = 0; i < 20000; i += 2) keys.push_back(i);
+    for(int key : {-1, 0, 7, 5000, 5001, 19998, 30000}) {
+        AVL<int, ORDER_STATS> tree, greater;
+        tree.buildFromSorted(keys.begin(), keys.end());
+        greater.insert(123456);
+        tree.split(key, greater);
+        size_t below = (size_t) (std::lower_bound(keys.begin(), keys.end(), key) - keys.begin());
+        if(!tree.checkInvariants() || !greater.checkInvariants()) return false;
+        if(tree.getCurrentMembers() != below || greater.getCurrentMembers() != keys.size() - below) return false;
+        if(greater.find(123456) || (key % 2 == 0 && key >= 0 && key < 20000 && !greater.find(key))) return false;
+        // greater now shares the pool, so joining back only relinks
+        if(!tree.join(greater) || greater.getCurrentMembers() != 0) return false;
+        if(tree.getCurrentMembers() != keys.size() || !tree.checkInvariants()) return false;
+    }
+    AVL<int, ORDER_STATS> low, high;
+    for(int i = 0; i < 1000; i++) low.insert(i);
+    for(int i = 999; i < 5000; i++) high.insert(i);
+    // overlapping ranges are refused
+    if(low.join(high) || high.getCurrentMembers() != 4001) return false;
+    high.erase(999);
+    // separate pools: high's keys are copied over
+    if(!low.join(high) || low.getCurrentMembers() != 5000 || !low.checkInvariants()) return false;
+    return high.getCurrentMembers() == 0 && high.getSlabCount() == 0 && low.find(4999);
+}
+
+bool testSplitAndJoin() {
+    return checkSplitAndJoin<false>() && checkSplitAndJoin<true>();
+}
+
+template<class T, bool ORDER_STATS>
+bool checkSetOperation(int op, const std::set<T>& a, const std::set<T>& b, size_t threads, bool shared) {
+    std::vector<T> expected;
+    if(op == 0){
+        std::set_union(a.begin(), a.end(), b.begin(), b.end(), std::back_inserter(expected));
+    }else if(op == 1){
+        std::set_intersection(a.begin(), a.end(), b.begin(), b.end(), std::back_inserter(expected));
+    }else{
+        std::set_difference(a.begin(), a.end(), b.begin(), b.end(), std::back_inserter(expected));
+    }
+    AVL<T, ORDER_STATS> left, right;
+    if(shared) right.sharePool(left);
+    left.buildFromSorted(a.begin(), a.end());
+    for(const T& key : b) right.insert(key);
+    if(op == 0){
+        left.setUnion(right, threads);
+    }else if(op == 1){
+        left.setIntersection(right, threads);
+    }else{
+        left.setDifference(right, threads);
+    }
+    if(!left.checkInvariants() || left.getCurrentMembers() != expected.size() || right.getCurrentMembers() != 0) return false;
+    for(const T& key : expected) {
+        if(!left.find(key)) return false;
+    }
+    // a union with the leftovers of b finds every node freed or in use
+    for(const T& key : b) right.insert(key);
+    left.setUnion(right);
+    return left.checkInvariants();
+}
+
+bool testSetOperations() {
+    std::mt19937 rng(9);
+    std::set<int> a, b;
+    for(int i = 0; i < 60000; i++) a.insert((int) (rng() % 200000));
+    for(int i = 0; i < 40000; i++) b.insert((int) (rng() % 200000));
+    std::set<int> few{5, 77, 1000, 150000, 500000};
+    std::set<int> none;
+    for(int op = 0; op < 3; op++) {
+        for(size_t threads : {(size_t) 1, (size_t) 4}) {
+            for(bool shared : {false, true}) {
+                if(!checkSetOperation<int, false>(op, a, b, threads, shared)) return false;
+                if(!checkSetOperation<int, true>(op, b, a, threads, shared)) return false;
+                if(!checkSetOperation<int, false>(op, a, few, threads, shared)) return false;
+                if(!checkSetOperation<int, false>(op, few, a, threads, shared)) return false;
+                if(!checkSetOperation<int, false>(op, a, none, threads, shared)) return false;
+                if(!checkSetOperation<int, false>(op, none, a, threads, shared)) return false;
+            }
+        }
+    }
+    // values with destructors go back to the pool through release
+    std::set<std::string> s, t;
+    for(int i = 0; i < 3000; i++) s.insert(std::to_string(rng() % 5000));
+    for(int i = 0; i < 3000; i++) t.insert(std::to_string(rng() % 5000));
+    for(int op = 0; op < 3; op++) {
+        if(!checkSetOperation<std::string, false>(op, s, t, 2, true)) return false;
+    }
+    AVL<int> self;
+    for(int i = 0; i < 100; i++) self.insert(i);
+    self.setUnion(self);
+    self.setIntersection(self);
+    if(self.getCurrentMembers() != 100) return false;
+    self.setDifference(self);
+    return self.getCurrentMembers() == 0 && self.checkInvariants();
+}
+
+bool testFreeze() {
+    std::mt19937 rng(10);
+    for(int n : {0, 1, 2, 7, 8, 1000, 65535, 65536, 100000}) {
+        AVL<int> tree;
+        std::set<int> reference;
+        while((int) reference.size() < n) {
+            int key = (int) (rng() % (4 * (unsigned) n + 1));
+            tree.insert(key);
+            reference.insert(key);
+        }
+        EytzingerSet<int> frozen = tree.freeze();
+        if(frozen.getCurrentMembers() != reference.size()) return false;
+        for(int probe = -2; probe <= 4 * n + 2; probe++) {
+            auto it = reference.lower_bound(probe);
+            const int* bound = frozen.lowerBound(probe);
+            if((it == reference.end()) != (bound == nullptr) || (bound && *bound != *it)) return false;
+            const int* found = frozen.find(probe);
+            if((found != nullptr) != (reference.count(probe) == 1) || (found && *found != probe)) return false;
+        }
+    }
+    AVL<std::string> words;
+    for(int i = 0; i < 500; i++) words.insert(std::to_string(i));
+    EytzingerSet<std::string> frozen = words.freeze();
+    // the tree is left as it was
+    if(words.getCurrentMembers() != 500 || !words.checkInvariants()) return false;
+    return frozen.find("42") && *frozen.find("42") == "42" && !frozen.find("500")
+        && *frozen.lowerBound("4990") == "5" && !frozen.lowerBound("9a");
+}
+
+bool testPersistentSnapshots() {
+    PersistentAVL<int> tree;
+    PersistentAVL<int>::Reader early(tree), late(tree);
+    std::set<int> reference;
+    std::mt19937 rng(11);
+    for(int i = 0; i < 2000; i++) {
+        int key = (int) (rng() % 3000);
+        if(tree.insert(key) != reference.insert(key).second) return false;
+    }
+    auto before = early.snapshot();
+    std::vector<int> expected(reference.begin(), reference.end());
+    for(int i = 0; i < 20000; i++) {
+        int key = (int) (rng() % 3000);
+        if(rng() % 2 == 0) {
+            if(tree.erase(key) != (reference.erase(key) == 1)) return false;
+        } else {
+            if(tree.insert(key) != reference.insert(key).second) return false;
+        }
+    }
+    if(!tree.checkInvariants() || tree.getCurrentMembers() != reference.size()) return false;
+    // the old version is untouched by every write since, and holds back
+    // the nodes those writes replaced
+    std::vector<int> seen;
+    before.forEach([&](int key){ seen.push_back(key); });
+    if(seen != expected || !before.checkInvariants() || tree.getPendingReclaim() == 0) return false;
+    {
+        auto now = late.snapshot();
+        auto again = late.snapshot();
+        seen.clear();
+        now.forEach([&](int key){ seen.push_back(key); });
+        if(seen != std::vector<int>(reference.begin(), reference.end())) return false;
+        for(int probe = -1; probe <= 3001; probe++) {
+            auto it = reference.lower_bound(probe);
+            const int* bound = again.lowerBound(probe);
+            if((it == reference.end()) != (bound == nullptr) || (bound && *bound != *it)) return false;
+            if((now.find(probe) != nullptr) != (reference.count(probe) == 1)) return false;
+        }
+    }
+    {
+        // moving a snapshot keeps it pinned once
+        auto moved = std::move(before);
+        if(!moved.find(expected.front())) return false;
+    }
+    // with no snapshot left, two epoch advances free everything retired
+    tree.collect();
+    tree.collect();
+    if(tree.getPendingReclaim() != 0) return false;
+
+    PersistentAVL<std::string> words;
+    PersistentAVL<std::string>::Reader reader(words);
+    for(int i = 0; i < 300; i++) words.insert(std::to_string(i));
+    auto old = reader.snapshot();
+    for(int i = 0; i < 300; i += 2) words.erase(std::to_string(i));
+    return old.find("0") && !words.erase("0") && words.getCurrentMembers() == 150 && words.checkInvariants();
+}
+
+// a value whose copies start failing once a shared budget runs out
+struct FailingCopy {
+    static int budget;
+    int value;
+
+    FailingCopy(int v): value(v) {}
+
+    FailingCopy(const FailingCopy& other): value(other.value) {
+        spend();
+    }
+
+    FailingCopy& operator=(const FailingCopy& other) {
+        spend();
+        value = other.value;
+        return *this;
+    }
+
+    static void spend() {
+        if(budget-- <= 0) throw std::bad_alloc();
+    }
+
+    bool operator<(const FailingCopy& other) const {
+        return value < other.value;
+    }
+};
+
+int FailingCopy::budget = 1 << 30;
+
+// a write that throws part way leaves the published version, and every
+// snapshot of it, as it was
+bool testPersistentFailedWrites() {
+    PersistentAVL<FailingCopy> tree;
+    PersistentAVL<FailingCopy>::Reader reader(tree);
+    std::set<int> reference;
+    std::mt19937 rng(5);
+    auto contents = [](const PersistentAVL<FailingCopy>::Snapshot& snap){
+        std::vector<int> seen;
+        snap.forEach([&](const FailingCopy& v){ seen.push_back(v.value); });
+        return seen;
+    };
+    for(int i = 0; i < 3000; i++) {
+        int key = (int) (rng() % 1000);
+        bool insert = rng() % 3 != 0;
+        auto before = reader.snapshot();
+        // a budget of up to a path's worth of copies fails most writes
+        FailingCopy::budget = (int) (rng() % 24);
+        bool threw = false;
+        bool changed = false;
+        try {
+            changed = insert ? tree.insert(FailingCopy(key)) : tree.erase(FailingCopy(key));
+        } catch(const std::bad_alloc&) {
+            threw = true;
+        }
+        FailingCopy::budget = 1 << 30;
+        if(!threw && changed) {
+            if(insert) reference.insert(key);
+            else reference.erase(key);
+        }
+        std::vector<int> expected(reference.begin(), reference.end());
+        if(contents(reader.snapshot()) != expected || tree.getCurrentMembers() != reference.size()) return false;
+        if(threw && contents(before) != expected) return false;
+        if(!tree.checkInvariants()) return false;
+    }
+    return true;
+}
+
+bool testPersistentConcurrentReaders() {
+    // the writer slides a window of keys up, so every version it publishes
+    // is a run of consecutive keys, which is all a reader may ever see
+    const int WINDOW = 500;
+    const int WRITES = 20000;
+    const int READERS = 3;
+    PersistentAVL<int> tree;
+    std::atomic<bool> done(false);
+    std::atomic<bool> ok(true);
+    std::atomic<int> started(0);
+    std::vector<std::thread> readers;
+    for(int t = 0; t < READERS; t++) {
+        readers.emplace_back([&]{
+            PersistentAVL<int>::Reader reader(tree);
+            started += 1;
+            while(!done.load()) {
+                auto snap = reader.snapshot();
+                int first = 0, last = 0;
+                size_t count = 0;
+                bool run = true;
+                snap.forEach([&](int key){
+                    if(count == 0) first = key;
+                    else if(key != last + 1) run = false;
+                    last = key;
+                    count += 1;
+                });
+                if(!run || count > (size_t) WINDOW + 1 || !snap.checkInvariants()
+                   || (count > 0 && (!snap.find(first) || snap.find(last + 1)))) {
+                    ok = false;
+                }
+            }
+        });
+    }
+    while(started.load() < READERS) {
+        std::this_thread::yield();
+    }
+    for(int i = 0; i < WRITES; i++) {
+        tree.insert(i);
+        if(i >= WINDOW) tree.erase(i - WINDOW);
+    }
+    done = true;
+    for(auto& reader : readers) {
+        reader.join();
+    }
+    tree.collect();
+    tree.collect();
+    return ok && tree.checkInvariants() && tree.getCurrentMembers() == (size_t) WINDOW && tree.getPendingReclaim() == 0;
+}
 
 void runTests(){
     testDoubleRotation();
@@ -264,6 +1913,257 @@ void runTests(){
     testRR();
     testLR();
     testRL();
+
+    int count = 0;
+    int total = 12;
+
+    tests::test(count, "Testing Insert and Find", testInsertAndFind);
+    tests::test(count, "Testing Erase", testErase);
+    tests::test(count, "Testing Churn", testChurn);
+    tests::test(count, "Testing Reset", testReset);
+    tests::test(count, "Testing Order Statistics", testOrderStatistics);
+    tests::test(count, "Testing Build From Sorted", testBuildFromSorted);
+    tests::test(count, "Testing Split and Join", testSplitAndJoin);
+    tests::test(count, "Testing Set Operations", testSetOperations);
+    tests::test(count, "Testing Freeze", testFreeze);
+    tests::test(count, "Testing Persistent Snapshots", testPersistentSnapshots);
+    tests::test(count, "Testing Persistent Concurrent Readers", testPersistentConcurrentReaders);
+    tests::test(count, "Testing Persistent Failed Writes", testPersistentFailedWrites);
+
+    std::cout << std::string(40, '-') << "\n";
+    std::cout << " -- AVL: Passed [" << count << "/" << total << "] tests -- " << std::endl;
+
+    std::cout << std::string(40, '-') << "\n\n";
+}
+
+// Sorted build, then union, intersection and difference of two sets of
+// setSize keys that share half of them, on 1, 2, 4, ... threads. The trees
+// share a pool, so the timings are of the join-based algorithms alone;
+// each op gets fresh trees, built outside the timed part.
+void runSetBenchmarks(size_t setSize) {
+    std::vector<uint64_t> a = bench::uniformKeys(setSize, 21);
+    std::sort(a.begin(), a.end());
+    a.erase(std::unique(a.begin(), a.end()), a.end());
+    std::vector<uint64_t> b = bench::uniformKeys(setSize / 2, 22);
+    for(size_t i = 0; i < a.size(); i += 2) b.push_back(a[i]);
+    std::sort(b.begin(), b.end());
+    b.erase(std::unique(b.begin(), b.end()), b.end());
+    std::cout << "  sets of " << a.size() << " and " << b.size() << " keys\n";
+
+    size_t maxThreads = std::max(1u, std::thread::hardware_concurrency());
+    const char* names[] = {"union", "intersection", "difference"};
+    double single[4] = {0, 0, 0, 0};
+    for(size_t threads = 1; threads <= maxThreads; threads *= 2){
+        std::string suffix = " [" + std::to_string(threads) + " threads]";
+        {
+            AVL<uint64_t> tree;
+            std::string label = "AVL buildFromSorted" + suffix;
+            double t = bench::run(label.c_str(), a.size(), [&]{
+                tree.buildFromSorted(a.begin(), a.end(), threads);
+            });
+            if(threads == 1) single[3] = t;
+            else std::cout << "  speedup: " << single[3] / t << "x\n";
+        }
+        for(int op = 0; op < 3; op++){
+            AVL<uint64_t> left, right;
+            right.sharePool(left);
+            left.buildFromSorted(a.begin(), a.end());
+            right.buildFromSorted(b.begin(), b.end());
+            std::string label = std::string("AVL ") + names[op] + suffix;
+            double t = bench::run(label.c_str(), a.size() + b.size(), [&]{
+                if(op == 0) left.setUnion(right, threads);
+                else if(op == 1) left.setIntersection(right, threads);
+                else left.setDifference(right, threads);
+            });
+            if(threads == 1) single[op] = t;
+            else std::cout << "  speedup: " << single[op] / t << "x\n";
+        }
+    }
+    {
+        // what the set operations replace: one insert per key of b
+        AVL<uint64_t> tree;
+        tree.buildFromSorted(a.begin(), a.end());
+        bench::run("AVL union by repeated insert", a.size() + b.size(), [&]{
+            for(auto k : b) tree.insert(k);
+        });
+    }
+    {
+        // trees with pools of their own: b's keys are copied over first
+        AVL<uint64_t> left, right;
+        left.buildFromSorted(a.begin(), a.end());
+        right.buildFromSorted(b.begin(), b.end());
+        bench::run("AVL union, separate pools [1 threads]", a.size() + b.size(), [&]{
+            left.setUnion(right);
+        });
+    }
+}
+
+// One writer re-inserting keys flat out while 1, 2, 4, ... readers look
+// keys up: readers of PersistentAVL take a snapshot per lookup, readers of
+// the locked AVL take the shared lock per lookup.
+void runReaderScalingBenchmarks(const std::vector<uint64_t>& keys) {
+    size_t n = keys.size();
+    size_t ops = std::min(n, (size_t) 1000000);
+    size_t maxThreads = std::max(1u, std::thread::hardware_concurrency());
+
+    PersistentAVL<uint64_t> persistent;
+    AVL<uint64_t> locked;
+    std::shared_mutex lock;
+    for(auto k : keys){
+        persistent.insert(k);
+        locked.insert(k);
+    }
+
+    // runs read(t, i) on every reader while write(i) loops on its own thread
+    auto withWriter = [&](const std::string& name, size_t readers, auto&& write, auto&& read){
+        std::atomic<bool> stop(false);
+        size_t writes = 0;
+        std::thread writer([&]{
+            while(!stop.load(std::memory_order_relaxed)){
+                write(writes % n);
+                writes += 1;
+            }
+        });
+        bench::parallel(name, readers, ops, read);
+        stop = true;
+        writer.join();
+        std::cout << "  writer: " << writes << " erase + insert pairs meanwhile\n";
+    };
+
+    for(size_t readers = 1; readers <= maxThreads; readers *= 2){
+        std::vector<std::unique_ptr<PersistentAVL<uint64_t>::Reader>> handles;
+        for(size_t t = 0; t < readers; t++){
+            handles.emplace_back(new PersistentAVL<uint64_t>::Reader(persistent));
+        }
+        withWriter("PersistentAVL snapshot + find", readers, [&](size_t i){
+            persistent.erase(keys[i]);
+            persistent.insert(keys[i]);
+        }, [&](size_t t, size_t i){
+            auto snap = handles[t]->snapshot();
+            bench::doNotOptimize(snap.find(keys[(i * 7919 + t) % n]));
+        });
+        std::cout << "  pending reclaim: " << persistent.getPendingReclaim() << "\n";
+
+        withWriter("AVL + shared_mutex find", readers, [&](size_t i){
+            std::unique_lock<std::shared_mutex> guard(lock);
+            locked.erase(keys[i]);
+            locked.insert(keys[i]);
+        }, [&](size_t t, size_t i){
+            std::shared_lock<std::shared_mutex> guard(lock);
+            bench::doNotOptimize(locked.find(keys[(i * 7919 + t) % n]));
+        });
+    }
+}
+
+// insert, find, erase and a steady erase/insert churn against std::set,
+// then percentile and range count queries, which std::set can only answer
+// by walking the keys; then lookups under a busy writer and last the bulk
+// set operations
+void runBenchmarks(size_t n = 1000000, size_t setSize = 10000000) {
+    bench::header("AVL benchmarks");
+    auto keys = bench::uniformKeys(n);
+    auto fresh = bench::uniformKeys(n, 11);
+
+    {
+        AVL<uint64_t> tree;
+        bench::run("AVL insert", n, [&]{
+            for(auto k : keys) tree.insert(k);
+        });
+        bench::run("AVL find", n, [&]{
+            for(auto k : keys) bench::doNotOptimize(tree.find(k));
+        });
+        bench::run("AVL erase + insert churn", 2 * n, [&]{
+            for(size_t i = 0; i < n; i++){
+                tree.erase(keys[i]);
+                tree.insert(fresh[i]);
+            }
+        });
+        std::cout << "  slabs: " << tree.getSlabCount() << "\n";
+        bench::run("AVL erase", n, [&]{
+            for(auto k : fresh) tree.erase(k);
+        });
+    }
+    {
+        // read-only lookups: the live tree, its frozen copy and a binary
+        // search over a plain sorted array
+        AVL<uint64_t> tree;
+        for(auto k : keys) tree.insert(k);
+        EytzingerSet<uint64_t> frozen;
+        bench::run("AVL freeze", n, [&]{
+            frozen = tree.freeze();
+        });
+        std::vector<uint64_t> sorted(keys.begin(), keys.end());
+        std::sort(sorted.begin(), sorted.end());
+        bench::run("AVL find (live tree)", n, [&]{
+            for(auto k : fresh) bench::doNotOptimize(tree.find(k));
+        });
+        bench::run("EytzingerSet find", n, [&]{
+            for(auto k : fresh) bench::doNotOptimize(frozen.find(k));
+        });
+        bench::run("EytzingerSet lowerBound", n, [&]{
+            for(auto k : fresh) bench::doNotOptimize(frozen.lowerBound(k));
+        });
+        bench::run("sorted array std::lower_bound", n, [&]{
+            for(auto k : fresh) bench::doNotOptimize(std::lower_bound(sorted.begin(), sorted.end(), k));
+        });
+        std::cout << "  bytes/key: AVL " << (double) tree.getMemoryUsage() / (double) n
+                  << ", EytzingerSet " << (double) frozen.getMemoryUsage() / (double) n << "\n";
+    }
+    {
+        AVL<uint64_t, true> tree;
+        bench::run("AVL<ORDER_STATS> insert", n, [&]{
+            for(auto k : keys) tree.insert(k);
+        });
+        const size_t queries = 100000;
+        bench::run("AVL<ORDER_STATS> select (percentile)", queries, [&]{
+            for(size_t q = 0; q < queries; q++) bench::doNotOptimize(tree.select((q * 7919) % n));
+        });
+        bench::run("AVL<ORDER_STATS> rank", queries, [&]{
+            for(size_t q = 0; q < queries; q++) bench::doNotOptimize(tree.rank(keys[q % n]));
+        });
+        // ranges cover a sixteenth of what lies above their low end
+        bench::run("AVL<ORDER_STATS> countRange", queries, [&]{
+            for(size_t q = 0; q < queries; q++){
+                uint64_t lo = keys[q % n];
+                bench::doNotOptimize(tree.countRange(lo, lo + (UINT64_MAX - lo) / 16));
+            }
+        });
+        bench::run("AVL<ORDER_STATS> erase", n, [&]{
+            for(auto k : keys) tree.erase(k);
+        });
+    }
+    {
+        std::set<uint64_t> tree;
+        bench::run("std::set insert", n, [&]{
+            for(auto k : keys) tree.insert(k);
+        });
+        bench::run("std::set find", n, [&]{
+            for(auto k : keys) bench::doNotOptimize(tree.find(k));
+        });
+        bench::run("std::set erase + insert churn", 2 * n, [&]{
+            for(size_t i = 0; i < n; i++){
+                tree.erase(keys[i]);
+                tree.insert(fresh[i]);
+            }
+        });
+        bench::run("std::set erase", n, [&]{
+            for(auto k : fresh) tree.erase(k);
+        });
+        for(auto k : keys) tree.insert(k);
+        const size_t queries = 100;
+        bench::run("std::set percentile (std::next)", queries, [&]{
+            for(size_t q = 0; q < queries; q++) bench::doNotOptimize(*std::next(tree.begin(), (std::ptrdiff_t) ((q * 7919) % n)));
+        });
+        bench::run("std::set range count (std::distance)", queries, [&]{
+            for(size_t q = 0; q < queries; q++){
+                uint64_t lo = keys[q % n];
+                bench::doNotOptimize(std::distance(tree.lower_bound(lo), tree.lower_bound(lo + (UINT64_MAX - lo) / 16)));
+            }
+        });
+    }
+    runReaderScalingBenchmarks(keys);
+    runSetBenchmarks(setSize);
+    std::cout << std::string(40, '-') << "\n\n";
 }
 
 }
@@ -7,6 +7,1713 @@
 
 #ifndef BPlusTree_h
 #define BPlusTree_h
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <iterator>
+#include <list>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "Hashing.h"
+#include "Testing.h"
+#include "Benchmark.h"
+#include "BTree.h"
+#include "NodeSearch.h"
 
+namespace bplustree {
+
+// shared header, the leaf flag tells which of the two node types it is
+struct alignas(64) Node {
+    uint32_t count;
+    bool leaf;
+
+    explicit Node(bool isLeaf): count(0), leaf(isLeaf) {}
+};
+
+// values live only here; the next pointers chain all leaves in key order
+template <class K, class T, size_t LEAF_SIZE>
+struct Leaf : Node {
+    K keys[LEAF_SIZE];
+    T vals[LEAF_SIZE];
+    Leaf* next;
+
+    Leaf(): Node(true), keys(), vals(), next(nullptr) {}
+};
+
+// routing only: child i holds keys[i - 1] <= key < keys[i]
+template <class K, size_t FANOUT>
+struct Inner : Node {
+    K keys[FANOUT - 1];
+    Node* children[FANOUT];
+
+    Inner(): Node(false), keys(), children() {}
+};
+
+// B+ tree: inner nodes only route, every key/value pair sits in a leaf, and
+// the leaves form a sorted list, so a range scan finds its first leaf once
+// and then streams leaf arrays without going back through the inner nodes.
+// Like BTree, insert splits and deleteNode refills nodes on the way down.
+template <class K, class T, size_t FANOUT = btree::defaultFanout<K>(), size_t LEAF_SIZE = btree::defaultFanout<K>()>
+class BPlusTree {
+    static_assert(FANOUT >= 4 && LEAF_SIZE >= 4, "nodes need room for at least three keys");
+
+    using LeafT = Leaf<K, T, LEAF_SIZE>;
+    using InnerT = Inner<K, FANOUT>;
+
+    static constexpr size_t MAX_KEYS = FANOUT - 1;
+    static constexpr size_t MIN_KEYS = (MAX_KEYS - 1) / 2;
+    static constexpr size_t MIN_LEAF = LEAF_SIZE / 2;
+
+    Node* root;
+    size_t currentMembers;
+    size_t height;
+
+    static LeafT* asLeaf(Node* n){
+        return static_cast<LeafT*>(n);
+    }
+
+    static InnerT* asInner(Node* n){
+        return static_cast<InnerT*>(n);
+    }
+
+    static bool isFull(Node* n){
+        return n->count == (n->leaf ? LEAF_SIZE : MAX_KEYS);
+    }
+
+    static size_t minCount(Node* n){
+        return n->leaf ? MIN_LEAF : MIN_KEYS;
+    }
+
+    // keys equal to a separator live to its right
+    static size_t childIndex(InnerT* n, const K& key){
+        return nodesearch::upperBound(n->keys, n->count, key);
+    }
+
+    static size_t leafIndex(LeafT* leaf, const K& key){
+        return nodesearch::lowerBound(leaf->keys, leaf->count, key);
+    }
+
+    static void freeNode(Node* n){
+        if(n->leaf){
+            delete asLeaf(n);
+        }else{
+            delete asInner(n);
+        }
+    }
+
+    static void destroy(Node* n){
+        if(!n->leaf){
+            for(size_t i = 0; i <= n->count; i++){
+                destroy(asInner(n)->children[i]);
+            }
+        }
+        freeNode(n);
+    }
+
+    LeafT* findLeaf(const K& key){
+        Node* n = root;
+        while(!n->leaf){
+            n = asInner(n)->children[childIndex(asInner(n), key)];
+        }
+        return asLeaf(n);
+    }
+
+    LeafT* firstLeaf(){
+        Node* n = root;
+        while(!n->leaf){
+            n = asInner(n)->children[0];
+        }
+        return asLeaf(n);
+    }
+
+    // a full leaf copies its upper half's first key up as the separator,
+    // a full inner node moves its middle key up
+    void splitChild(InnerT* parent, size_t i){
+        Node* child = parent->children[i];
+        Node* right;
+        K separator;
+        if(child->leaf){
+            LeafT* left = asLeaf(child);
+            LeafT* newLeaf = new LeafT();
+            size_t mid = LEAF_SIZE / 2;
+            std::move(left->keys + mid, left->keys + LEAF_SIZE, newLeaf->keys);
+            std::move(left->vals + mid, left->vals + LEAF_SIZE, newLeaf->vals);
+            newLeaf->count = (uint32_t) (LEAF_SIZE - mid);
+            left->count = (uint32_t) mid;
+            newLeaf->next = left->next;
+            left->next = newLeaf;
+            separator = newLeaf->keys[0];
+            right = newLeaf;
+        }else{
+            InnerT* left = asInner(child);
+            InnerT* newInner = new InnerT();
+            size_t mid = MAX_KEYS / 2;
+            std::move(left->keys + mid + 1, left->keys + MAX_KEYS, newInner->keys);
+            std::copy(left->children + mid + 1, left->children + MAX_KEYS + 1, newInner->children);
+            newInner->count = (uint32_t) (MAX_KEYS - mid - 1);
+            left->count = (uint32_t) mid;
+            separator = std::move(left->keys[mid]);
+            right = newInner;
+        }
+        std::move_backward(parent->keys + i, parent->keys + parent->count, parent->keys + parent->count + 1);
+        std::copy_backward(parent->children + i + 1, parent->children + parent->count + 1, parent->children + parent->count + 2);
+        parent->keys[i] = std::move(separator);
+        parent->children[i + 1] = right;
+        parent->count += 1;
+    }
+
+    void borrowFromLeft(InnerT* parent, size_t i){
+        Node* child = parent->children[i];
+        Node* sibling = parent->children[i - 1];
+        if(child->leaf){
+            LeafT* c = asLeaf(child);
+            LeafT* s = asLeaf(sibling);
+            std::move_backward(c->keys, c->keys + c->count, c->keys + c->count + 1);
+            std::move_backward(c->vals, c->vals + c->count, c->vals + c->count + 1);
+            c->keys[0] = std::move(s->keys[s->count - 1]);
+            c->vals[0] = std::move(s->vals[s->count - 1]);
+            parent->keys[i - 1] = c->keys[0];
+        }else{
+            InnerT* c = asInner(child);
+            InnerT* s = asInner(sibling);
+            std::move_backward(c->keys, c->keys + c->count, c->keys + c->count + 1);
+            std::copy_backward(c->children, c->children + c->count + 1, c->children + c->count + 2);
+            c->keys[0] = std::move(parent->keys[i - 1]);
+            c->children[0] = s->children[s->count];
+            parent->keys[i - 1] = std::move(s->keys[s->count - 1]);
+        }
+        sibling->count -= 1;
+        child->count += 1;
+    }
+
+    void borrowFromRight(InnerT* parent, size_t i){
+        Node* child = parent->children[i];
+        Node* sibling = parent->children[i + 1];
+        if(child->leaf){
+            LeafT* c = asLeaf(child);
+            LeafT* s = asLeaf(sibling);
+            c->keys[c->count] = std::move(s->keys[0]);
+            c->vals[c->count] = std::move(s->vals[0]);
+            std::move(s->keys + 1, s->keys + s->count, s->keys);
+            std::move(s->vals + 1, s->vals + s->count, s->vals);
+            parent->keys[i] = s->keys[0];
+        }else{
+            InnerT* c = asInner(child);
+            InnerT* s = asInner(sibling);
+            c->keys[c->count] = std::move(parent->keys[i]);
+            c->children[c->count + 1] = s->children[0];
+            parent->keys[i] = std::move(s->keys[0]);
+            std::move(s->keys + 1, s->keys + s->count, s->keys);
+            std::copy(s->children + 1, s->children + s->count + 1, s->children);
+        }
+        sibling->count -= 1;
+        child->count += 1;
+    }
+
+    // folds child i + 1 into child i; for leaves the separator just goes away
+    void merge(InnerT* parent, size_t i){
+        Node* left = parent->children[i];
+        Node* right = parent->children[i + 1];
+        if(left->leaf){
+            LeafT* l = asLeaf(left);
+            LeafT* r = asLeaf(right);
+            std::move(r->keys, r->keys + r->count, l->keys + l->count);
+            std::move(r->vals, r->vals + r->count, l->vals + l->count);
+            l->count += r->count;
+            l->next = r->next;
+        }else{
+            InnerT* l = asInner(left);
+            InnerT* r = asInner(right);
+            l->keys[l->count] = std::move(parent->keys[i]);
+            std::move(r->keys, r->keys + r->count, l->keys + l->count + 1);
+            std::copy(r->children, r->children + r->count + 1, l->children + l->count + 1);
+            l->count += r->count + 1;
+        }
+        freeNode(right);
+        std::move(parent->keys + i + 1, parent->keys + parent->count, parent->keys + i);
+        std::copy(parent->children + i + 2, parent->children + parent->count + 1, parent->children + i + 1);
+        parent->count -= 1;
+    }
+
+    // gives child i more than its minimum before we descend into it and
+    // returns the index the child ends up at
+    size_t fill(InnerT* parent, size_t i){
+        if(i > 0 && parent->children[i - 1]->count > minCount(parent->children[i - 1])){
+            borrowFromLeft(parent, i);
+        }else if(i < parent->count && parent->children[i + 1]->count > minCount(parent->children[i + 1])){
+            borrowFromRight(parent, i);
+        }else if(i < parent->count){
+            merge(parent, i);
+        }else{
+            merge(parent, i - 1);
+            i -= 1;
+        }
+        return i;
+    }
+
+    bool checkNode(Node* n, const K* lo, const K* hi, size_t depth, size_t& leafDepth, LeafT*& expectedLeaf, size_t& members){
+        if(n != root && (n->count < minCount(n) || n->count > (n->leaf ? LEAF_SIZE : MAX_KEYS))){
+            return false;
+        }
+        const K* keys = n->leaf ? asLeaf(n)->keys : asInner(n)->keys;
+        for(size_t i = 0; i < n->count; i++){
+            if((i > 0 && !(keys[i - 1] < keys[i])) || (lo && keys[i] < *lo) || (hi && !(keys[i] < *hi))){
+                return false;
+            }
+        }
+        if(n->leaf){
+            if(leafDepth == 0){
+                leafDepth = depth;
+            }
+            // leaves must be reached in the same order the sibling list links them
+            if(leafDepth != depth || asLeaf(n) != expectedLeaf){
+                return false;
+            }
+            expectedLeaf = asLeaf(n)->next;
+            members += n->count;
+            return true;
+        }
+        for(size_t i = 0; i <= n->count; i++){
+            const K* childLo = (i == 0) ? lo : &keys[i - 1];
+            const K* childHi = (i == n->count) ? hi : &keys[i];
+            if(!checkNode(asInner(n)->children[i], childLo, childHi, depth + 1, leafDepth, expectedLeaf, members)){
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // splits count items into runs of per; a short last run is folded into
+    // the one before it, or shares evenly with it when both don't fit in max
+    static std::vector<size_t> runLengths(size_t count, size_t per, size_t min, size_t max){
+        std::vector<size_t> runs(count / per, per);
+        size_t rest = count % per;
+        if(rest == 0){
+            return runs;
+        }
+        if(rest >= min || runs.empty()){
+            runs.push_back(rest);
+        }else if(runs.back() + rest <= max){
+            runs.back() += rest;
+        }else{
+            size_t total = runs.back() + rest;
+            runs.back() = total - total / 2;
+            runs.push_back(total / 2);
+        }
+        return runs;
+    }
+
+    // packs perLeaf entries into each new leaf and links them; false if a
+    // key is not strictly greater than the one before it
+    template <class It>
+    static bool loadLeaves(It first, It last, size_t perLeaf, std::vector<LeafT*>& leaves, size_t& loaded){
+        LeafT* leaf = nullptr;
+        const K* prev = nullptr;
+        for(; first != last; ++first){
+            const auto& entry = *first;
+            if(prev && !(*prev < entry.first)){
+                return false;
+            }
+            if(!leaf || leaf->count == perLeaf){
+                // in leaves before anything else can throw, so the caller frees it
+                std::unique_ptr<LeafT> next(new LeafT());
+                leaves.push_back(next.get());
+                if(leaf){
+                    leaf->next = next.get();
+                }
+                leaf = next.release();
+            }
+            leaf->keys[leaf->count] = entry.first;
+            leaf->vals[leaf->count] = entry.second;
+            prev = &leaf->keys[leaf->count];
+            leaf->count += 1;
+            loaded += 1;
+        }
+        return true;
+    }
+
+    // one leaf segment per thread; segments are whole leaves, so only the
+    // very last leaf can come out short. If a worker throws, every leaf
+    // built is freed and the exception is rethrown here.
+    template <class It>
+    static bool loadLeavesParallel(It first, It last, size_t perLeaf, size_t threads, std::vector<LeafT*>& leaves, size_t& loaded){
+        size_t n = (size_t) (last - first);
+        size_t leafCount = (n + perLeaf - 1) / perLeaf;
+        size_t segment = ((leafCount + threads - 1) / threads) * perLeaf;
+        size_t segments = (n + segment - 1) / segment;
+        std::vector<std::vector<LeafT*>> parts(segments);
+        std::vector<size_t> counts(segments, 0);
+        std::vector<char> sorted(segments, 0);
+        std::vector<std::exception_ptr> errors(segments);
+        std::vector<std::thread> workers;
+        workers.reserve(segments);
+        std::exception_ptr failed;
+        try{
+            for(size_t t = 0; t < segments; t++){
+                workers.emplace_back([&, t]{
+                    try{
+                        It from = first + (std::ptrdiff_t) (t * segment);
+                        It to = first + (std::ptrdiff_t) std::min(n, (t + 1) * segment);
+                        sorted[t] = loadLeaves(from, to, perLeaf, parts[t], counts[t]);
+                    }catch(...){
+                        errors[t] = std::current_exception();
+                    }
+                });
+            }
+        }catch(...){
+            failed = std::current_exception();
+        }
+        for(auto& worker : workers){
+            worker.join();
+        }
+        for(size_t t = 0; t < segments && !failed; t++){
+            failed = errors[t];
+        }
+        if(!failed){
+            try{
+                leaves.reserve(leaves.size() + leafCount);
+            }catch(...){
+                failed = std::current_exception();
+            }
+        }
+        if(failed){
+            for(auto& part : parts){
+                for(LeafT* leaf : part){
+                    delete leaf;
+                }
+            }
+            std::rethrow_exception(failed);
+        }
+        bool ok = true;
+        for(size_t t = 0; t < segments; t++){
+            ok = ok && sorted[t];
+            if(t > 0 && !parts[t - 1].empty() && !parts[t].empty()){
+                LeafT* tail = parts[t - 1].back();
+                ok = ok && tail->keys[tail->count - 1] < parts[t].front()->keys[0];
+                tail->next = parts[t].front();
+            }
+            leaves.insert(leaves.end(), parts[t].begin(), parts[t].end());
+            loaded += counts[t];
+        }
+        return ok;
+    }
+
+    // tops up a short last leaf from its neighbour, or folds it into it
+    static void balanceLastLeaf(std::vector<LeafT*>& leaves){
+        if(leaves.size() < 2 || leaves.back()->count >= MIN_LEAF){
+            return;
+        }
+        LeafT* prev = leaves[leaves.size() - 2];
+        LeafT* last = leaves.back();
+        size_t total = prev->count + last->count;
+        if(total <= LEAF_SIZE){
+            std::move(last->keys, last->keys + last->count, prev->keys + prev->count);
+            std::move(last->vals, last->vals + last->count, prev->vals + prev->count);
+            prev->count = (uint32_t) total;
+            prev->next = nullptr;
+            delete last;
+            leaves.pop_back();
+            return;
+        }
+        size_t shift = total / 2 - last->count;
+        std::move_backward(last->keys, last->keys + last->count, last->keys + last->count + shift);
+        std::move_backward(last->vals, last->vals + last->count, last->vals + last->count + shift);
+        std::move(prev->keys + prev->count - shift, prev->keys + prev->count, last->keys);
+        std::move(prev->vals + prev->count - shift, prev->vals + prev->count, last->vals);
+        prev->count -= (uint32_t) shift;
+        last->count += (uint32_t) shift;
+    }
+
+    // Groups every level into the one above it, separators being the
+    // smallest key under each child after the first, and returns the root,
+    // or nullptr if there are no leaves. Every inner node goes into inners,
+    // which has room reserved for them all, before anything else can throw.
+    static Node* buildLevels(const std::vector<LeafT*>& leaves, std::vector<InnerT*>& inners, size_t& levels){
+        std::vector<Node*> level(leaves.begin(), leaves.end());
+        std::vector<K> lows;
+        lows.reserve(leaves.size());
+        for(LeafT* leaf : leaves){
+            lows.push_back(leaf->keys[0]);
+        }
+        levels = 1;
+        while(level.size() > 1){
+            std::vector<Node*> parents;
+            std::vector<K> parentLows;
+            size_t j = 0;
+            for(size_t run : runLengths(level.size(), FANOUT, MIN_KEYS + 1, FANOUT)){
+                InnerT* in = new InnerT();
+                inners.push_back(in);
+                for(size_t c = 0; c < run; c++){
+                    in->children[c] = level[j + c];
+                    if(c > 0){
+                        in->keys[c - 1] = std::move(lows[j + c]);
+                    }
+                }
+                in->count = (uint32_t) (run - 1);
+                parents.push_back(in);
+                parentLows.push_back(std::move(lows[j]));
+                j += run;
+            }
+            level.swap(parents);
+            lows.swap(parentLows);
+            levels += 1;
+        }
+        return level.empty() ? nullptr : level[0];
+    }
+
+public:
+    // walks the leaf list; any insert or deleteNode invalidates it
+    class Iterator {
+        LeafT* leaf;
+        size_t index;
+
+        void skipEmpty(){
+            while(leaf && index >= leaf->count){
+                leaf = leaf->next;
+                index = 0;
+            }
+        }
+
+    public:
+        Iterator(LeafT* l, size_t i): leaf(l), index(i) {
+            skipEmpty();
+        }
+
+        const K& key() const {
+            return leaf->keys[index];
+        }
+
+        T& value() const {
+            return leaf->vals[index];
+        }
+
+        std::pair<const K&, T&> operator*() const {
+            return {leaf->keys[index], leaf->vals[index]};
+        }
+
+        Iterator& operator++(){
+            index += 1;
+            skipEmpty();
+            return *this;
+        }
+
+        bool operator==(const Iterator& other) const {
+            return leaf == other.leaf && index == other.index;
+        }
+
+        bool operator!=(const Iterator& other) const {
+            return !(*this == other);
+        }
+    };
+
+    BPlusTree(): root(new LeafT()), currentMembers(0), height(1) {}
+
+    BPlusTree(const BPlusTree&) = delete;
+    BPlusTree& operator=(const BPlusTree&) = delete;
+
+    ~BPlusTree(){
+        destroy(root);
+    }
+
+    size_t getCurrentMembers(){
+        return currentMembers;
+    }
+
+    size_t getHeight(){
+        return height;
+    }
+
+    // returns false if the key was already there and only its value changed
+    bool insert(K key, T val){
+        if(isFull(root)){
+            InnerT* newRoot = new InnerT();
+            newRoot->children[0] = root;
+            splitChild(newRoot, 0);
+            root = newRoot;
+            height += 1;
+        }
+        Node* n = root;
+        while(!n->leaf){
+            InnerT* in = asInner(n);
+            size_t i = childIndex(in, key);
+            if(isFull(in->children[i])){
+                splitChild(in, i);
+                if(!(key < in->keys[i])){
+                    i += 1;
+                }
+            }
+            n = in->children[i];
+        }
+        LeafT* leaf = asLeaf(n);
+        size_t i = leafIndex(leaf, key);
+        if(i < leaf->count && !(key < leaf->keys[i])){
+            leaf->vals[i] = val;
+            return false;
+        }
+        std::move_backward(leaf->keys + i, leaf->keys + leaf->count, leaf->keys + leaf->count + 1);
+        std::move_backward(leaf->vals + i, leaf->vals + leaf->count, leaf->vals + leaf->count + 1);
+        leaf->keys[i] = key;
+        leaf->vals[i] = val;
+        leaf->count += 1;
+        currentMembers += 1;
+        return true;
+    }
+
+    T* find(K key){
+        LeafT* leaf = findLeaf(key);
+        size_t i = leafIndex(leaf, key);
+        if(i < leaf->count && !(key < leaf->keys[i])){
+            return &leaf->vals[i];
+        }
+        return nullptr;
+    }
+
+    // separators of removed keys may stay behind in inner nodes; they still
+    // split the key space correctly, so nothing above the leaf is rewritten
+    bool deleteNode(K key){
+        Node* n = root;
+        while(!n->leaf){
+            InnerT* in = asInner(n);
+            size_t i = childIndex(in, key);
+            if(in->children[i]->count <= minCount(in->children[i])){
+                i = fill(in, i);
+            }
+            n = in->children[i];
+        }
+        LeafT* leaf = asLeaf(n);
+        size_t i = leafIndex(leaf, key);
+        bool removed = i < leaf->count && !(key < leaf->keys[i]);
+        if(removed){
+            std::move(leaf->keys + i + 1, leaf->keys + leaf->count, leaf->keys + i);
+            std::move(leaf->vals + i + 1, leaf->vals + leaf->count, leaf->vals + i);
+            leaf->count -= 1;
+            currentMembers -= 1;
+        }
+        // a merge may have emptied the root
+        if(!root->leaf && root->count == 0){
+            Node* old = root;
+            root = asInner(old)->children[0];
+            delete asInner(old);
+            height -= 1;
+        }
+        return removed;
+    }
+
+    Iterator begin(){
+        return Iterator(firstLeaf(), 0);
+    }
+
+    Iterator end(){
+        return Iterator(nullptr, 0);
+    }
+
+    // first entry whose key is not less than key
+    Iterator lowerBound(const K& key){
+        LeafT* leaf = findLeaf(key);
+        return Iterator(leaf, leafIndex(leaf, key));
+    }
+
+    // calls visit(key, value) for every key in [lo, hi) in order and returns
+    // how many it visited. Whole leaves below hi are handed over without a
+    // per-key bound check, and the next leaf is prefetched while one is read.
+    template <class F>
+    size_t scan(const K& lo, const K& hi, F&& visit){
+        if(!(lo < hi)){
+            return 0;
+        }
+        LeafT* leaf = findLeaf(lo);
+        size_t i = leafIndex(leaf, lo);
+        size_t visited = 0;
+        while(leaf){
+            if(leaf->next){
+                hashing::prefetch(leaf->next);
+            }
+            size_t last = leaf->count;
+            bool done = last > 0 && !(leaf->keys[last - 1] < hi);
+            if(done){
+                last = leafIndex(leaf, hi);
+            }
+            for(; i < last; i++){
+                visit(leaf->keys[i], leaf->vals[i]);
+                visited += 1;
+            }
+            if(done){
+                break;
+            }
+            leaf = leaf->next;
+            i = 0;
+        }
+        return visited;
+    }
+
+    // Replaces the contents with the (key, value) pairs in [first, last),
+    // built bottom-up in O(n) instead of n inserts. Keys must be strictly
+    // increasing; otherwise the tree is left empty and false is returned.
+    // fillFactor is the share of each leaf that gets filled (at least half),
+    // leaving room for later inserts. With random-access input and
+    // threads > 1 every thread packs its own run of leaves. If copying an
+    // entry or allocating throws, the tree is left empty and the exception
+    // propagates.
+    template <class It>
+    bool bulkLoad(It first, It last, double fillFactor = 1.0, size_t threads = 1){
+        // the tree stays a valid empty one until the new nodes are complete
+        LeafT* empty = new LeafT();
+        destroy(root);
+        root = empty;
+        currentMembers = 0;
+        height = 1;
+        size_t perLeaf = std::min(LEAF_SIZE, std::max(MIN_LEAF, (size_t) (fillFactor * (double) LEAF_SIZE)));
+        // everything allocated so far, freed node by node if a step throws
+        std::vector<LeafT*> leaves;
+        std::vector<InnerT*> inners;
+        auto freeBuilt = [&]{
+            for(LeafT* leaf : leaves){
+                delete leaf;
+            }
+            for(InnerT* in : inners){
+                delete in;
+            }
+        };
+        try{
+            size_t loaded = 0;
+            bool sorted;
+            if constexpr (std::is_base_of<std::random_access_iterator_tag, typename std::iterator_traits<It>::iterator_category>::value){
+                if(threads > 1 && last - first > (std::ptrdiff_t) (threads * perLeaf)){
+                    sorted = loadLeavesParallel(first, last, perLeaf, threads, leaves, loaded);
+                }else{
+                    sorted = loadLeaves(first, last, perLeaf, leaves, loaded);
+                }
+            }else{
+                sorted = loadLeaves(first, last, perLeaf, leaves, loaded);
+            }
+            if(!sorted){
+                freeBuilt();
+                return false;
+            }
+            balanceLastLeaf(leaves);
+            // fanout is at least two, so there are fewer inner nodes than leaves
+            inners.reserve(leaves.size());
+            size_t levels;
+            Node* built = buildLevels(leaves, inners, levels);
+            if(built){
+                root = built;
+                delete empty;
+                currentMembers = loaded;
+                height = levels;
+            }
+            return true;
+        }catch(...){
+            freeBuilt();
+            throw;
+        }
+    }
+
+    size_t getLeafCount(){
+        size_t leaves = 0;
+        for(LeafT* leaf = firstLeaf(); leaf; leaf = leaf->next){
+            leaves += 1;
+        }
+        return leaves;
+    }
+
+    bool reset(){
+        try{
+            destroy(root);
+            root = new LeafT();
+            currentMembers = 0;
+            height = 1;
+            return true;
+        }catch(...){
+            return false;
+        }
+    }
+
+    // key order, node occupancy, equal leaf depth and the leaf chain, for the tests
+    bool checkInvariants(){
+        size_t leafDepth = 0, members = 0;
+        LeafT* expectedLeaf = firstLeaf();
+        return checkNode(root, nullptr, nullptr, 1, leafDepth, expectedLeaf, members) && expectedLeaf == nullptr && members == currentMembers;
+    }
+};
+
+// Concurrent nodes carry a version word for optimistic lock coupling: bit 0
+// is the write lock and every unlock moves the version on. A reader notes
+// the version, reads without locking and then checks the version is still
+// the same; if it is not, whatever it read may be torn and it starts over.
+//
+// Everything a reader looks at while a writer may be changing it is an
+// atomic, loaded and stored relaxed: the version check decides whether a
+// value is kept, the atomics only keep the overlap from being a data race.
+struct alignas(64) SyncNode {
+    std::atomic<uint64_t> version;
+    std::atomic<uint32_t> count;
+    const bool leaf;
+
+    explicit SyncNode(bool isLeaf): version(0), count(0), leaf(isLeaf) {}
+
+    uint32_t size() const {
+        return count.load(std::memory_order_relaxed);
+    }
+
+    void setSize(size_t n){
+        count.store((uint32_t) n, std::memory_order_relaxed);
+    }
+
+    // waits out a writer and returns the version to validate against
+    uint64_t readLock(){
+        uint64_t v = version.load(std::memory_order_acquire);
+        while(v & 1){
+            std::this_thread::yield();
+            v = version.load(std::memory_order_acquire);
+        }
+        return v;
+    }
+
+    // true if no writer got in since readLock returned v
+    bool validate(uint64_t v){
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return version.load(std::memory_order_relaxed) == v;
+    }
+
+    // Takes the write lock only if the node is still at version v. The
+    // fence keeps the writer's relaxed stores after the locked version, so
+    // a reader that sees any of them fails validate.
+    bool upgrade(uint64_t v){
+        if(!version.compare_exchange_strong(v, v + 1, std::memory_order_acquire)){
+            return false;
+        }
+        std::atomic_thread_fence(std::memory_order_release);
+        return true;
+    }
+
+    void writeUnlock(){
+        version.fetch_add(1, std::memory_order_release);
+    }
+};
+
+template <class V>
+V loadSlot(const std::atomic<V>& slot){
+    return slot.load(std::memory_order_relaxed);
+}
+
+template <class V>
+void storeSlot(std::atomic<V>& slot, const V& value){
+    slot.store(value, std::memory_order_relaxed);
+}
+
+// std::move for slots readers may be looking at; overlapping ranges are
+// fine, the direction is picked so nothing is overwritten before it moves
+template <class V>
+void moveSlots(std::atomic<V>* first, std::atomic<V>* last, std::atomic<V>* out){
+    if(out < first){
+        for(; first != last; ++first, ++out){
+            storeSlot(*out, loadSlot(*first));
+        }
+        return;
+    }
+    std::atomic<V>* outLast = out + (last - first);
+    while(last != first){
+        storeSlot(*--outLast, loadSlot(*--last));
+    }
+}
+
+template <class K, class T, size_t LEAF_SIZE>
+struct SyncLeaf : SyncNode {
+    std::atomic<K> keys[LEAF_SIZE];
+    std::atomic<T> vals[LEAF_SIZE];
+    std::atomic<SyncLeaf*> next;
+
+    SyncLeaf(): SyncNode(true), keys(), vals(), next(nullptr) {}
+};
+
+template <class K, size_t FANOUT>
+struct SyncInner : SyncNode {
+    std::atomic<K> keys[FANOUT - 1];
+    std::atomic<SyncNode*> children[FANOUT];
+
+    SyncInner(): SyncNode(false), keys(), children() {}
+};
+
+// BPlusTree for many threads, with optimistic lock coupling. Lookups and
+// scans take no locks at all: they validate each node's version after
+// reading it and restart from the root if a writer got in. Inserts descend
+// the same way and write-lock only the leaf they change, or the node they
+// split and its parent; full nodes are split on the way down, so a split
+// never has to reach further up.
+//
+// deleteNode only removes the key from its leaf and never merges, so no node
+// is freed while the tree is shared and readers can follow any pointer they
+// read. Keys and values live in std::atomic slots, so both have to be
+// trivially copyable, and the ones that fit a machine word avoid the lock
+// std::atomic falls back to. Scans see each leaf as of one moment, not the
+// whole range.
+template <class K, class T, size_t FANOUT = btree::defaultFanout<K>(), size_t LEAF_SIZE = btree::defaultFanout<K>()>
+class ConcurrentBPlusTree {
+    static_assert(FANOUT >= 4 && LEAF_SIZE >= 4, "nodes need room for at least three keys");
+    static_assert(std::is_trivially_copyable<K>::value && std::is_trivially_copyable<T>::value,
+                  "readers copy keys and values that may be mid-write");
+
+    using LeafT = SyncLeaf<K, T, LEAF_SIZE>;
+    using InnerT = SyncInner<K, FANOUT>;
+
+    static constexpr size_t MAX_KEYS = FANOUT - 1;
+
+    std::atomic<SyncNode*> root;
+    std::atomic<size_t> currentMembers;
+    std::atomic<size_t> height;
+
+    static LeafT* asLeaf(SyncNode* n){
+        return static_cast<LeafT*>(n);
+    }
+
+    static InnerT* asInner(SyncNode* n){
+        return static_cast<InnerT*>(n);
+    }
+
+    static bool isFull(SyncNode* n){
+        return n->size() == (n->leaf ? LEAF_SIZE : MAX_KEYS);
+    }
+
+    // binary search with one relaxed load per probe; nodesearch's kernels
+    // want plain arrays, which readers may not touch mid-write
+    template <bool UPPER>
+    static size_t bound(const std::atomic<K>* keys, size_t count, const K& key){
+        size_t lo = 0, hi = count;
+        while(lo < hi){
+            size_t mid = lo + (hi - lo) / 2;
+            K probe = loadSlot(keys[mid]);
+            if(UPPER ? !(key < probe) : probe < key){
+                lo = mid + 1;
+            }else{
+                hi = mid;
+            }
+        }
+        return lo;
+    }
+
+    static size_t childIndex(InnerT* n, const K& key){
+        return bound<true>(n->keys, n->size(), key);
+    }
+
+    static size_t leafIndex(LeafT* leaf, const K& key){
+        return bound<false>(leaf->keys, leaf->size(), key);
+    }
+
+    static void destroy(SyncNode* n){
+        if(n->leaf){
+            delete asLeaf(n);
+            return;
+        }
+        for(size_t i = 0; i <= n->size(); i++){
+            destroy(loadSlot(asInner(n)->children[i]));
+        }
+        delete asInner(n);
+    }
+
+    // Starts at the root and read-locks its way down to key's leaf. The
+    // parent is validated again after the child's version is read, so the
+    // child cannot have split in between. nullptr means start over.
+    LeafT* descend(const K& key, uint64_t& v){
+        SyncNode* node = root.load(std::memory_order_acquire);
+        v = node->readLock();
+        if(node != root.load(std::memory_order_acquire)){
+            return nullptr;
+        }
+        while(!node->leaf){
+            InnerT* inner = asInner(node);
+            SyncNode* child = loadSlot(inner->children[childIndex(inner, key)]);
+            if(!inner->validate(v)){
+                return nullptr;
+            }
+            uint64_t childVersion = child->readLock();
+            if(!inner->validate(v)){
+                return nullptr;
+            }
+            node = child;
+            v = childVersion;
+        }
+        return asLeaf(node);
+    }
+
+    // moves the upper half of a write-locked node into a new node, which is
+    // not reachable until the caller links it into the parent
+    SyncNode* split(SyncNode* n, K& separator){
+        if(n->leaf){
+            LeafT* left = asLeaf(n);
+            LeafT* right = new LeafT();
+            size_t mid = LEAF_SIZE / 2;
+            moveSlots(left->keys + mid, left->keys + LEAF_SIZE, right->keys);
+            moveSlots(left->vals + mid, left->vals + LEAF_SIZE, right->vals);
+            right->setSize(LEAF_SIZE - mid);
+            storeSlot(right->next, loadSlot(left->next));
+            separator = loadSlot(right->keys[0]);
+            left->setSize(mid);
+            storeSlot(left->next, right);
+            return right;
+        }
+        InnerT* left = asInner(n);
+        InnerT* right = new InnerT();
+        size_t mid = MAX_KEYS / 2;
+        moveSlots(left->keys + mid + 1, left->keys + MAX_KEYS, right->keys);
+        moveSlots(left->children + mid + 1, left->children + MAX_KEYS + 1, right->children);
+        right->setSize(MAX_KEYS - mid - 1);
+        separator = loadSlot(left->keys[mid]);
+        left->setSize(mid);
+        return right;
+    }
+
+    // Locks the full node and its parent, both still at the versions seen on
+    // the way down, and splits. The parent was not full when it was passed,
+    // so it has room for the separator. Returns nothing either way: the
+    // caller restarts from the root.
+    void splitFull(SyncNode* node, uint64_t v, InnerT* parent, uint64_t parentVersion){
+        if(parent && !parent->upgrade(parentVersion)){
+            return;
+        }
+        if(!node->upgrade(v)){
+            if(parent){
+                parent->writeUnlock();
+            }
+            return;
+        }
+        // the root may have been split since we read it
+        if(!parent && node != root.load(std::memory_order_acquire)){
+            node->writeUnlock();
+            return;
+        }
+        K separator;
+        SyncNode* right = split(node, separator);
+        if(parent){
+            size_t i = childIndex(parent, separator);
+            size_t count = parent->size();
+            moveSlots(parent->keys + i, parent->keys + count, parent->keys + i + 1);
+            moveSlots(parent->children + i + 1, parent->children + count + 1, parent->children + i + 2);
+            storeSlot(parent->keys[i], separator);
+            storeSlot(parent->children[i + 1], right);
+            parent->setSize(count + 1);
+        }else{
+            InnerT* newRoot = new InnerT();
+            storeSlot(newRoot->keys[0], separator);
+            storeSlot(newRoot->children[0], node);
+            storeSlot(newRoot->children[1], right);
+            newRoot->setSize(1);
+            root.store(newRoot, std::memory_order_release);
+            height.fetch_add(1, std::memory_order_relaxed);
+        }
+        node->writeUnlock();
+        if(parent){
+            parent->writeUnlock();
+        }
+    }
+
+    // one pass of insert; false means it ran into a writer and has to restart
+    bool tryInsert(const K& key, const T& val, bool& inserted){
+        SyncNode* node = root.load(std::memory_order_acquire);
+        uint64_t v = node->readLock();
+        if(node != root.load(std::memory_order_acquire)){
+            return false;
+        }
+        InnerT* parent = nullptr;
+        uint64_t parentVersion = 0;
+        while(true){
+            if(isFull(node)){
+                splitFull(node, v, parent, parentVersion);
+                return false;
+            }
+            if(node->leaf){
+                break;
+            }
+            InnerT* inner = asInner(node);
+            SyncNode* child = loadSlot(inner->children[childIndex(inner, key)]);
+            if(!inner->validate(v)){
+                return false;
+            }
+            uint64_t childVersion = child->readLock();
+            if(!inner->validate(v)){
+                return false;
+            }
+            parent = inner;
+            parentVersion = v;
+            node = child;
+            v = childVersion;
+        }
+        LeafT* leaf = asLeaf(node);
+        if(!leaf->upgrade(v)){
+            return false;
+        }
+        size_t i = leafIndex(leaf, key);
+        size_t count = leaf->size();
+        inserted = !(i < count && !(key < loadSlot(leaf->keys[i])));
+        if(inserted){
+            moveSlots(leaf->keys + i, leaf->keys + count, leaf->keys + i + 1);
+            moveSlots(leaf->vals + i, leaf->vals + count, leaf->vals + i + 1);
+            storeSlot(leaf->keys[i], key);
+            leaf->setSize(count + 1);
+        }
+        storeSlot(leaf->vals[i], val);
+        leaf->writeUnlock();
+        return true;
+    }
+
+    bool tryDelete(const K& key, bool& removed){
+        uint64_t v;
+        LeafT* leaf = descend(key, v);
+        if(!leaf || !leaf->upgrade(v)){
+            return false;
+        }
+        size_t i = leafIndex(leaf, key);
+        size_t count = leaf->size();
+        removed = i < count && !(key < loadSlot(leaf->keys[i]));
+        if(removed){
+            moveSlots(leaf->keys + i + 1, leaf->keys + count, leaf->keys + i);
+            moveSlots(leaf->vals + i + 1, leaf->vals + count, leaf->vals + i);
+            leaf->setSize(count - 1);
+        }
+        leaf->writeUnlock();
+        return true;
+    }
+
+    bool tryFind(const K& key, T& out, bool& found){
+        uint64_t v;
+        LeafT* leaf = descend(key, v);
+        if(!leaf){
+            return false;
+        }
+        size_t i = leafIndex(leaf, key);
+        bool hit = i < leaf->size() && !(key < loadSlot(leaf->keys[i]));
+        T val;
+        if(hit){
+            val = loadSlot(leaf->vals[i]);
+        }
+        if(!leaf->validate(v)){
+            return false;
+        }
+        found = hit;
+        if(hit){
+            out = val;
+        }
+        return true;
+    }
+
+    bool checkNode(SyncNode* n, const K* lo, const K* hi, size_t depth, size_t& leafDepth, LeafT*& expectedLeaf, size_t& members){
+        size_t count = n->size();
+        if(count > (n->leaf ? LEAF_SIZE : MAX_KEYS) || (!n->leaf && count == 0) || (n->version.load() & 1)){
+            return false;
+        }
+        const std::atomic<K>* slots = n->leaf ? asLeaf(n)->keys : asInner(n)->keys;
+        std::vector<K> keys(count);
+        for(size_t i = 0; i < count; i++){
+            keys[i] = loadSlot(slots[i]);
+            if((i > 0 && !(keys[i - 1] < keys[i])) || (lo && keys[i] < *lo) || (hi && !(keys[i] < *hi))){
+                return false;
+            }
+        }
+        if(n->leaf){
+            if(leafDepth == 0){
+                leafDepth = depth;
+            }
+            if(leafDepth != depth || asLeaf(n) != expectedLeaf){
+                return false;
+            }
+            expectedLeaf = loadSlot(asLeaf(n)->next);
+            members += count;
+            return true;
+        }
+        for(size_t i = 0; i <= count; i++){
+            const K* childLo = (i == 0) ? lo : &keys[i - 1];
+            const K* childHi = (i == count) ? hi : &keys[i];
+            if(!checkNode(loadSlot(asInner(n)->children[i]), childLo, childHi, depth + 1, leafDepth, expectedLeaf, members)){
+                return false;
+            }
+        }
+        return true;
+    }
+
+public:
+    ConcurrentBPlusTree(): root(new LeafT()), currentMembers(0), height(1) {}
+
+    ConcurrentBPlusTree(const ConcurrentBPlusTree&) = delete;
+    ConcurrentBPlusTree& operator=(const ConcurrentBPlusTree&) = delete;
+
+    // no other thread may still be using the tree
+    ~ConcurrentBPlusTree(){
+        destroy(root.load());
+    }
+
+    size_t getCurrentMembers(){
+        return currentMembers.load();
+    }
+
+    size_t getHeight(){
+        return height.load();
+    }
+
+    // returns false if the key was already there and only its value changed
+    bool insert(K key, T val){
+        bool inserted = false;
+        while(!tryInsert(key, val, inserted)){}
+        if(inserted){
+            currentMembers.fetch_add(1, std::memory_order_relaxed);
+        }
+        return inserted;
+    }
+
+    // copies the value out, since the leaf may change right after
+    bool find(K key, T& out){
+        bool found = false;
+        while(!tryFind(key, out, found)){}
+        return found;
+    }
+
+    bool contains(K key){
+        T ignored;
+        return find(key, ignored);
+    }
+
+    bool deleteNode(K key){
+        bool removed = false;
+        while(!tryDelete(key, removed)){}
+        if(removed){
+            currentMembers.fetch_sub(1, std::memory_order_relaxed);
+        }
+        return removed;
+    }
+
+    // Calls visit(key, value) for every key in [lo, hi) in order and returns
+    // how many it visited. Each leaf is copied out and validated before its
+    // entries are handed over, so visit may take its time; after a restart
+    // the scan picks up right after the last key it visited.
+    template <class F>
+    size_t scan(const K& lo, const K& hi, F&& visit){
+        if(!(lo < hi)){
+            return 0;
+        }
+        K keys[LEAF_SIZE];
+        T vals[LEAF_SIZE];
+        size_t visited = 0;
+        bool resumed = false;
+        K last = lo;
+        while(true){
+            uint64_t v;
+            LeafT* leaf = descend(last, v);
+            while(leaf){
+                size_t count = leaf->size();
+                size_t i = resumed ? bound<true>(leaf->keys, count, last) : leafIndex(leaf, lo);
+                size_t copied = 0;
+                bool done = false;
+                for(; i < count; i++){
+                    K key = loadSlot(leaf->keys[i]);
+                    if(!(key < hi)){
+                        done = true;
+                        break;
+                    }
+                    keys[copied] = key;
+                    vals[copied] = loadSlot(leaf->vals[i]);
+                    copied += 1;
+                }
+                LeafT* next = loadSlot(leaf->next);
+                if(!leaf->validate(v)){
+                    break;
+                }
+                for(size_t j = 0; j < copied; j++){
+                    visit(keys[j], vals[j]);
+                }
+                visited += copied;
+                if(copied > 0){
+                    last = keys[copied - 1];
+                    resumed = true;
+                }
+                if(done || !next){
+                    return visited;
+                }
+                uint64_t nextVersion = next->readLock();
+                if(!leaf->validate(v)){
+                    break;
+                }
+                leaf = next;
+                v = nextVersion;
+            }
+        }
+    }
+
+    // same checks as BPlusTree::checkInvariants, minus minimum occupancy,
+    // for a tree no thread is writing to
+    bool checkInvariants(){
+        size_t leafDepth = 0, members = 0;
+        SyncNode* n = root.load();
+        while(!n->leaf){
+            n = loadSlot(asInner(n)->children[0]);
+        }
+        LeafT* expectedLeaf = asLeaf(n);
+        return checkNode(root.load(), nullptr, nullptr, 1, leafDepth, expectedLeaf, members) && expectedLeaf == nullptr && members == currentMembers.load();
+    }
+};
+
+// the reader-writer lock setup ConcurrentBPlusTree replaces
+template <class K, class T>
+class LockedBPlusTree {
+    std::shared_mutex lock;
+    BPlusTree<K, T> tree;
+
+public:
+    bool insert(K key, T val){
+        std::unique_lock<std::shared_mutex> guard(lock);
+        return tree.insert(key, val);
+    }
+
+    bool find(K key, T& out){
+        std::shared_lock<std::shared_mutex> guard(lock);
+        T* found = tree.find(key);
+        if(found){
+            out = *found;
+            return true;
+        }
+        return false;
+    }
+};
+
+
+bool testInsertAndFind() {
+    BPlusTree<int, std::string> tree;
+    tree.insert(1, "one");
+    tree.insert(2, "two");
+    tree.insert(3, "three");
+
+    if(*tree.find(1) != "one") return false;
+    if(*tree.find(2) != "two") return false;
+    if(*tree.find(3) != "three") return false;
+    if(tree.find(4) != nullptr) return false;
+    return true;
+}
+
+bool testDuplicateInserts() {
+    BPlusTree<int, std::string> tree;
+    if(!tree.insert(1, "one")) return false;
+    if(tree.insert(1, "uno")) return false;
+
+    if(*tree.find(1) != "uno" || tree.getCurrentMembers() != 1) return false;
+    return true;
+}
+
+bool testDelete() {
+    // small nodes force splits, borrows and merges at every level
+    BPlusTree<int, int, 4, 4> tree;
+    std::map<int, int> reference;
+    std::mt19937 rng(1);
+    for(int i = 0; i < 20000; i++) {
+        int key = (int) (rng() % 2000);
+        if(rng() % 3 == 0) {
+            if(tree.deleteNode(key) != (reference.erase(key) == 1)) return false;
+        } else {
+            tree.insert(key, i);
+            reference[key] = i;
+        }
+    }
+    if(!tree.checkInvariants() || tree.getCurrentMembers() != reference.size()) return false;
+    for(int key = 0; key < 2000; key++) {
+        auto it = reference.find(key);
+        int* found = tree.find(key);
+        if((it == reference.end()) != (found == nullptr)) return false;
+        if(found && *found != it->second) return false;
+    }
+    for(int key = 0; key < 2000; key++) {
+        tree.deleteNode(key);
+    }
+    return tree.getCurrentMembers() == 0 && tree.getHeight() == 1 && tree.checkInvariants();
+}
+
+bool testIterator() {
+    BPlusTree<int, int, 4, 6> tree;
+    if(tree.begin() != tree.end()) return false;
+    for(int i = 0; i < 5000; i++) {
+        tree.insert((i * 7919) % 5000, i);
+    }
+    // the leaf chain yields every key once, in order
+    int expected = 0;
+    for(auto entry : tree) {
+        if(entry.first != expected) return false;
+        expected += 1;
+    }
+    if(expected != 5000) return false;
+    auto it = tree.lowerBound(4998);
+    if(it == tree.end() || it.key() != 4998 || (++it).key() != 4999 || ++it != tree.end()) return false;
+    return tree.lowerBound(5000) == tree.end();
+}
+
+bool testScan() {
+    BPlusTree<int, int, 4, 8> tree;
+    std::map<int, int> reference;
+    for(int i = 0; i < 3000; i++) {
+        tree.insert(i * 3, i);
+        reference[i * 3] = i;
+    }
+    std::mt19937 rng(2);
+    for(int round = 0; round < 200; round++) {
+        int lo = (int) (rng() % 10000) - 500;
+        int hi = lo + (int) (rng() % 2000);
+        std::vector<std::pair<int, int>> got;
+        size_t visited = tree.scan(lo, hi, [&](const int& key, int& val){ got.emplace_back(key, val); });
+        std::vector<std::pair<int, int>> want(reference.lower_bound(lo), reference.lower_bound(hi));
+        if(got != want || visited != want.size()) return false;
+    }
+    // an empty or reversed range visits nothing
+    if(tree.scan(10, 10, [](const int&, int&){}) != 0 || tree.scan(10, 5, [](const int&, int&){}) != 0) return false;
+    return true;
+}
+
+bool testBulkLoad() {
+    std::vector<std::pair<int, int>> entries;
+    for(int i = 0; i < 10000; i++) {
+        entries.emplace_back(i * 2, i);
+    }
+    // every size that leaves a short last leaf or inner node at some level
+    for(size_t n : {(size_t) 0, (size_t) 1, (size_t) 7, (size_t) 9, (size_t) 100, (size_t) 1001, entries.size()}) {
+        for(double fill : {1.0, 0.7, 0.5}) {
+            for(size_t threads : {(size_t) 1, (size_t) 4}) {
+                BPlusTree<int, int, 5, 8> tree;
+                if(!tree.bulkLoad(entries.begin(), entries.begin() + n, fill, threads)) return false;
+                if(!tree.checkInvariants() || tree.getCurrentMembers() != n) return false;
+                for(size_t i = 0; i < n; i++) {
+                    if(*tree.find((int) i * 2) != (int) i || tree.find((int) i * 2 + 1) != nullptr) return false;
+                }
+            }
+        }
+    }
+    // a single-pass input goes through the serial path
+    std::list<std::pair<int, int>> stream(entries.begin(), entries.end());
+    BPlusTree<int, int, 5, 8> tree;
+    if(!tree.bulkLoad(stream.begin(), stream.end(), 0.8) || !tree.checkInvariants()) return false;
+    // the loaded tree takes regular updates
+    for(int i = 0; i < 20000; i += 3) {
+        tree.insert(i, -i);
+    }
+    for(int i = 0; i < 20000; i += 5) {
+        tree.deleteNode(i);
+    }
+    if(!tree.checkInvariants()) return false;
+    // out of order input is rejected and leaves the tree empty
+    std::swap(entries[500], entries[501]);
+    if(tree.bulkLoad(entries.begin(), entries.end(), 1.0, 4)) return false;
+    return tree.getCurrentMembers() == 0 && tree.begin() == tree.end() && tree.checkInvariants();
+}
+
+// a key whose copies start throwing once a shared budget runs out
+struct ThrowingKey {
+    static std::atomic<int> budget;
+    int value = 0;
+
+    ThrowingKey() = default;
+    ThrowingKey(int v): value(v) {}
+
+    ThrowingKey(const ThrowingKey& other): value(other.value) {
+        spend();
+    }
+
+    ThrowingKey& operator=(const ThrowingKey& other) {
+        spend();
+        value = other.value;
+        return *this;
+    }
+
+    static void spend() {
+        if(budget.fetch_sub(1) <= 0) throw std::bad_alloc();
+    }
+
+    bool operator<(const ThrowingKey& other) const {
+        return value < other.value;
+    }
+
+    bool operator==(const ThrowingKey& other) const {
+        return value == other.value;
+    }
+};
+
+std::atomic<int> ThrowingKey::budget(1 << 30);
+
+bool testBulkLoadThrows() {
+    std::vector<std::pair<ThrowingKey, int>> entries;
+    for(int i = 0; i < 200; i++) {
+        entries.emplace_back(ThrowingKey(i), i);
+    }
+    // run out at every copy in turn: while filling leaves, on a worker
+    // thread, and while building the inner levels
+    for(size_t threads : {(size_t) 1, (size_t) 4}) {
+        for(int budget = 0; ; budget++) {
+            ThrowingKey::budget = 1 << 30;
+            BPlusTree<ThrowingKey, int, 5, 8> tree;
+            for(int i = 0; i < 50; i++) tree.insert(ThrowingKey(-1 - i), i);
+            ThrowingKey::budget = budget;
+            bool threw = false;
+            bool loaded = false;
+            try {
+                loaded = tree.bulkLoad(entries.begin(), entries.end(), 1.0, threads);
+            } catch(const std::bad_alloc&) {
+                threw = true;
+            }
+            ThrowingKey::budget = 1 << 30;
+            if(!threw) {
+                if(!loaded || tree.getCurrentMembers() != entries.size() || !tree.checkInvariants()) return false;
+                break;
+            }
+            // left empty, and still usable
+            if(tree.getCurrentMembers() != 0 || tree.begin() != tree.end() || !tree.checkInvariants()) return false;
+            tree.insert(ThrowingKey(7), 7);
+            if(tree.find(ThrowingKey(7)) == nullptr || !tree.checkInvariants()) return false;
+        }
+    }
+    return true;
+}
+
+bool testReset() {
+    BPlusTree<int, std::string> tree;
+    for(int i = 0; i < 1000; i++) {
+        tree.insert(i, std::to_string(i));
+    }
+    if(!tree.reset()) return false;
+    if(tree.getCurrentMembers() != 0 || tree.find(1) != nullptr || tree.begin() != tree.end()) return false;
+    tree.insert(1, "one");
+    return *tree.find(1) == "one";
+}
+
+bool testConcurrentSingleThread() {
+    ConcurrentBPlusTree<int, int, 4, 4> tree;
+    std::map<int, int> reference;
+    std::mt19937 rng(3);
+    for(int i = 0; i < 20000; i++) {
+        int key = (int) (rng() % 3000);
+        if(rng() % 4 == 0) {
+            if(tree.deleteNode(key) != (reference.erase(key) == 1)) return false;
+        } else {
+            if(tree.insert(key, i) != (reference.find(key) == reference.end())) return false;
+            reference[key] = i;
+        }
+    }
+    if(!tree.checkInvariants() || tree.getCurrentMembers() != reference.size()) return false;
+    int value = 0;
+    for(int key = 0; key < 3000; key++) {
+        auto it = reference.find(key);
+        if(tree.find(key, value) != (it != reference.end())) return false;
+        if(it != reference.end() && value != it->second) return false;
+    }
+    std::vector<std::pair<int, int>> got;
+    tree.scan(500, 2500, [&](const int& key, const int& val){ got.emplace_back(key, val); });
+    std::vector<std::pair<int, int>> want(reference.lower_bound(500), reference.lower_bound(2500));
+    return got == want;
+}
+
+bool testConcurrentStress() {
+    // Writers own the keys congruent to their id, so each key sees one
+    // thread's updates in that thread's order and the end state has to match
+    // replaying every writer's ops one after the other. Values are
+    // key * 1000 + step, which lets readers spot a value under the wrong key.
+    const uint64_t writers = 4, range = 4000;
+    const int ops = 40000;
+    ConcurrentBPlusTree<uint64_t, uint64_t, 4, 4> tree;
+    std::atomic<bool> bad(false), stop(false);
+    auto op = [&](uint64_t t, std::mt19937_64& rng, int i, uint64_t& key, uint64_t& val) {
+        key = (rng() % range) * writers + t;
+        val = key * 1000 + (uint64_t) (i % 1000);
+        return rng() % 10;
+    };
+    std::vector<std::thread> workers;
+    for(uint64_t t = 0; t < writers; t++) {
+        workers.emplace_back([&, t]{
+            std::mt19937_64 rng(t);
+            uint64_t key, val, found;
+            for(int i = 0; i < ops; i++) {
+                uint64_t kind = op(t, rng, i, key, val);
+                if(kind < 6) {
+                    tree.insert(key, val);
+                } else if(kind < 8) {
+                    tree.deleteNode(key);
+                } else if(tree.find(key ^ 1, found) && found / 1000 != (key ^ 1)) {
+                    bad = true;
+                }
+            }
+        });
+    }
+    // a scanner checks every range it sees is sorted and holds sane values
+    std::thread scanner([&]{
+        std::mt19937_64 rng(99);
+        while(!stop) {
+            uint64_t lo = rng() % (range * writers);
+            bool first = true;
+            uint64_t prev = 0;
+            tree.scan(lo, lo + 500, [&](const uint64_t& key, const uint64_t& val){
+                if((!first && !(prev < key)) || key < lo || val / 1000 != key) bad = true;
+                first = false;
+                prev = key;
+            });
+        }
+    });
+    for(auto& worker : workers) {
+        worker.join();
+    }
+    stop = true;
+    scanner.join();
+    if(bad || !tree.checkInvariants()) return false;
+
+    BPlusTree<uint64_t, uint64_t> reference;
+    for(uint64_t t = 0; t < writers; t++) {
+        std::mt19937_64 rng(t);
+        uint64_t key, val;
+        for(int i = 0; i < ops; i++) {
+            uint64_t kind = op(t, rng, i, key, val);
+            if(kind < 6) {
+                reference.insert(key, val);
+            } else if(kind < 8) {
+                reference.deleteNode(key);
+            }
+        }
+    }
+    if(tree.getCurrentMembers() != reference.getCurrentMembers()) return false;
+    std::vector<std::pair<uint64_t, uint64_t>> got, want;
+    tree.scan(0, range * writers, [&](const uint64_t& key, const uint64_t& val){ got.emplace_back(key, val); });
+    reference.scan(0, range * writers, [&](const uint64_t& key, uint64_t& val){ want.emplace_back(key, val); });
+    return got == want;
+}
+
+void runTests() {
+    int count = 0;
+    int total = 10;
+
+    tests::test(count, "Testing Insert and Find", testInsertAndFind);
+    tests::test(count, "Testing Duplicate Inserts", testDuplicateInserts);
+    tests::test(count, "Testing Delete", testDelete);
+    tests::test(count, "Testing Iterator", testIterator);
+    tests::test(count, "Testing Scan", testScan);
+    tests::test(count, "Testing Bulk Load", testBulkLoad);
+    tests::test(count, "Testing Bulk Load Throws", testBulkLoadThrows);
+    tests::test(count, "Testing Reset", testReset);
+    tests::test(count, "Testing Concurrent Single Thread", testConcurrentSingleThread);
+    tests::test(count, "Testing Concurrent Stress", testConcurrentStress);
+
+    std::cout << std::string(40, '-') << "\n";
+    std::cout << " -- BPlusTree: Passed [" << count << "/" << total << "] tests -- " << std::endl;
+
+    std::cout << std::string(40, '-') << "\n\n";
+}
+
+// prefills n keys, then each op reads with probability readPercent and
+// otherwise overwrites a random key
+template <class Tree>
+void benchConcurrent(const char* name, size_t threads, int readPercent, const std::vector<uint64_t>& keys, size_t opsPerThread) {
+    size_t n = keys.size();
+    Tree tree;
+    for(auto k : keys){
+        tree.insert(k, k);
+    }
+    std::string label = std::string(name) + " " + std::to_string(readPercent) + "% reads";
+    bench::parallel(label, threads, opsPerThread, [&](size_t t, size_t i){
+        uint64_t r = (i + 1) * 0x9E3779B97F4A7C15ULL + t * 0xBF58476D1CE4E5B9ULL;
+        uint64_t key = keys[(r >> 16) % n];
+        uint64_t value;
+        if((int) (r % 100) < readPercent){
+            bench::doNotOptimize(tree.find(key, value));
+        }else{
+            tree.insert(key, i);
+        }
+    });
+}
+
+// point operations as in btree::runBenchmarks, then range scans of growing
+// length, where the leaf chain competes with std::map's node-by-node walk
+void runBenchmarks(size_t n = 1000000) {
+    bench::header("BPlusTree benchmarks");
+    auto keys = bench::uniformKeys(n);
+    std::vector<uint64_t> sorted(keys);
+    std::sort(sorted.begin(), sorted.end());
+    const size_t scans = 1000;
+
+    BPlusTree<uint64_t, uint64_t> tree;
+    bench::run("BPlusTree insert", n, [&]{
+        for(auto k : keys) tree.insert(k, k);
+    });
+    bench::run("BPlusTree find (hit)", n, [&]{
+        for(auto k : keys) bench::doNotOptimize(tree.find(k));
+    });
+    std::map<uint64_t, uint64_t> map;
+    for(auto k : keys) map[k] = k;
+
+    for(size_t length : {(size_t) 10, (size_t) 1000, n / 10}){
+        if(length == 0 || length >= n){
+            continue;
+        }
+        std::string suffix = " scan " + std::to_string(length) + " keys";
+        uint64_t sum = 0;
+        bench::run(("BPlusTree" + suffix).c_str(), scans * length, [&]{
+            for(size_t s = 0; s < scans; s++){
+                size_t start = (s * 7919) % (n - length);
+                tree.scan(sorted[start], sorted[start + length], [&](const uint64_t&, uint64_t& v){ sum += v; });
+            }
+        });
+        bench::run(("BPlusTree iterator" + suffix).c_str(), scans * length, [&]{
+            for(size_t s = 0; s < scans; s++){
+                size_t start = (s * 7919) % (n - length);
+                auto it = tree.lowerBound(sorted[start]);
+                for(size_t i = 0; i < length; i++, ++it){
+                    sum += it.value();
+                }
+            }
+        });
+        bench::run(("std::map" + suffix).c_str(), scans * length, [&]{
+            for(size_t s = 0; s < scans; s++){
+                size_t start = (s * 7919) % (n - length);
+                auto it = map.lower_bound(sorted[start]);
+                for(size_t i = 0; i < length; i++, ++it){
+                    sum += it->second;
+                }
+            }
+        });
+        bench::doNotOptimize(sum);
+    }
+
+    // rebuilding from sorted input: n inserts against the bottom-up load
+    std::vector<std::pair<uint64_t, uint64_t>> entries;
+    entries.reserve(n);
+    for(auto k : sorted){
+        entries.emplace_back(k, k);
+    }
+    {
+        BPlusTree<uint64_t, uint64_t> rebuilt;
+        bench::run("BPlusTree sorted insert", n, [&]{
+            for(auto& e : entries) rebuilt.insert(e.first, e.second);
+        });
+        std::cout << "  leaves: " << rebuilt.getLeafCount() << "\n";
+    }
+    size_t maxThreads = std::max(1u, std::thread::hardware_concurrency());
+    for(size_t threads = 1; threads <= maxThreads; threads *= 2){
+        BPlusTree<uint64_t, uint64_t> loaded;
+        std::string label = "BPlusTree bulkLoad [" + std::to_string(threads) + " threads]";
+        bench::run(label.c_str(), n, [&]{
+            loaded.bulkLoad(entries.begin(), entries.end(), 1.0, threads);
+        });
+        if(threads == 1){
+            std::cout << "  leaves: " << loaded.getLeafCount() << "\n";
+        }
+    }
+
+    // 90% reads is the target mix; 100% shows the lock-free read path alone
+    for(int readPercent : {100, 90, 50}){
+        for(size_t threads = 1; threads <= maxThreads; threads *= 2){
+            benchConcurrent<LockedBPlusTree<uint64_t, uint64_t>>("LockedBPlusTree", threads, readPercent, keys, n);
+            benchConcurrent<ConcurrentBPlusTree<uint64_t, uint64_t>>("ConcurrentBPlusTree", threads, readPercent, keys, n);
+        }
+    }
+    std::cout << std::string(40, '-') << "\n\n";
+}
+
+}
 
 #endif /* BPlusTree_h */
@@ -7,6 +7,1037 @@
 
 #ifndef BTree_h
 #define BTree_h
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+#include "Testing.h"
+#include "Benchmark.h"
+#include "AVL.h"
+#include "NodeSearch.h"
 
+namespace btree {
+
+// enough keys to fill four cache lines, so a node search scans a few
+// adjacent lines instead of chasing one pointer per comparison
+template <class K>
+constexpr size_t defaultFanout() {
+    return (256 / sizeof(K) < 4) ? 4 : 256 / sizeof(K);
+}
+
+// keys and values sit in separate arrays so the search only touches keys;
+// leaves are allocated without the child array
+template <class K, class T, size_t FANOUT>
+struct alignas(64) Node {
+    static const size_t MAX_KEYS = FANOUT - 1;
+
+    uint32_t count;
+    bool leaf;
+    K keys[MAX_KEYS];
+    T vals[MAX_KEYS];
+
+    explicit Node(bool isLeaf): count(0), leaf(isLeaf), keys(), vals() {}
+};
+
+template <class K, class T, size_t FANOUT>
+struct InnerNode : Node<K, T, FANOUT> {
+    Node<K, T, FANOUT>* children[FANOUT];
+
+    InnerNode(): Node<K, T, FANOUT>(false), children() {}
+};
+
+// Classic B-tree: every node holds between MIN_KEYS and MAX_KEYS sorted keys
+// (the root may hold fewer). Insert splits full nodes and deleteNode refills
+// thin ones on the way down, so both finish in a single root-to-leaf pass.
+template <class K, class T, size_t FANOUT = defaultFanout<K>()>
+class BTree {
+    static_assert(FANOUT >= 4, "a B-tree node needs room for at least three keys");
+
+    using NodeT = Node<K, T, FANOUT>;
+    using Inner = InnerNode<K, T, FANOUT>;
+
+    static const size_t MAX_KEYS = FANOUT - 1;
+    static const size_t MIN_KEYS = (MAX_KEYS - 1) / 2;
+
+    NodeT* root;
+    size_t currentMembers;
+    size_t height;
+
+    static Inner* inner(NodeT* n){
+        return static_cast<Inner*>(n);
+    }
+
+    // first slot whose key is not less than key
+    static size_t lowerBound(const NodeT* n, const K& key){
+        return nodesearch::lowerBound(n->keys, n->count, key);
+    }
+
+    static bool matches(const NodeT* n, size_t i, const K& key){
+        return i < n->count && !(key < n->keys[i]);
+    }
+
+    static void freeNode(NodeT* n){
+        if(n->leaf){
+            delete n;
+        }else{
+            delete inner(n);
+        }
+    }
+
+    static void destroy(NodeT* n){
+        if(!n->leaf){
+            for(size_t i = 0; i <= n->count; i++){
+                destroy(inner(n)->children[i]);
+            }
+        }
+        freeNode(n);
+    }
+
+    // child i of parent is full: its middle key moves up into parent and the
+    // upper half becomes a new sibling at i + 1
+    void splitChild(Inner* parent, size_t i){
+        NodeT* child = parent->children[i];
+        size_t mid = MAX_KEYS / 2;
+        NodeT* right = child->leaf ? new NodeT(true) : new Inner();
+
+        right->count = (uint32_t) (MAX_KEYS - mid - 1);
+        std::move(child->keys + mid + 1, child->keys + MAX_KEYS, right->keys);
+        std::move(child->vals + mid + 1, child->vals + MAX_KEYS, right->vals);
+        if(!child->leaf){
+            std::copy(inner(child)->children + mid + 1, inner(child)->children + MAX_KEYS + 1, inner(right)->children);
+        }
+        child->count = (uint32_t) mid;
+
+        std::move_backward(parent->keys + i, parent->keys + parent->count, parent->keys + parent->count + 1);
+        std::move_backward(parent->vals + i, parent->vals + parent->count, parent->vals + parent->count + 1);
+        std::copy_backward(parent->children + i + 1, parent->children + parent->count + 1, parent->children + parent->count + 2);
+        parent->keys[i] = std::move(child->keys[mid]);
+        parent->vals[i] = std::move(child->vals[mid]);
+        parent->children[i + 1] = right;
+        parent->count += 1;
+    }
+
+    // child i takes parent's separator, the left sibling's last key replaces it
+    void borrowFromLeft(Inner* parent, size_t i){
+        NodeT* child = parent->children[i];
+        NodeT* sibling = parent->children[i - 1];
+
+        std::move_backward(child->keys, child->keys + child->count, child->keys + child->count + 1);
+        std::move_backward(child->vals, child->vals + child->count, child->vals + child->count + 1);
+        child->keys[0] = std::move(parent->keys[i - 1]);
+        child->vals[0] = std::move(parent->vals[i - 1]);
+        if(!child->leaf){
+            std::copy_backward(inner(child)->children, inner(child)->children + child->count + 1, inner(child)->children + child->count + 2);
+            inner(child)->children[0] = inner(sibling)->children[sibling->count];
+        }
+        parent->keys[i - 1] = std::move(sibling->keys[sibling->count - 1]);
+        parent->vals[i - 1] = std::move(sibling->vals[sibling->count - 1]);
+        sibling->count -= 1;
+        child->count += 1;
+    }
+
+    // mirror of borrowFromLeft with the right sibling's first key
+    void borrowFromRight(Inner* parent, size_t i){
+        NodeT* child = parent->children[i];
+        NodeT* sibling = parent->children[i + 1];
+
+        child->keys[child->count] = std::move(parent->keys[i]);
+        child->vals[child->count] = std::move(parent->vals[i]);
+        if(!child->leaf){
+            inner(child)->children[child->count + 1] = inner(sibling)->children[0];
+            std::copy(inner(sibling)->children + 1, inner(sibling)->children + sibling->count + 1, inner(sibling)->children);
+        }
+        parent->keys[i] = std::move(sibling->keys[0]);
+        parent->vals[i] = std::move(sibling->vals[0]);
+        std::move(sibling->keys + 1, sibling->keys + sibling->count, sibling->keys);
+        std::move(sibling->vals + 1, sibling->vals + sibling->count, sibling->vals);
+        sibling->count -= 1;
+        child->count += 1;
+    }
+
+    // folds separator i and child i + 1 into child i
+    void merge(Inner* parent, size_t i){
+        NodeT* left = parent->children[i];
+        NodeT* right = parent->children[i + 1];
+
+        left->keys[left->count] = std::move(parent->keys[i]);
+        left->vals[left->count] = std::move(parent->vals[i]);
+        std::move(right->keys, right->keys + right->count, left->keys + left->count + 1);
+        std::move(right->vals, right->vals + right->count, left->vals + left->count + 1);
+        if(!left->leaf){
+            std::copy(inner(right)->children, inner(right)->children + right->count + 1, inner(left)->children + left->count + 1);
+        }
+        left->count += right->count + 1;
+        freeNode(right);
+
+        std::move(parent->keys + i + 1, parent->keys + parent->count, parent->keys + i);
+        std::move(parent->vals + i + 1, parent->vals + parent->count, parent->vals + i);
+        std::copy(parent->children + i + 2, parent->children + parent->count + 1, parent->children + i + 1);
+        parent->count -= 1;
+    }
+
+    // gives child i more than MIN_KEYS keys before we descend into it and
+    // returns the index the child ends up at
+    size_t fill(Inner* parent, size_t i){
+        if(i > 0 && parent->children[i - 1]->count > MIN_KEYS){
+            borrowFromLeft(parent, i);
+        }else if(i < parent->count && parent->children[i + 1]->count > MIN_KEYS){
+            borrowFromRight(parent, i);
+        }else if(i < parent->count){
+            merge(parent, i);
+        }else{
+            merge(parent, i - 1);
+            i -= 1;
+        }
+        return i;
+    }
+
+    bool checkNode(NodeT* n, const K* lo, const K* hi, size_t depth, size_t& leafDepth, size_t& members){
+        if(n != root && (n->count < MIN_KEYS || n->count > MAX_KEYS)){
+            return false;
+        }
+        for(size_t i = 0; i < n->count; i++){
+            if((i > 0 && !(n->keys[i - 1] < n->keys[i])) || (lo && !(*lo < n->keys[i])) || (hi && !(n->keys[i] < *hi))){
+                return false;
+            }
+        }
+        members += n->count;
+        if(n->leaf){
+            if(leafDepth == 0){
+                leafDepth = depth;
+            }
+            return leafDepth == depth;
+        }
+        for(size_t i = 0; i <= n->count; i++){
+            const K* childLo = (i == 0) ? lo : &n->keys[i - 1];
+            const K* childHi = (i == n->count) ? hi : &n->keys[i];
+            if(!checkNode(inner(n)->children[i], childLo, childHi, depth + 1, leafDepth, members)){
+                return false;
+            }
+        }
+        return true;
+    }
+
+public:
+    BTree(): root(new NodeT(true)), currentMembers(0), height(1) {}
+
+    BTree(const BTree&) = delete;
+    BTree& operator=(const BTree&) = delete;
+
+    ~BTree(){
+        destroy(root);
+    }
+
+    size_t getCurrentMembers(){
+        return currentMembers;
+    }
+
+    size_t getHeight(){
+        return height;
+    }
+
+    // returns false if the key was already there and only its value changed
+    bool insert(K key, T val){
+        if(root->count == MAX_KEYS){
+            Inner* newRoot = new Inner();
+            newRoot->children[0] = root;
+            splitChild(newRoot, 0);
+            root = newRoot;
+            height += 1;
+        }
+        NodeT* n = root;
+        while(true){
+            size_t i = lowerBound(n, key);
+            if(matches(n, i, key)){
+                n->vals[i] = val;
+                return false;
+            }
+            if(n->leaf){
+                std::move_backward(n->keys + i, n->keys + n->count, n->keys + n->count + 1);
+                std::move_backward(n->vals + i, n->vals + n->count, n->vals + n->count + 1);
+                n->keys[i] = key;
+                n->vals[i] = val;
+                n->count += 1;
+                currentMembers += 1;
+                return true;
+            }
+            Inner* in = inner(n);
+            if(in->children[i]->count == MAX_KEYS){
+                splitChild(in, i);
+                if(!(key < in->keys[i]) && !(in->keys[i] < key)){
+                    in->vals[i] = val;
+                    return false;
+                }
+                if(in->keys[i] < key){
+                    i += 1;
+                }
+            }
+            n = in->children[i];
+        }
+    }
+
+    T* find(K key){
+        NodeT* n = root;
+        while(true){
+            size_t i = lowerBound(n, key);
+            if(matches(n, i, key)){
+                return &n->vals[i];
+            }
+            if(n->leaf){
+                return nullptr;
+            }
+            n = inner(n)->children[i];
+        }
+    }
+
+    bool deleteNode(K key){
+        bool removed = false;
+        NodeT* n = root;
+        while(true){
+            size_t i = lowerBound(n, key);
+            bool found = matches(n, i, key);
+            if(n->leaf){
+                if(found){
+                    std::move(n->keys + i + 1, n->keys + n->count, n->keys + i);
+                    std::move(n->vals + i + 1, n->vals + n->count, n->vals + i);
+                    n->count -= 1;
+                    removed = true;
+                }
+                break;
+            }
+            Inner* in = inner(n);
+            if(found){
+                NodeT* left = in->children[i];
+                NodeT* right = in->children[i + 1];
+                if(left->count > MIN_KEYS || right->count > MIN_KEYS){
+                    // swap in the predecessor (or successor) from the fuller
+                    // side and go on to delete that one from its leaf
+                    bool useLeft = left->count > MIN_KEYS;
+                    NodeT* m = useLeft ? left : right;
+                    while(!m->leaf){
+                        m = inner(m)->children[useLeft ? m->count : 0];
+                    }
+                    size_t j = useLeft ? m->count - 1 : 0;
+                    in->keys[i] = m->keys[j];
+                    in->vals[i] = m->vals[j];
+                    key = m->keys[j];
+                    n = useLeft ? left : right;
+                }else{
+                    merge(in, i);
+                    n = left;
+                }
+                continue;
+            }
+            if(in->children[i]->count == MIN_KEYS){
+                i = fill(in, i);
+            }
+            n = in->children[i];
+        }
+        // a merge may have emptied the root
+        if(root->count == 0 && !root->leaf){
+            NodeT* old = root;
+            root = inner(old)->children[0];
+            delete inner(old);
+            height -= 1;
+        }
+        if(removed){
+            currentMembers -= 1;
+        }
+        return removed;
+    }
+
+    bool reset(){
+        try{
+            destroy(root);
+            root = new NodeT(true);
+            currentMembers = 0;
+            height = 1;
+            return true;
+        }catch(...){
+            return false;
+        }
+    }
+
+    // key order, node occupancy and equal leaf depth, for the tests
+    bool checkInvariants(){
+        size_t leafDepth = 0, members = 0;
+        return checkNode(root, nullptr, nullptr, 1, leafDepth, members) && members == currentMembers;
+    }
+};
+
+enum class MessageType : uint8_t {
+    INSERT,
+    DELETE,
+    UPSERT
+};
+
+// a pending update, waiting in an inner node's buffer until it is flushed
+template <class K, class T>
+struct Message {
+    K key;
+    T val;
+    MessageType type;
+};
+
+// Inner nodes keep one buffer of messages per child, oldest first; leaves
+// only use keys and vals. Nodes may briefly overflow during a flush, so
+// everything is a vector.
+template <class K, class T>
+struct BufferedNode {
+    bool leaf;
+    std::vector<K> keys;
+    std::vector<T> vals;
+    std::vector<BufferedNode*> children;
+    std::vector<std::vector<Message<K, T>>> buffers;
+    size_t buffered;
+
+    explicit BufferedNode(bool isLeaf): leaf(isLeaf), buffered(0) {}
+};
+
+// Write-optimized B-tree (a B-epsilon tree). Updates are not applied in
+// place: they go into the root's buffer as messages, and when a buffer
+// passes BUFFER messages the largest group bound for one child is moved
+// down in a single batch. A random insert thus costs an append, plus its
+// share of a few bulk flushes, instead of a walk to its own leaf. Nodes
+// split when a flush reaches them; there are no merges, but subtrees that
+// a flush leaves empty are dropped.
+//
+// find merges the messages it meets on the way down with what the leaf
+// holds, so reads pay for the buffering. Values live in the leaves only,
+// with keys equal to a pivot to its right, as in bplustree::BPlusTree.
+// upsert(key, delta) stores combine(old, delta), or combine(T(), delta) for
+// a missing key; Combine has to be associative, as std::plus is.
+template <class K, class T, size_t FANOUT = 16, size_t BUFFER = 1024, size_t LEAF_SIZE = 128, class Combine = std::plus<T>>
+class BufferedBTree {
+    static_assert(FANOUT >= 3 && LEAF_SIZE >= 2 && BUFFER >= 1, "nodes need room to split");
+
+    using NodeT = BufferedNode<K, T>;
+    using MessageT = Message<K, T>;
+
+    NodeT* root;
+    size_t currentMembers;
+    size_t height;
+    Combine combine;
+    // reused by every leaf flush
+    std::vector<MessageT> sorted;
+    std::vector<K> mergedKeys;
+    std::vector<T> mergedVals;
+
+    static size_t childIndex(const NodeT* n, const K& key){
+        return nodesearch::upperBound(n->keys.data(), n->keys.size(), key);
+    }
+
+    static bool overfull(const NodeT* n){
+        return n->leaf ? n->keys.size() > LEAF_SIZE : n->children.size() > FANOUT;
+    }
+
+    static void destroy(NodeT* n){
+        for(NodeT* child : n->children){
+            destroy(child);
+        }
+        delete n;
+    }
+
+    void apply(T& val, bool& present, const MessageT& m){
+        if(m.type == MessageType::INSERT){
+            val = m.val;
+            present = true;
+        }else if(m.type == MessageType::DELETE){
+            present = false;
+        }else{
+            val = present ? combine(val, m.val) : combine(T(), m.val);
+            present = true;
+        }
+    }
+
+    // merges a batch of messages, oldest first, into a leaf
+    void applyToLeaf(NodeT* leaf, const MessageT* messages, size_t count){
+        sorted.assign(messages, messages + count);
+        std::stable_sort(sorted.begin(), sorted.end(), [](const MessageT& a, const MessageT& b){ return a.key < b.key; });
+        mergedKeys.clear();
+        mergedVals.clear();
+        size_t i = 0, j = 0, size = leaf->keys.size();
+        while(i < size || j < count){
+            if(j == count || (i < size && leaf->keys[i] < sorted[j].key)){
+                mergedKeys.push_back(std::move(leaf->keys[i]));
+                mergedVals.push_back(std::move(leaf->vals[i]));
+                i += 1;
+                continue;
+            }
+            K key = sorted[j].key;
+            T val = T();
+            bool present = false;
+            if(i < size && !(key < leaf->keys[i])){
+                val = std::move(leaf->vals[i]);
+                present = true;
+                i += 1;
+            }
+            bool existed = present;
+            for(; j < count && !(key < sorted[j].key); j++){
+                apply(val, present, sorted[j]);
+            }
+            if(present){
+                mergedKeys.push_back(std::move(key));
+                mergedVals.push_back(std::move(val));
+            }
+            currentMembers = currentMembers + present - existed;
+        }
+        leaf->keys.swap(mergedKeys);
+        leaf->vals.swap(mergedVals);
+    }
+
+    // Cuts an overfull child into as few even pieces as fit and links the
+    // new ones in after it; separators of inner pieces move up, and the
+    // parent's buffer for the child is divided among the pieces.
+    void splitChild(NodeT* parent, size_t i){
+        NodeT* child = parent->children[i];
+        size_t size = child->leaf ? child->keys.size() : child->children.size();
+        size_t cap = child->leaf ? LEAF_SIZE : FANOUT;
+        size_t pieces = (size + cap - 1) / cap;
+        std::vector<NodeT*> nodes{child};
+        std::vector<K> separators;
+        size_t end = size;
+        // build pieces from the back so the child keeps its front part
+        for(size_t p = pieces - 1; p > 0; p--){
+            size_t start = p * size / pieces;
+            NodeT* piece = new NodeT(child->leaf);
+            if(child->leaf){
+                piece->keys.assign(std::make_move_iterator(child->keys.begin() + start), std::make_move_iterator(child->keys.begin() + end));
+                piece->vals.assign(std::make_move_iterator(child->vals.begin() + start), std::make_move_iterator(child->vals.begin() + end));
+                separators.push_back(piece->keys[0]);
+                child->keys.resize(start);
+                child->vals.resize(start);
+            }else{
+                // pivots start .. end - 2 stay with the piece, start - 1 moves up
+                piece->keys.assign(std::make_move_iterator(child->keys.begin() + start), std::make_move_iterator(child->keys.begin() + end - 1));
+                piece->children.assign(child->children.begin() + start, child->children.begin() + end);
+                piece->buffers.assign(std::make_move_iterator(child->buffers.begin() + start), std::make_move_iterator(child->buffers.begin() + end));
+                for(auto& buffer : piece->buffers){
+                    piece->buffered += buffer.size();
+                }
+                separators.push_back(std::move(child->keys[start - 1]));
+                child->keys.resize(start - 1);
+                child->children.resize(start);
+                child->buffers.resize(start);
+                child->buffered -= piece->buffered;
+            }
+            nodes.push_back(piece);
+            end = start;
+        }
+        std::reverse(nodes.begin() + 1, nodes.end());
+        std::reverse(separators.begin(), separators.end());
+
+        std::vector<std::vector<MessageT>> buffers(pieces);
+        for(MessageT& m : parent->buffers[i]){
+            buffers[std::upper_bound(separators.begin(), separators.end(), m.key) - separators.begin()].push_back(std::move(m));
+        }
+        parent->keys.insert(parent->keys.begin() + i, std::make_move_iterator(separators.begin()), std::make_move_iterator(separators.end()));
+        parent->children.insert(parent->children.begin() + i + 1, nodes.begin() + 1, nodes.end());
+        parent->buffers[i].swap(buffers[0]);
+        parent->buffers.insert(parent->buffers.begin() + i + 1, std::make_move_iterator(buffers.begin() + 1), std::make_move_iterator(buffers.end()));
+    }
+
+    // an empty leaf, or an inner node with no messages above one
+    static bool isEmpty(const NodeT* n){
+        if(n->leaf){
+            return n->keys.empty();
+        }
+        return n->buffered == 0 && n->children.size() == 1 && isEmpty(n->children[0]);
+    }
+
+    // splits an overfull child, or drops it if it is empty and has siblings
+    void fixChild(NodeT* parent, size_t i){
+        NodeT* child = parent->children[i];
+        if(overfull(child)){
+            splitChild(parent, i);
+        }else if(parent->children.size() > 1 && parent->buffers[i].empty() && isEmpty(child)){
+            destroy(child);
+            parent->children.erase(parent->children.begin() + i);
+            parent->buffers.erase(parent->buffers.begin() + i);
+            parent->keys.erase(parent->keys.begin() + (i > 0 ? i - 1 : 0));
+        }
+    }
+
+    // appends the messages bound for child i to the child's own buffers, or
+    // applies them if it is a leaf
+    void moveDown(NodeT* n, size_t i){
+        std::vector<MessageT>& buffer = n->buffers[i];
+        NodeT* child = n->children[i];
+        if(child->leaf){
+            applyToLeaf(child, buffer.data(), buffer.size());
+        }else{
+            for(MessageT& m : buffer){
+                child->buffers[childIndex(child, m.key)].push_back(std::move(m));
+            }
+            child->buffered += buffer.size();
+        }
+        n->buffered -= buffer.size();
+        buffer.clear();
+    }
+
+    // flushes the fullest child buffer until the node is within BUFFER
+    void flushNode(NodeT* n){
+        while(n->buffered > BUFFER){
+            size_t i = 0;
+            for(size_t c = 1; c < n->buffers.size(); c++){
+                if(n->buffers[c].size() > n->buffers[i].size()){
+                    i = c;
+                }
+            }
+            NodeT* child = n->children[i];
+            moveDown(n, i);
+            if(!child->leaf && child->buffered > BUFFER){
+                flushNode(child);
+            }
+            fixChild(n, i);
+        }
+    }
+
+    // moves every message in the subtree to the leaves; children are
+    // visited from the back so splits and removals do not shift the rest
+    void flushAll(NodeT* n){
+        for(size_t i = n->children.size(); i-- > 0;){
+            NodeT* child = n->children[i];
+            moveDown(n, i);
+            if(!child->leaf){
+                flushAll(child);
+            }
+            fixChild(n, i);
+        }
+    }
+
+    void send(MessageT&& m){
+        if(root->leaf){
+            applyToLeaf(root, &m, 1);
+        }else{
+            root->buffers[childIndex(root, m.key)].push_back(std::move(m));
+            root->buffered += 1;
+            flushNode(root);
+        }
+        growRoot();
+    }
+
+    void growRoot(){
+        while(overfull(root)){
+            NodeT* newRoot = new NodeT(false);
+            newRoot->children.push_back(root);
+            newRoot->buffers.emplace_back();
+            splitChild(newRoot, 0);
+            root = newRoot;
+            height += 1;
+        }
+    }
+
+    static size_t pendingIn(NodeT* n){
+        size_t pending = n->buffered;
+        for(NodeT* child : n->children){
+            if(!child->leaf){
+                pending += pendingIn(child);
+            }
+        }
+        return pending;
+    }
+
+    bool checkNode(NodeT* n, const K* lo, const K* hi, size_t depth, size_t& leafDepth, size_t& members){
+        for(size_t i = 0; i < n->keys.size(); i++){
+            if((i > 0 && !(n->keys[i - 1] < n->keys[i])) || (lo && n->keys[i] < *lo) || (hi && !(n->keys[i] < *hi))){
+                return false;
+            }
+        }
+        if(n->leaf){
+            if(leafDepth == 0){
+                leafDepth = depth;
+            }
+            members += n->keys.size();
+            return leafDepth == depth && n->keys.size() == n->vals.size() && n->keys.size() <= LEAF_SIZE;
+        }
+        if(n->children.empty() || n->children.size() > FANOUT || n->children.size() != n->keys.size() + 1 ||
+           n->buffers.size() != n->children.size() || n->buffered > BUFFER){
+            return false;
+        }
+        size_t buffered = 0;
+        for(size_t i = 0; i < n->children.size(); i++){
+            const K* childLo = (i == 0) ? lo : &n->keys[i - 1];
+            const K* childHi = (i == n->keys.size()) ? hi : &n->keys[i];
+            // every message waits in the buffer of the child its key routes to
+            for(const MessageT& m : n->buffers[i]){
+                if((childLo && m.key < *childLo) || (childHi && !(m.key < *childHi))){
+                    return false;
+                }
+            }
+            buffered += n->buffers[i].size();
+            if(!checkNode(n->children[i], childLo, childHi, depth + 1, leafDepth, members)){
+                return false;
+            }
+        }
+        return buffered == n->buffered;
+    }
+
+public:
+    BufferedBTree(): root(new NodeT(true)), currentMembers(0), height(1) {}
+
+    BufferedBTree(const BufferedBTree&) = delete;
+    BufferedBTree& operator=(const BufferedBTree&) = delete;
+
+    ~BufferedBTree(){
+        destroy(root);
+    }
+
+    // pending messages have to reach the leaves before they can be counted,
+    // so this flushes everything first
+    size_t getCurrentMembers(){
+        flush();
+        return currentMembers;
+    }
+
+    size_t getHeight(){
+        return height;
+    }
+
+    // messages still waiting in buffers
+    size_t getPending(){
+        return root->leaf ? 0 : pendingIn(root);
+    }
+
+    // Updates are blind: they do not look for the key, so unlike
+    // BTree::insert and deleteNode they cannot report whether it was there.
+    void insert(K key, T val){
+        send(MessageT{std::move(key), std::move(val), MessageType::INSERT});
+    }
+
+    void upsert(K key, T delta){
+        send(MessageT{std::move(key), std::move(delta), MessageType::UPSERT});
+    }
+
+    void deleteNode(K key){
+        send(MessageT{std::move(key), T(), MessageType::DELETE});
+    }
+
+    // Walks the buffers from the root down, newest messages first: an insert
+    // or delete settles the value, upserts are folded into one delta that is
+    // applied to whatever settles it, the leaf entry if nothing else does.
+    bool find(const K& key, T& out){
+        NodeT* n = root;
+        T delta = T();
+        bool hasDelta = false;
+        while(!n->leaf){
+            size_t i = childIndex(n, key);
+            const std::vector<MessageT>& buffer = n->buffers[i];
+            for(size_t j = buffer.size(); j-- > 0;){
+                const MessageT& m = buffer[j];
+                if(m.key < key || key < m.key){
+                    continue;
+                }
+                if(m.type == MessageType::UPSERT){
+                    delta = hasDelta ? combine(m.val, delta) : m.val;
+                    hasDelta = true;
+                    continue;
+                }
+                if(m.type == MessageType::DELETE && !hasDelta){
+                    return false;
+                }
+                out = !hasDelta ? m.val : combine(m.type == MessageType::INSERT ? m.val : T(), delta);
+                return true;
+            }
+            n = n->children[i];
+        }
+        size_t i = nodesearch::lowerBound(n->keys.data(), n->keys.size(), key);
+        if(i < n->keys.size() && !(key < n->keys[i])){
+            out = hasDelta ? combine(n->vals[i], delta) : n->vals[i];
+            return true;
+        }
+        if(hasDelta){
+            out = combine(T(), delta);
+            return true;
+        }
+        return false;
+    }
+
+    bool contains(const K& key){
+        T ignored;
+        return find(key, ignored);
+    }
+
+    // applies every pending message; the root shrinks if subtrees were dropped
+    void flush(){
+        if(root->leaf){
+            return;
+        }
+        flushAll(root);
+        growRoot();
+        while(!root->leaf && root->children.size() == 1){
+            NodeT* old = root;
+            root = old->children[0];
+            delete old;
+            height -= 1;
+        }
+    }
+
+    bool reset(){
+        try{
+            destroy(root);
+            root = new NodeT(true);
+            currentMembers = 0;
+            height = 1;
+            return true;
+        }catch(...){
+            return false;
+        }
+    }
+
+    // key order, buffer routing, node sizes and equal leaf depth, for the tests
+    bool checkInvariants(){
+        size_t leafDepth = 0, members = 0;
+        return checkNode(root, nullptr, nullptr, 1, leafDepth, members) && members == currentMembers;
+    }
+};
+
+bool testInsertAndFind() {
+    BTree<int, std::string> tree;
+    tree.insert(1, "one");
+    tree.insert(2, "two");
+    tree.insert(3, "three");
+
+    if(*tree.find(1) != "one") return false;
+    if(*tree.find(2) != "two") return false;
+    if(*tree.find(3) != "three") return false;
+    if(tree.find(4) != nullptr) return false;
+    return true;
+}
+
+bool testDuplicateInserts() {
+    BTree<int, std::string> tree;
+    if(!tree.insert(1, "one")) return false;
+    if(tree.insert(1, "uno")) return false;
+
+    if(*tree.find(1) != "uno" || tree.getCurrentMembers() != 1) return false;
+    return true;
+}
+
+bool testSplits() {
+    // a small fanout forces splits at every level
+    BTree<int, int, 4> tree;
+    for(int i = 0; i < 10000; i++) {
+        tree.insert((i * 7919) % 10000, i);
+    }
+    if(tree.getCurrentMembers() != 10000 || tree.getHeight() < 5) return false;
+    if(!tree.checkInvariants()) return false;
+    for(int i = 0; i < 10000; i++) {
+        if(*tree.find((i * 7919) % 10000) != i) return false;
+    }
+    return true;
+}
+
+bool testDelete() {
+    BTree<int, int, 6> tree;
+    std::map<int, int> reference;
+    std::mt19937 rng(1);
+    for(int i = 0; i < 20000; i++) {
+        int key = (int) (rng() % 2000);
+        if(rng() % 3 == 0) {
+            if(tree.deleteNode(key) != (reference.erase(key) == 1)) return false;
+        } else {
+            tree.insert(key, i);
+            reference[key] = i;
+        }
+    }
+    if(!tree.checkInvariants() || tree.getCurrentMembers() != reference.size()) return false;
+    for(int key = 0; key < 2000; key++) {
+        auto it = reference.find(key);
+        int* found = tree.find(key);
+        if((it == reference.end()) != (found == nullptr)) return false;
+        if(found && *found != it->second) return false;
+    }
+    // draining the tree collapses it back to a single leaf
+    for(int key = 0; key < 2000; key++) {
+        tree.deleteNode(key);
+    }
+    return tree.getCurrentMembers() == 0 && tree.getHeight() == 1 && tree.checkInvariants();
+}
+
+bool testReset() {
+    BTree<int, std::string> tree;
+    for(int i = 0; i < 1000; i++) {
+        tree.insert(i, std::to_string(i));
+    }
+    if(!tree.reset()) return false;
+    if(tree.getCurrentMembers() != 0 || tree.find(1) != nullptr) return false;
+    tree.insert(1, "one");
+    return *tree.find(1) == "one";
+}
+
+bool testBufferedAgainstMap() {
+    // tiny nodes and buffers force flushes, splits and leaf drops at every level
+    BufferedBTree<int, int, 4, 8, 4> tree;
+    std::map<int, int> reference;
+    std::mt19937 rng(5);
+    int value = 0;
+    for(int i = 0; i < 30000; i++) {
+        int key = (int) (rng() % 3000);
+        switch(rng() % 5) {
+            case 0:
+                tree.deleteNode(key);
+                reference.erase(key);
+                break;
+            case 1:
+                tree.upsert(key, i);
+                reference[key] += i;
+                break;
+            case 2: {
+                // reads see pending messages before they are flushed
+                auto it = reference.find(key);
+                if(tree.find(key, value) != (it != reference.end())) return false;
+                if(it != reference.end() && value != it->second) return false;
+                break;
+            }
+            default:
+                tree.insert(key, i);
+                reference[key] = i;
+        }
+    }
+    if(!tree.checkInvariants() || tree.getPending() == 0) return false;
+    if(tree.getCurrentMembers() != reference.size() || tree.getPending() != 0 || !tree.checkInvariants()) return false;
+    for(int key = 0; key < 3000; key++) {
+        auto it = reference.find(key);
+        if(tree.find(key, value) != (it != reference.end())) return false;
+        if(it != reference.end() && value != it->second) return false;
+    }
+    return true;
+}
+
+bool testBufferedUpsert() {
+    BufferedBTree<int, int, 4, 16, 8> tree;
+    for(int round = 0; round < 10; round++) {
+        for(int key = 0; key < 500; key++) {
+            tree.upsert(key, 1);
+        }
+    }
+    // a delete drops earlier upserts, an insert resets the count
+    tree.deleteNode(7);
+    tree.upsert(7, 1);
+    tree.insert(8, 100);
+    tree.upsert(8, 1);
+    int value = 0;
+    for(int key = 0; key < 500; key++) {
+        int expected = (key == 7) ? 1 : (key == 8) ? 101 : 10;
+        if(!tree.find(key, value) || value != expected) return false;
+    }
+    // a custom combine only has to be associative
+    BufferedBTree<int, std::string, 4, 8, 4> log;
+    for(int i = 0; i < 300; i++) {
+        log.upsert(i % 3, std::to_string(i % 10));
+    }
+    std::string text;
+    if(!log.find(1, text) || text.size() != 100 || text.substr(0, 4) != "1470") return false;
+    return log.getCurrentMembers() == 3 && log.checkInvariants();
+}
+
+bool testBufferedDrain() {
+    BufferedBTree<int, int, 4, 8, 4> tree;
+    for(int i = 0; i < 10000; i++) {
+        tree.insert((i * 7919) % 10000, i);
+    }
+    if(tree.getCurrentMembers() != 10000 || tree.getHeight() < 4 || !tree.checkInvariants()) return false;
+    for(int i = 0; i < 10000; i++) {
+        tree.deleteNode(i);
+    }
+    // dropped leaves let the tree collapse back to a single leaf
+    return tree.getCurrentMembers() == 0 && tree.getHeight() == 1 && tree.checkInvariants() && !tree.contains(5);
+}
+
+void runTests() {
+    int count = 0;
+    int total = 8;
+
+    tests::test(count, "Testing Insert and Find", testInsertAndFind);
+    tests::test(count, "Testing Duplicate Inserts", testDuplicateInserts);
+    tests::test(count, "Testing Splits", testSplits);
+    tests::test(count, "Testing Delete", testDelete);
+    tests::test(count, "Testing Reset", testReset);
+    tests::test(count, "Testing Buffered Against Map", testBufferedAgainstMap);
+    tests::test(count, "Testing Buffered Upsert", testBufferedUpsert);
+    tests::test(count, "Testing Buffered Drain", testBufferedDrain);
+
+    std::cout << std::string(40, '-') << "\n";
+    std::cout << " -- BTree: Passed [" << count << "/" << total << "] tests -- " << std::endl;
+
+    std::cout << std::string(40, '-') << "\n\n";
+}
+
+// random inserts and point lookups against the other ordered containers,
+// BufferedBTree among them; n is meant to run from 1M to 100M keys
+void runBenchmarks(size_t n = 1000000) {
+    bench::header("BTree benchmarks");
+    auto keys = bench::uniformKeys(n);
+    auto misses = bench::uniformKeys(n, 7);
+
+    {
+        BTree<uint64_t, uint64_t> tree;
+        bench::run("BTree insert", n, [&]{
+            for(auto k : keys) tree.insert(k, k);
+        });
+        bench::run("BTree find (hit)", n, [&]{
+            for(auto k : keys) bench::doNotOptimize(tree.find(k));
+        });
+        bench::run("BTree find (miss)", n, [&]{
+            for(auto k : misses) bench::doNotOptimize(tree.find(k));
+        });
+    }
+    {
+        // inserts are timed up to the last one sent; the final flush that
+        // settles the rest is reported on its own
+        BufferedBTree<uint64_t, uint64_t> tree;
+        uint64_t value;
+        bench::run("BufferedBTree insert", n, [&]{
+            for(auto k : keys) tree.insert(k, k);
+        });
+        std::cout << "  pending: " << tree.getPending() << "\n";
+        bench::run("BufferedBTree find (hit, buffered)", n, [&]{
+            for(auto k : keys) bench::doNotOptimize(tree.find(k, value));
+        });
+        bench::run("BufferedBTree flush", n, [&]{
+            tree.flush();
+        });
+        bench::run("BufferedBTree find (hit)", n, [&]{
+            for(auto k : keys) bench::doNotOptimize(tree.find(k, value));
+        });
+        bench::run("BufferedBTree upsert", n, [&]{
+            for(auto k : keys) tree.upsert(k, 1);
+        });
+    }
+    {
+        avl::AVL<uint64_t> tree;
+        bench::run("avl::AVL insert", n, [&]{
+            for(auto k : keys) tree.insert(k);
+        });
+        bench::run("avl::AVL find (hit)", n, [&]{
+            for(auto k : keys) bench::doNotOptimize(tree.find(k));
+        });
+        bench::run("avl::AVL find (miss)", n, [&]{
+            for(auto k : misses) bench::doNotOptimize(tree.find(k));
+        });
+    }
+    {
+        std::map<uint64_t, uint64_t> tree;
+        bench::run("std::map insert", n, [&]{
+            for(auto k : keys) tree[k] = k;
+        });
+        bench::run("std::map find (hit)", n, [&]{
+            for(auto k : keys) bench::doNotOptimize(tree.find(k));
+        });
+        bench::run("std::map find (miss)", n, [&]{
+            for(auto k : misses) bench::doNotOptimize(tree.find(k));
+        });
+    }
+    std::cout << std::string(40, '-') << "\n\n";
+}
+
+}
 
 #endif /* BTree_h */
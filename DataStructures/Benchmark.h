@@ -0,0 +1,394 @@
+//
+//  Benchmark.h
+//  AdvancedDSA
+//
+//
+
+#ifndef Benchmark_h
+#define Benchmark_h
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <cstdint>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace bench {
+
+using Clock = std::chrono::steady_clock;
+
+// keeps the compiler from optimizing away results we never read
+template <class V>
+void doNotOptimize(V const& value) {
+#if defined(__GNUC__) || defined(__clang__)
+    asm volatile("" : : "r,m"(value) : "memory");
+#else
+    static volatile const V* sink;
+    sink = &value;
+#endif
+}
+
+// times a single call of func, which performs ops operations, and prints ns/op
+template <class F>
+double run(const char* name, size_t ops, F&& func) {
+    auto start = Clock::now();
+    func();
+    auto end = Clock::now();
+    double ns = (double) std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+    double perOp = ops ? ns / (double) ops : ns;
+    std::cout << "Running " << name << " ... " << perOp << " ns/op\n";
+    return perOp;
+}
+
+struct Percentiles {
+    uint64_t p50, p90, p99, p999, p9999, max;
+};
+
+// sorts samples in place
+Percentiles percentiles(std::vector<uint64_t>& samples) {
+    Percentiles result{0, 0, 0, 0, 0, 0};
+    size_t n = samples.size();
+    if(n == 0){
+        return result;
+    }
+    std::sort(samples.begin(), samples.end());
+    auto pct = [&](double p){
+        return samples[std::min(n - 1, (size_t) (p * (double) n))];
+    };
+    result.p50 = pct(0.5);
+    result.p90 = pct(0.9);
+    result.p99 = pct(0.99);
+    result.p999 = pct(0.999);
+    result.p9999 = pct(0.9999);
+    result.max = samples[n - 1];
+    return result;
+}
+
+// times every op(i) separately and returns the latency percentiles, which is
+// where one-off pauses such as a full rehash show up
+template <class F>
+Percentiles sampleLatency(size_t ops, F&& op) {
+    std::vector<uint64_t> samples(ops);
+    for(size_t i = 0; i < ops; i++){
+        auto start = Clock::now();
+        op(i);
+        auto end = Clock::now();
+        samples[i] = (uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+    }
+    return percentiles(samples);
+}
+
+// same as sampleLatency, but prints the result
+template <class F>
+void latency(const char* name, size_t ops, F&& op) {
+    if(ops == 0){
+        return;
+    }
+    Percentiles p = sampleLatency(ops, op);
+    std::cout << "Running " << name << " ... p50 " << p.p50 << " ns, p99 " << p.p99
+              << " ns, p99.99 " << p.p9999 << " ns, max " << p.max << " ns\n";
+}
+
+// runs op(thread, i) for i in [0, opsPerThread) on every thread at once and
+// prints the combined throughput in million ops per second
+template <class F>
+double parallel(const std::string& name, size_t threads, size_t opsPerThread, F&& op) {
+    std::atomic<bool> go(false);
+    std::vector<std::thread> workers;
+    for(size_t t = 0; t < threads; t++){
+        workers.emplace_back([&, t]{
+            while(!go.load(std::memory_order_acquire)){
+                std::this_thread::yield();
+            }
+            for(size_t i = 0; i < opsPerThread; i++){
+                op(t, i);
+            }
+        });
+    }
+    auto start = Clock::now();
+    go.store(true, std::memory_order_release);
+    for(auto& worker : workers){
+        worker.join();
+    }
+    auto end = Clock::now();
+    double seconds = std::chrono::duration<double>(end - start).count();
+    double mops = (double) (threads * opsPerThread) / seconds / 1e6;
+    std::cout << "Running " << name << " [" << threads << " threads] ... " << mops << " Mops/s\n";
+    return mops;
+}
+
+std::vector<uint64_t> uniformKeys(size_t n, uint64_t seed = 42) {
+    std::mt19937_64 rng(seed);
+    std::vector<uint64_t> keys(n);
+    for(size_t i = 0; i < n; i++){
+        keys[i] = rng();
+    }
+    return keys;
+}
+
+// prefills a concurrent map with n keys, then each op reads with probability
+// readPercent and otherwise overwrites a random key
+template <class Map>
+void concurrentMap(const char* name, size_t threads, int readPercent, size_t n, size_t opsPerThread) {
+    auto keys = uniformKeys(n);
+    Map map;
+    for(auto k : keys){
+        map.insert(k, k);
+    }
+    std::string label = std::string(name) + " " + std::to_string(readPercent) + "% reads";
+    parallel(label, threads, opsPerThread, [&](size_t t, size_t i){
+        uint64_t r = (i + 1) * 0x9E3779B97F4A7C15ULL + t * 0xBF58476D1CE4E5B9ULL;
+        uint64_t key = keys[(r >> 16) % n];
+        uint64_t value;
+        if((int) (r % 100) < readPercent){
+            doNotOptimize(map.find(key, value));
+        }else{
+            map.insert(key, i);
+        }
+    });
+}
+
+// looks the keys up one find at a time and then through findBatch, on a
+// table that is far larger than the last level cache; Map needs
+// insertBatch, find returning a node with data, and findBatch
+template <class Map>
+void batchFind(const char* name, size_t n) {
+    auto keys = uniformKeys(n);
+    Map map;
+    map.insertBatch(keys.data(), keys.data(), n);
+    std::vector<uint64_t*> out(n);
+    std::string label(name);
+    run((label + " find loop").c_str(), n, [&]{
+        for(size_t i = 0; i < n; i++){
+            auto it = map.find(keys[i]);
+            out[i] = it ? &it->data : nullptr;
+        }
+    });
+    doNotOptimize(out.data());
+    run((label + " findBatch").c_str(), n, [&]{
+        map.findBatch(keys.data(), n, out.data());
+    });
+    doNotOptimize(out.data());
+}
+
+// YCSB-style Zipfian ranks in [0, n): rank 0 is the hottest item
+class Zipf {
+    size_t n;
+    double theta, alpha, zetan, eta;
+    std::mt19937_64 rng;
+    std::uniform_real_distribution<double> unit;
+    
+    static double zeta(size_t n, double theta) {
+        double sum = 0;
+        for(size_t i = 1; i <= n; i++){
+            sum += 1.0 / std::pow((double) i, theta);
+        }
+        return sum;
+    }
+    
+public:
+    Zipf(size_t items, double skew = 0.99, uint64_t seed = 42): n(items), theta(skew), rng(seed), unit(0.0, 1.0) {
+        zetan = zeta(n, theta);
+        double zeta2 = zeta(2, theta);
+        alpha = 1.0 / (1.0 - theta);
+        eta = (1.0 - std::pow(2.0 / (double) n, 1.0 - theta)) / (1.0 - zeta2 / zetan);
+    }
+    
+    size_t next() {
+        double u = unit(rng);
+        double uz = u * zetan;
+        if(uz < 1.0){
+            return 0;
+        }
+        if(uz < 1.0 + std::pow(0.5, theta)){
+            return 1;
+        }
+        size_t rank = (size_t) ((double) n * std::pow(eta * u - eta + 1.0, alpha));
+        return std::min(rank, n - 1);
+    }
+};
+
+// hardware counters for the calling thread through perf_event_open; every
+// read returns zeros where that is not available (macOS, containers)
+class PerfCounters {
+public:
+    static const int COUNT = 4;
+    
+    struct Values {
+        uint64_t cycles, instructions, cacheMisses, branchMisses;
+        bool valid;
+    };
+    
+private:
+    int fds[COUNT];
+    uint64_t startValues[COUNT];
+    
+#if defined(__linux__)
+    static int open(uint32_t type, uint64_t config) {
+        perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = type;
+        attr.config = config;
+        attr.disabled = 0;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        return (int) syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+#endif
+    
+    bool readAll(uint64_t* out) {
+        for(int i = 0; i < COUNT; i++){
+            out[i] = 0;
+            if(fds[i] < 0){
+                return false;
+            }
+#if defined(__linux__)
+            if(::read(fds[i], &out[i], sizeof(uint64_t)) != (ssize_t) sizeof(uint64_t)){
+                return false;
+            }
+#endif
+        }
+        return true;
+    }
+    
+public:
+    PerfCounters() {
+        for(int i = 0; i < COUNT; i++){
+            fds[i] = -1;
+            startValues[i] = 0;
+        }
+#if defined(__linux__)
+        fds[0] = open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+        fds[1] = open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+        fds[2] = open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+        fds[3] = open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+#endif
+    }
+    
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
+    
+    ~PerfCounters() {
+#if defined(__linux__)
+        for(int i = 0; i < COUNT; i++){
+            if(fds[i] >= 0){
+                close(fds[i]);
+            }
+        }
+#endif
+    }
+    
+    void start() {
+        readAll(startValues);
+    }
+    
+    Values stop() {
+        uint64_t now[COUNT];
+        bool valid = readAll(now);
+        Values v{0, 0, 0, 0, valid};
+        if(valid){
+            v.cycles = now[0] - startValues[0];
+            v.instructions = now[1] - startValues[1];
+            v.cacheMisses = now[2] - startValues[2];
+            v.branchMisses = now[3] - startValues[3];
+        }
+        return v;
+    }
+};
+
+// one measured configuration, printed as text, CSV or JSON lines
+struct Record {
+    std::string container, keyType, workload, mix;
+    size_t keys, ops;
+    double nsPerOp, bytesPerKey;
+    Percentiles latency;
+    PerfCounters::Values counters;
+};
+
+enum class Format {
+    TEXT,
+    CSV,
+    JSON
+};
+
+class Reporter {
+    Format format;
+    std::ostream& out;
+    bool headerDone;
+    
+    double perOp(uint64_t value, const Record& r) {
+        return r.ops ? (double) value / (double) r.ops : 0.0;
+    }
+    
+public:
+    Reporter(Format f, std::ostream& stream): format(f), out(stream), headerDone(false) {}
+    
+    void report(const Record& r) {
+        const PerfCounters::Values& c = r.counters;
+        switch(format){
+            case Format::TEXT:
+                out << "Running " << r.container << " <" << r.keyType << "> " << r.workload << " " << r.mix
+                    << " n=" << r.keys << " ... " << r.nsPerOp << " ns/op, p50 " << r.latency.p50
+                    << " ns, p99 " << r.latency.p99 << " ns, p99.9 " << r.latency.p999 << " ns, "
+                    << r.bytesPerKey << " bytes/key";
+                if(c.valid){
+                    out << ", " << perOp(c.cycles, r) << " cycles/op, " << perOp(c.cacheMisses, r) << " misses/op";
+                }
+                out << "\n";
+                break;
+            case Format::CSV:
+                if(!headerDone){
+                    out << "container,key_type,workload,mix,keys,ops,ns_per_op,p50_ns,p90_ns,p99_ns,p999_ns,max_ns,"
+                        << "bytes_per_key,cycles_per_op,instructions_per_op,cache_misses_per_op,branch_misses_per_op\n";
+                    headerDone = true;
+                }
+                out << r.container << "," << r.keyType << "," << r.workload << "," << r.mix << "," << r.keys << ","
+                    << r.ops << "," << r.nsPerOp << "," << r.latency.p50 << "," << r.latency.p90 << ","
+                    << r.latency.p99 << "," << r.latency.p999 << "," << r.latency.max << "," << r.bytesPerKey << ",";
+                if(c.valid){
+                    out << perOp(c.cycles, r) << "," << perOp(c.instructions, r) << ","
+                        << perOp(c.cacheMisses, r) << "," << perOp(c.branchMisses, r);
+                }else{
+                    out << ",,,";
+                }
+                out << "\n";
+                break;
+            case Format::JSON:
+                out << "{\"container\":\"" << r.container << "\",\"key_type\":\"" << r.keyType
+                    << "\",\"workload\":\"" << r.workload << "\",\"mix\":\"" << r.mix
+                    << "\",\"keys\":" << r.keys << ",\"ops\":" << r.ops << ",\"ns_per_op\":" << r.nsPerOp
+                    << ",\"p50_ns\":" << r.latency.p50 << ",\"p90_ns\":" << r.latency.p90
+                    << ",\"p99_ns\":" << r.latency.p99 << ",\"p999_ns\":" << r.latency.p999
+                    << ",\"max_ns\":" << r.latency.max << ",\"bytes_per_key\":" << r.bytesPerKey;
+                if(c.valid){
+                    out << ",\"cycles_per_op\":" << perOp(c.cycles, r) << ",\"instructions_per_op\":" << perOp(c.instructions, r)
+                        << ",\"cache_misses_per_op\":" << perOp(c.cacheMisses, r)
+                        << ",\"branch_misses_per_op\":" << perOp(c.branchMisses, r);
+                }
+                out << "}\n";
+                break;
+        }
+        out.flush();
+    }
+};
+
+void header(const std::string& title) {
+    std::cout << std::string(40, '-') << "\n";
+    std::cout << " -- " << title << " -- " << std::endl;
+    std::cout << std::string(40, '-') << "\n";
+}
+
+}
+
+#endif /* Benchmark_h */
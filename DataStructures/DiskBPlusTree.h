@@ -0,0 +1,613 @@
+//
+//  DiskBPlusTree.h
+//  AdvancedDSA
+//
+//
+
+#ifndef DiskBPlusTree_h
+#define DiskBPlusTree_h
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include "Pager.h"
+#include "NodeSearch.h"
+#include "Testing.h"
+#include "Benchmark.h"
+
+namespace diskbplustree {
+
+// The B+ tree with file-backed nodes: every node is one storage page, and
+// children and sibling links are page ids instead of pointers. Pages are
+// reached through a BufferPool, so only poolPages of them are ever in
+// memory; with mmap on, lookups and scans read uncached pages straight from
+// the mapping. The root and counters sit in page 0, so reopening the file
+// restores the tree without reading anything else.
+//
+// Page 0 is only up to date after flush() or close(). Before the first page
+// is written back after either, the header is marked unclean and synced,
+// so a file left behind by a crash is refused on open rather than read
+// with a header that no longer matches its pages.
+//
+// Keys and values are copied into pages as raw bytes and have to be
+// trivially copyable. Not thread-safe.
+template <class K, class T>
+class DiskBPlusTree {
+    static_assert(std::is_trivially_copyable<K>::value && std::is_trivially_copyable<T>::value,
+                  "DiskBPlusTree stores keys and values as raw bytes");
+
+    using PageId = storage::PageId;
+
+    static constexpr uint32_t MAGIC = 0x42505431;   // "BPT1"
+    static constexpr uint32_t VERSION = 2;
+
+    struct FileHeader {
+        uint32_t magic, version, pageSize, keySize, valSize, clean;
+        uint64_t root, height, members, pageCount;
+    };
+
+    struct PageHeader {
+        uint32_t count;
+        uint32_t leaf;
+        uint64_t next;
+    };
+
+    static constexpr size_t alignUp(size_t offset, size_t align) {
+        return (offset + align - 1) / align * align;
+    }
+
+    // leaf page: header, keys[LEAF_SIZE], vals[LEAF_SIZE]
+    static constexpr size_t KEYS_OFFSET = alignUp(sizeof(PageHeader), alignof(K));
+    static constexpr size_t LEAF_SIZE = (storage::PAGE_SIZE - KEYS_OFFSET - alignof(T)) / (sizeof(K) + sizeof(T));
+    static constexpr size_t VALS_OFFSET = alignUp(KEYS_OFFSET + LEAF_SIZE * sizeof(K), alignof(T));
+
+    // inner page: header, keys[MAX_KEYS], children[MAX_KEYS + 1]
+    static constexpr size_t MAX_KEYS = (storage::PAGE_SIZE - KEYS_OFFSET - sizeof(PageId) - alignof(PageId)) / (sizeof(K) + sizeof(PageId));
+    static constexpr size_t CHILDREN_OFFSET = alignUp(KEYS_OFFSET + MAX_KEYS * sizeof(K), alignof(PageId));
+
+    static_assert(LEAF_SIZE >= 4 && MAX_KEYS >= 3, "keys and values are too large for a page");
+
+    storage::Pager pager;
+    std::unique_ptr<storage::BufferPool> pool;
+    PageId root;
+    size_t height;
+    size_t currentMembers;
+
+    static PageHeader* header(char* page){
+        return reinterpret_cast<PageHeader*>(page);
+    }
+
+    static K* keys(char* page){
+        return reinterpret_cast<K*>(page + KEYS_OFFSET);
+    }
+
+    static T* vals(char* page){
+        return reinterpret_cast<T*>(page + VALS_OFFSET);
+    }
+
+    static PageId* children(char* page){
+        return reinterpret_cast<PageId*>(page + CHILDREN_OFFSET);
+    }
+
+    static bool isFull(char* page){
+        return header(page)->count == (header(page)->leaf ? LEAF_SIZE : MAX_KEYS);
+    }
+
+    static size_t childIndex(char* page, const K& key){
+        return nodesearch::upperBound(keys(page), header(page)->count, key);
+    }
+
+    static size_t leafIndex(char* page, const K& key){
+        return nodesearch::lowerBound(keys(page), header(page)->count, key);
+    }
+
+    storage::PageRef newPage(PageId& id, bool leaf){
+        storage::PageRef page = pool->allocate(id);
+        header(page.data())->leaf = leaf ? 1 : 0;
+        return page;
+    }
+
+    // same split as BPlusTree::splitChild, on pinned pages
+    void splitChild(storage::PageRef& parent, size_t i, storage::PageRef& child){
+        char* p = parent.data();
+        char* c = child.data();
+        PageId rightId;
+        storage::PageRef right = newPage(rightId, header(c)->leaf);
+        char* r = right.data();
+        K separator;
+        if(header(c)->leaf){
+            size_t mid = LEAF_SIZE / 2;
+            std::copy(keys(c) + mid, keys(c) + LEAF_SIZE, keys(r));
+            std::copy(vals(c) + mid, vals(c) + LEAF_SIZE, vals(r));
+            header(r)->count = (uint32_t) (LEAF_SIZE - mid);
+            header(c)->count = (uint32_t) mid;
+            header(r)->next = header(c)->next;
+            header(c)->next = rightId;
+            separator = keys(r)[0];
+        }else{
+            size_t mid = MAX_KEYS / 2;
+            std::copy(keys(c) + mid + 1, keys(c) + MAX_KEYS, keys(r));
+            std::copy(children(c) + mid + 1, children(c) + MAX_KEYS + 1, children(r));
+            header(r)->count = (uint32_t) (MAX_KEYS - mid - 1);
+            header(c)->count = (uint32_t) mid;
+            separator = keys(c)[mid];
+        }
+        size_t count = header(p)->count;
+        std::copy_backward(keys(p) + i, keys(p) + count, keys(p) + count + 1);
+        std::copy_backward(children(p) + i + 1, children(p) + count + 1, children(p) + count + 2);
+        keys(p)[i] = separator;
+        children(p)[i + 1] = rightId;
+        header(p)->count += 1;
+        parent.markDirty();
+        child.markDirty();
+        right.markDirty();
+    }
+
+    // page 0 bypasses the pool, so the header reaches the file exactly when
+    // it is written here
+    void writeHeader(bool clean){
+        std::unique_ptr<char[]> page(new char[storage::PAGE_SIZE]());
+        FileHeader h{MAGIC, VERSION, (uint32_t) storage::PAGE_SIZE, (uint32_t) sizeof(K), (uint32_t) sizeof(T),
+                     clean ? 1u : 0u, root, height, currentMembers, pager.getPageCount()};
+        std::memcpy(page.get(), &h, sizeof(h));
+        pager.write(0, page.get());
+    }
+
+    bool readHeader(){
+        std::unique_ptr<char[]> page(new char[storage::PAGE_SIZE]);
+        pager.read(0, page.get());
+        FileHeader h;
+        std::memcpy(&h, page.get(), sizeof(h));
+        if(h.magic != MAGIC || h.version != VERSION || h.pageSize != storage::PAGE_SIZE ||
+           h.keySize != sizeof(K) || h.valSize != sizeof(T) || h.clean != 1){
+            return false;
+        }
+        // the allocator resumes at pageCount, so it must not reach past the file
+        if(h.root == storage::NO_PAGE || h.root >= h.pageCount || h.height == 0 ||
+           h.pageCount > pager.getFileSize() / storage::PAGE_SIZE){
+            return false;
+        }
+        root = h.root;
+        height = h.height;
+        currentMembers = h.members;
+        pager.setPageCount(h.pageCount);
+        return true;
+    }
+
+public:
+    DiskBPlusTree(): root(storage::NO_PAGE), height(0), currentMembers(0) {}
+
+    DiskBPlusTree(const DiskBPlusTree&) = delete;
+    DiskBPlusTree& operator=(const DiskBPlusTree&) = delete;
+
+    ~DiskBPlusTree(){
+        close();
+    }
+
+    // Opens the tree stored at path, or creates an empty one if the file is
+    // missing or empty. poolPages bounds the pages cached in memory. Returns
+    // false, leaving the file untouched, if it cannot be opened, is not a
+    // whole number of pages, holds a tree with another layout, or was not
+    // closed cleanly.
+    bool open(const std::string& path, size_t poolPages = 1024, bool useMmap = true){
+        close();
+        if(!pager.open(path, useMmap)){
+            return false;
+        }
+        try{
+            size_t size = pager.getFileSize();
+            bool existing = size > 0;
+            if(existing && (size % storage::PAGE_SIZE != 0 || !readHeader())){
+                pager.close();
+                return false;
+            }
+            pool = std::make_unique<storage::BufferPool>(pager, poolPages);
+            pool->beforeWriteBack([this]{
+                writeHeader(false);
+                pager.sync();
+            });
+            if(!existing){
+                pager.allocate();
+                storage::PageRef leaf = newPage(root, true);
+                leaf.markDirty();
+                leaf.release();
+                height = 1;
+                currentMembers = 0;
+                flush();
+            }
+            return true;
+        }catch(...){
+            pool = nullptr;
+            pager.close();
+            return false;
+        }
+    }
+
+    bool isOpen(){
+        return pool != nullptr;
+    }
+
+    // writes every dirty page and syncs them, then marks the header clean
+    void flush(){
+        if(!pool){
+            return;
+        }
+        pool->flush();
+        pager.sync();
+        writeHeader(true);
+        pager.sync();
+        pool->checkpoint();
+    }
+
+    void close(){
+        if(!pool){
+            return;
+        }
+        flush();
+        pool = nullptr;
+        pager.close();
+    }
+
+    size_t getCurrentMembers(){
+        return currentMembers;
+    }
+
+    size_t getHeight(){
+        return height;
+    }
+
+    size_t getPageCount(){
+        return pager.getPageCount();
+    }
+
+    storage::BufferPool::Stats getPoolStats(){
+        return pool->getStats();
+    }
+
+    // returns false if the key was already there and only its value changed
+    bool insert(K key, T val){
+        storage::PageRef node = pool->pin(root);
+        if(isFull(node.data())){
+            PageId newRootId;
+            storage::PageRef newRoot = newPage(newRootId, false);
+            children(newRoot.data())[0] = root;
+            splitChild(newRoot, 0, node);
+            root = newRootId;
+            height += 1;
+            node = std::move(newRoot);
+        }
+        while(!header(node.data())->leaf){
+            size_t i = childIndex(node.data(), key);
+            storage::PageRef child = pool->pin(children(node.data())[i]);
+            if(isFull(child.data())){
+                splitChild(node, i, child);
+                if(!(key < keys(node.data())[i])){
+                    child = pool->pin(children(node.data())[i + 1]);
+                }
+            }
+            node = std::move(child);
+        }
+        char* leaf = node.data();
+        size_t i = leafIndex(leaf, key);
+        size_t count = header(leaf)->count;
+        node.markDirty();
+        if(i < count && !(key < keys(leaf)[i])){
+            vals(leaf)[i] = val;
+            return false;
+        }
+        std::copy_backward(keys(leaf) + i, keys(leaf) + count, keys(leaf) + count + 1);
+        std::copy_backward(vals(leaf) + i, vals(leaf) + count, vals(leaf) + count + 1);
+        keys(leaf)[i] = key;
+        vals(leaf)[i] = val;
+        header(leaf)->count += 1;
+        currentMembers += 1;
+        return true;
+    }
+
+    // copies the value out, since the page may be evicted afterwards
+    bool find(K key, T& out){
+        storage::PageRef node = pool->read(root);
+        while(!header(node.data())->leaf){
+            node = pool->read(children(node.data())[childIndex(node.data(), key)]);
+        }
+        size_t i = leafIndex(node.data(), key);
+        if(i < header(node.data())->count && !(key < keys(node.data())[i])){
+            out = vals(node.data())[i];
+            return true;
+        }
+        return false;
+    }
+
+    bool contains(K key){
+        T ignored;
+        return find(key, ignored);
+    }
+
+    // Removes the key from its leaf without merging underfull leaves, as
+    // many disk B-trees do: lookups and scans stay correct, and a leaf left
+    // empty costs one extra page read during scans until the file is rebuilt.
+    bool deleteNode(K key){
+        storage::PageRef node = pool->read(root);
+        PageId id = root;
+        while(!header(node.data())->leaf){
+            id = children(node.data())[childIndex(node.data(), key)];
+            node = pool->read(id);
+        }
+        node = pool->pin(id);
+        char* leaf = node.data();
+        size_t i = leafIndex(leaf, key);
+        size_t count = header(leaf)->count;
+        if(i >= count || key < keys(leaf)[i]){
+            return false;
+        }
+        std::copy(keys(leaf) + i + 1, keys(leaf) + count, keys(leaf) + i);
+        std::copy(vals(leaf) + i + 1, vals(leaf) + count, vals(leaf) + i);
+        header(leaf)->count -= 1;
+        node.markDirty();
+        currentMembers -= 1;
+        return true;
+    }
+
+    // calls visit(key, value) for every key in [lo, hi) in order, following
+    // the leaf links, and returns how many it visited
+    template <class F>
+    size_t scan(const K& lo, const K& hi, F&& visit){
+        if(!(lo < hi)){
+            return 0;
+        }
+        storage::PageRef node = pool->read(root);
+        while(!header(node.data())->leaf){
+            node = pool->read(children(node.data())[childIndex(node.data(), lo)]);
+        }
+        size_t i = leafIndex(node.data(), lo);
+        size_t visited = 0;
+        while(true){
+            char* leaf = node.data();
+            size_t count = header(leaf)->count;
+            for(; i < count; i++){
+                if(!(keys(leaf)[i] < hi)){
+                    return visited;
+                }
+                visit(keys(leaf)[i], vals(leaf)[i]);
+                visited += 1;
+            }
+            PageId next = header(leaf)->next;
+            if(next == storage::NO_PAGE){
+                return visited;
+            }
+            node = pool->read(next);
+            i = 0;
+        }
+    }
+};
+
+std::string testPath(const char* name) {
+    return (std::filesystem::temp_directory_path() / name).string();
+}
+
+bool testDiskInsertAndFind() {
+    std::string path = testPath("advanceddsa_disk_insert.db");
+    std::remove(path.c_str());
+    DiskBPlusTree<int, int> tree;
+    if(!tree.open(path)) return false;
+    for(int i = 0; i < 10000; i++) {
+        tree.insert((i * 7919) % 10000, i);
+    }
+    if(tree.insert(5, -5) || tree.getCurrentMembers() != 10000 || tree.getHeight() < 2) return false;
+    int value = 0;
+    for(int i = 0; i < 10000; i++) {
+        int key = (i * 7919) % 10000;
+        if(!tree.find(key, value) || value != (key == 5 ? -5 : i)) return false;
+    }
+    bool missing = !tree.contains(10000) && !tree.contains(-1);
+    tree.close();
+    std::remove(path.c_str());
+    return missing;
+}
+
+bool testDiskSmallPool() {
+    // an 8-page pool forces evictions and write-backs on nearly every insert
+    std::string path = testPath("advanceddsa_disk_pool.db");
+    std::remove(path.c_str());
+    DiskBPlusTree<uint64_t, uint64_t> tree;
+    if(!tree.open(path, 8, false)) return false;
+    std::map<uint64_t, uint64_t> reference;
+    std::mt19937_64 rng(4);
+    for(int i = 0; i < 50000; i++) {
+        uint64_t key = rng() % 100000;
+        tree.insert(key, i);
+        reference[key] = i;
+    }
+    for(int i = 0; i < 20000; i++) {
+        uint64_t key = rng() % 100000;
+        if(tree.deleteNode(key) != (reference.erase(key) == 1)) return false;
+    }
+    if(tree.getPoolStats().evictions == 0 || tree.getCurrentMembers() != reference.size()) return false;
+    // scans walk the leaf links in key order, empty leaves included
+    std::vector<std::pair<uint64_t, uint64_t>> got;
+    tree.scan(20000, 60000, [&](const uint64_t& key, const uint64_t& val){ got.emplace_back(key, val); });
+    std::vector<std::pair<uint64_t, uint64_t>> want(reference.lower_bound(20000), reference.lower_bound(60000));
+    tree.close();
+    std::remove(path.c_str());
+    return got == want;
+}
+
+bool testDiskReopen() {
+    std::string path = testPath("advanceddsa_disk_reopen.db");
+    std::remove(path.c_str());
+    size_t pages = 0;
+    {
+        DiskBPlusTree<uint64_t, double> tree;
+        if(!tree.open(path, 16)) return false;
+        for(uint64_t i = 0; i < 30000; i++) {
+            tree.insert(i * 3, (double) i / 2);
+        }
+        pages = tree.getPageCount();
+    }
+    // mmap and buffer-pool reads see the same persisted tree
+    for(bool useMmap : {true, false}) {
+        DiskBPlusTree<uint64_t, double> tree;
+        if(!tree.open(path, 16, useMmap)) return false;
+        if(tree.getCurrentMembers() != 30000 || tree.getPageCount() != pages) return false;
+        double value = 0;
+        for(uint64_t i = 0; i < 30000; i += 7) {
+            if(!tree.find(i * 3, value) || value != (double) i / 2) return false;
+        }
+        if(tree.scan(0, 90000, [](const uint64_t&, const double&){}) != 30000) return false;
+    }
+    // a file holding another key/value layout is refused
+    DiskBPlusTree<uint32_t, uint32_t> other;
+    bool refused = !other.open(path);
+    std::remove(path.c_str());
+    return refused;
+}
+
+bool testDiskRefusesDamagedFiles() {
+    std::string path = testPath("advanceddsa_disk_damaged.db");
+    // non-empty files shorter than a page or with a partial page are left alone
+    for(size_t size : {(size_t) 100, storage::PAGE_SIZE + 10}) {
+        std::remove(path.c_str());
+        {
+            std::ofstream out(path, std::ios::binary);
+            out << std::string(size, 'x');
+        }
+        DiskBPlusTree<int, int> tree;
+        if(tree.open(path) || std::filesystem::file_size(path) != size) return false;
+    }
+    std::remove(path.c_str());
+    {
+        DiskBPlusTree<int, int> tree;
+        if(!tree.open(path)) return false;
+        for(int i = 0; i < 20000; i++) {
+            tree.insert(i, i);
+        }
+    }
+    // a header counting more pages than the file holds
+    std::filesystem::resize_file(path, 2 * storage::PAGE_SIZE);
+    DiskBPlusTree<int, int> truncated;
+    bool refused = !truncated.open(path);
+    std::remove(path.c_str());
+    return refused;
+}
+
+bool testDiskUncleanFile() {
+    // copies of the file taken while the tree is open stand in for crashes
+    std::string path = testPath("advanceddsa_disk_unclean.db");
+    std::string copy = testPath("advanceddsa_disk_unclean_copy.db");
+    std::remove(path.c_str());
+    // returns how many keys the copy holds, or -1 if it is refused
+    auto openCopy = [&]() -> long {
+        std::filesystem::copy_file(path, copy, std::filesystem::copy_options::overwrite_existing);
+        DiskBPlusTree<uint64_t, uint64_t> other;
+        if(!other.open(copy, 8)) return -1;
+        size_t scanned = other.scan(0, UINT64_MAX, [](const uint64_t&, const uint64_t&){});
+        return scanned == other.getCurrentMembers() ? (long) scanned : -2;
+    };
+    DiskBPlusTree<uint64_t, uint64_t> tree;
+    if(!tree.open(path, 8)) return false;
+    bool ok = openCopy() == 0;
+    for(uint64_t i = 0; i < 20000; i++) {
+        tree.insert(i, i);
+    }
+    // evictions have written pages back, so the header is marked unclean
+    ok = ok && tree.getPoolStats().writeBacks > 0 && openCopy() == -1;
+    tree.flush();
+    ok = ok && openCopy() == 20000;
+    for(uint64_t i = 20000; i < 40000; i++) {
+        tree.insert(i, i);
+    }
+    ok = ok && openCopy() == -1;
+    tree.close();
+    ok = ok && openCopy() == 40000;
+    std::remove(path.c_str());
+    std::remove(copy.c_str());
+    return ok;
+}
+
+void runTests() {
+    int count = 0;
+    int total = 5;
+
+    tests::test(count, "Testing Disk Insert and Find", testDiskInsertAndFind);
+    tests::test(count, "Testing Disk Small Pool", testDiskSmallPool);
+    tests::test(count, "Testing Disk Reopen", testDiskReopen);
+    tests::test(count, "Testing Disk Refuses Damaged Files", testDiskRefusesDamagedFiles);
+    tests::test(count, "Testing Disk Unclean File", testDiskUncleanFile);
+
+    std::cout << std::string(40, '-') << "\n";
+    std::cout << " -- DiskBPlusTree: Passed [" << count << "/" << total << "] tests -- " << std::endl;
+
+    std::cout << std::string(40, '-') << "\n\n";
+}
+
+// Builds a tree of n keys once, then reopens it with buffer pools from the
+// whole file down to a sliver of it to stand in for a working set that
+// outgrows memory. The OS page cache still holds the file, so a pool miss
+// costs a pread and a copy here rather than a disk seek.
+void runBenchmarks(size_t n = 2000000) {
+    bench::header("DiskBPlusTree benchmarks");
+    std::string path = testPath("advanceddsa_disk_bench.db");
+    std::remove(path.c_str());
+    auto keys = bench::uniformKeys(n);
+    size_t pages;
+    {
+        DiskBPlusTree<uint64_t, uint64_t> tree;
+        tree.open(path, 1 << 16);
+        bench::run("DiskBPlusTree insert", n, [&]{
+            for(auto k : keys) tree.insert(k, k);
+        });
+        pages = tree.getPageCount();
+    }
+    std::cout << "  file: " << pages << " pages\n";
+    {
+        DiskBPlusTree<uint64_t, uint64_t> tree;
+        bench::run("DiskBPlusTree reopen", 1, [&]{
+            tree.open(path, 64);
+        });
+    }
+
+    std::vector<uint64_t> sorted(keys);
+    std::sort(sorted.begin(), sorted.end());
+    const size_t lookups = std::min(n, (size_t) 1000000);
+    const size_t scans = 1000, scanLength = 1000;
+    for(bool useMmap : {false, true}){
+        for(size_t divisor : {1, 4, 16, 64, 256}){
+            size_t poolPages = std::max(pages / divisor, (size_t) 8);
+            DiskBPlusTree<uint64_t, uint64_t> tree;
+            tree.open(path, poolPages, useMmap);
+            std::string label = std::string(useMmap ? "mmap + " : "") + "pool 1/" + std::to_string(divisor);
+            uint64_t value = 0, sum = 0;
+            bench::run(("DiskBPlusTree find, " + label).c_str(), lookups, [&]{
+                for(size_t i = 0; i < lookups; i++){
+                    tree.find(keys[(i * 7919) % n], value);
+                    sum += value;
+                }
+            });
+            bench::run(("DiskBPlusTree scan 1000, " + label).c_str(), scans * scanLength, [&]{
+                for(size_t s = 0; s < scans; s++){
+                    size_t start = (s * 7919) % (n - scanLength);
+                    tree.scan(sorted[start], sorted[start + scanLength], [&](const uint64_t&, const uint64_t& v){ sum += v; });
+                }
+            });
+            auto stats = tree.getPoolStats();
+            std::cout << "  pool hits " << stats.hits << ", misses " << stats.misses << ", mapped " << stats.mappedReads << "\n";
+            bench::doNotOptimize(sum);
+        }
+    }
+    std::remove(path.c_str());
+    std::cout << std::string(40, '-') << "\n\n";
+}
+
+}
+
+#endif /* DiskBPlusTree_h */
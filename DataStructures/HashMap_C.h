@@ -9,33 +9,95 @@
 #define HashMap_C_h
 
 #include "LinkedList.h"
+#include "Hashing.h"
 #include "Testing.h"
-#include <functional>
+#include "Benchmark.h"
+#include <algorithm>
+#include <atomic>
 #include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <vector>
 
 namespace chaining {
 
-template <class K, class T>
+template <class K, class T, class Hash = hashing::DefaultHash<K>, class Index = hashing::PowerOfTwo>
 class HashMap{
     static const size_t ARRAY_SIZE = 100;
+    // buckets moved from the old table on every operation while resizing
+    static const size_t MIGRATE_STEP = 4;
     size_t currentSize;
     size_t currentMembers;
     float allowedLoadFactor;
+    // declared before the bucket arrays so it is destroyed after every node
+    std::unique_ptr<linkedlist::NodePool<K, T>> pool;
     std::unique_ptr<linkedlist::LinkedList<K, T>[]> map;
     
-    using HashFuncType = std::function<size_t(const K&)>;
-    HashFuncType hashFunction;
+    // incremental mode keeps the old table alive after a resize; buckets
+    // below migrateIndex (and any moved early by migrateKey) are empty
+    bool incremental;
+    size_t oldSize;
+    size_t migrateIndex;
+    std::unique_ptr<linkedlist::LinkedList<K, T>[]> oldMap;
+    
+    Hash hashFunction;
+    Index indexer;
+    Index oldIndexer;
+    
+#if defined(HASHMAP_STATS)
+    hashing::Stats stats;
+#endif
     
-    static size_t defaultHash(const K key){
-        return std::hash<K>()(key);
+    size_t getIndex(const K& key){
+        return indexer.index(hashFunction(key));
     }
     
-    size_t getIndex(const K key){
-        return defaultHash(key) % currentSize;
+    size_t getOldIndex(const K& key){
+        return oldIndexer.index(hashFunction(key));
+    }
+    
+    // relinks the existing nodes, nothing is allocated or copied
+    void moveBucket(linkedlist::LinkedList<K, T>& from, linkedlist::LinkedList<K, T>* to){
+        while(auto node = from.popFront()){
+            size_t index = getIndex(node->key);
+            to[index].pushFront(std::move(node));
+        }
+    }
+    
+    void migrateBucket(size_t i){
+        moveBucket(oldMap[i], map.get());
+    }
+    
+    // moves a bounded number of old buckets, dropping the old table once done
+    void migrateStep(){
+#if defined(HASHMAP_STATS)
+        hashing::ScopedTimer timer(stats.rehashNanos);
+#endif
+        for(size_t n = 0; n < MIGRATE_STEP && migrateIndex < oldSize; n++){
+            migrateBucket(migrateIndex);
+            migrateIndex += 1;
+        }
+        if(migrateIndex == oldSize){
+            oldMap = nullptr;
+        }
+    }
+    
+    // writers move the key's old bucket first, so a key only ever lives in one table
+    void migrateKey(const K key){
+        migrateStep();
+        if(isMigrating()){
+            migrateBucket(getOldIndex(key));
+        }
     }
     
 public:
-    HashMap():currentSize(ARRAY_SIZE), allowedLoadFactor(0.75f), map(std::make_unique<linkedlist::LinkedList<K, T>[]>(ARRAY_SIZE)), hashFunction(defaultHash) {}
+    HashMap(bool incrementalReHash = false, Hash customHash = Hash()):currentSize(Index(ARRAY_SIZE).capacity()), currentMembers(0), allowedLoadFactor(0.75f), pool(std::make_unique<linkedlist::NodePool<K, T>>()), map(std::make_unique<linkedlist::LinkedList<K, T>[]>(currentSize)),
+    incremental(incrementalReHash), oldSize(0), migrateIndex(0), hashFunction(customHash), indexer(ARRAY_SIZE), oldIndexer(ARRAY_SIZE) {}
+    
+    bool isMigrating(){
+        return oldMap != nullptr;
+    }
     
     size_t getCurrentSize(){
         return currentSize;
@@ -57,8 +119,11 @@ public:
     }
     
     bool insert(K key, T val){
+        if(isMigrating()){
+            migrateKey(key);
+        }
         size_t index = getIndex(key);
-        if(map[index].insert(key, val)){
+        if(map[index].insert(key, val, pool.get())){
             currentMembers += 1;
             if(shouldReHash()){
                 reHash();
@@ -74,6 +139,9 @@ public:
     }
     
     bool deleteNode(K key){
+        if(isMigrating()){
+            migrateKey(key);
+        }
         size_t index = getIndex(key);
         if(map[index].deleteNodeKey(key)){
             currentMembers -= 1;
@@ -82,14 +150,79 @@ public:
         return false;
     }
     
+    // while resizing, the returned node may move on the next operation
     linkedlist::Node<K, T>* find(K key){
+        size_t probes = 0;
+        if(isMigrating()){
+            migrateStep();
+        }
+        if(isMigrating()){
+            size_t oldIndex = getOldIndex(key);
+            if(oldIndex >= migrateIndex){
+                auto it = oldMap[oldIndex].find(key, probes);
+                if(it){
+                    HASHMAP_STAT(stats.recordFind(true, probes));
+                    return it;
+                }
+            }
+        }
         size_t index = getIndex(key);
-        return map[index].find(key);
+        auto it = map[index].find(key, probes);
+        HASHMAP_STAT(stats.recordFind(it != nullptr, probes));
+        return it;
+    }
+    
+    // resolves n keys a group at a time in two prefetch stages: first the
+    // bucket heads, then the first node of every bucket, before walking any
+    // chain. out[i] points at the value for keys[i], or is nullptr.
+    void findBatch(const K* keys, size_t n, T** out){
+        if(isMigrating()){
+            // keys may still be in the old table, take the plain path
+            for(size_t i = 0; i < n; i++){
+                auto it = find(keys[i]);
+                out[i] = it ? &it->data : nullptr;
+            }
+            return;
+        }
+        size_t index[hashing::BATCH_SIZE];
+        for(size_t base = 0; base < n; base += hashing::BATCH_SIZE){
+            size_t count = std::min(hashing::BATCH_SIZE, n - base);
+            for(size_t i = 0; i < count; i++){
+                index[i] = getIndex(keys[base + i]);
+                hashing::prefetch(&map[index[i]]);
+            }
+            for(size_t i = 0; i < count; i++){
+                auto head = map[index[i]].getHead();
+                if(head){
+                    hashing::prefetch(head);
+                }
+            }
+            for(size_t i = 0; i < count; i++){
+                size_t probes = 0;
+                auto it = map[index[i]].find(keys[base + i], probes);
+                HASHMAP_STAT(stats.recordFind(it != nullptr, probes));
+                out[base + i] = it ? &it->data : nullptr;
+            }
+        }
+    }
+    
+    // inserts keys[i] -> vals[i], prefetching each group's buckets first
+    void insertBatch(const K* keys, const T* vals, size_t n){
+        for(size_t base = 0; base < n; base += hashing::BATCH_SIZE){
+            size_t count = std::min(hashing::BATCH_SIZE, n - base);
+            for(size_t i = 0; i < count; i++){
+                hashing::prefetch(&map[getIndex(keys[base + i])]);
+            }
+            for(size_t i = 0; i < count; i++){
+                insert(keys[base + i], vals[base + i]);
+            }
+        }
     }
     
     bool reset(){
         try{
             map = std::make_unique<linkedlist::LinkedList<K, T>[]>(currentSize);
+            oldMap = nullptr;
             currentMembers = 0;
             return true;
         }catch(...){
@@ -98,28 +231,201 @@ public:
     };
     
     void reHash(){
+        HASHMAP_STAT(stats.rehashes += 1);
+        if(incremental){
+            startReHash();
+            return;
+        }
+#if defined(HASHMAP_STATS)
+        hashing::ScopedTimer timer(stats.rehashNanos);
+#endif
         // load factor is greater than 0.75
         // create a new map with twice the capacity
-        std::unique_ptr<linkedlist::LinkedList<K, T>[]> newMap;
-        newMap = std::make_unique<linkedlist::LinkedList<K, T>[]>(2 * currentSize);
+        size_t oldCapacity = currentSize;
         
         // this effectively changes the hash function
-        currentSize *= 2;
+        indexer = indexer.grown();
+        currentSize = indexer.capacity();
         
-        for(int i = 0; i < currentSize/2; i++){
-            // traverse each list, and hash the key to the new value
-            // it is a linkedList it has a smart pointer
-            auto ptr = map[i].getHead();
-            while(ptr){
-                newMap[getIndex(ptr->key)].insert(ptr->key, ptr->data);
-                ptr = ptr->next.get();
-            }
+        std::unique_ptr<linkedlist::LinkedList<K, T>[]> newMap;
+        newMap = std::make_unique<linkedlist::LinkedList<K, T>[]>(currentSize);
+        
+        for(size_t i = 0; i < oldCapacity; i++){
+            // traverse each list and relink its nodes under the new hash
+            moveBucket(map[i], newMap.get());
         }
         map = std::move(newMap);
         newMap = nullptr;
         
     }
     
+    // swaps in a table twice as large and leaves the old one to be drained
+    // by later operations instead of moving every node now
+    void startReHash(){
+        // migrateStep times itself
+        while(isMigrating()){
+            migrateStep();
+        }
+#if defined(HASHMAP_STATS)
+        hashing::ScopedTimer timer(stats.rehashNanos);
+#endif
+        oldMap = std::move(map);
+        oldSize = currentSize;
+        oldIndexer = indexer;
+        migrateIndex = 0;
+        indexer = indexer.grown();
+        currentSize = indexer.capacity();
+        map = std::make_unique<linkedlist::LinkedList<K, T>[]>(currentSize);
+    }
+    
+#if defined(HASHMAP_STATS)
+    // the counters so far plus a chain length histogram taken now; while
+    // resizing, the undrained old buckets are counted as well
+    hashing::Stats getStats(){
+        hashing::Stats result = stats;
+        auto addChains = [&](linkedlist::LinkedList<K, T>* table, size_t from, size_t to){
+            for(size_t i = from; i < to; i++){
+                size_t length = 0;
+                for(auto node = table[i].getHead(); node; node = node->next.get()){
+                    length += 1;
+                }
+                result.addToHistogram(length);
+            }
+        };
+        addChains(map.get(), 0, currentSize);
+        if(isMigrating()){
+            addChains(oldMap.get(), migrateIndex, oldSize);
+        }
+        return result;
+    }
+    
+    void resetStats(){
+        stats = hashing::Stats();
+    }
+#endif
+    
+};
+
+
+// Thread-safe variant built on the same bucket-of-LinkedList layout. Bucket
+// i is guarded by stripe i % STRIPES. Table sizes are powers of two no
+// smaller than STRIPES, so a key keeps its stripe across resizes and the
+// stripe can be picked from the hash before the table size is known.
+template <class K, class T>
+class ConcurrentHashMap{
+    static const size_t STRIPES = 64;
+    static const size_t ARRAY_SIZE = 128;
+    
+    // one cache line per lock so neighbouring stripes don't false-share
+    struct alignas(64) Stripe {
+        std::shared_mutex lock;
+        // nodes of a stripe's buckets only ever move between buckets of the
+        // same stripe, so each pool is only touched under its own lock
+        linkedlist::NodePool<K, T> pool;
+    };
+    
+    size_t currentSize;
+    std::atomic<size_t> currentMembers;
+    float allowedLoadFactor;
+    // declared before the buckets so the pools are destroyed after every node
+    std::unique_ptr<Stripe[]> stripes;
+    std::unique_ptr<linkedlist::LinkedList<K, T>[]> map;
+    
+    hashing::DefaultHash<K> hashFunction;
+    
+    // sizes are powers of two, so the stripe is the low bits of the index
+    Stripe& getStripe(const K& key){
+        return stripes[hashFunction(key) & (STRIPES - 1)];
+    }
+    
+    // only valid while holding a stripe lock
+    size_t getIndex(const K& key){
+        return hashFunction(key) & (currentSize - 1);
+    }
+    
+public:
+    ConcurrentHashMap(): currentSize(ARRAY_SIZE), currentMembers(0), allowedLoadFactor(0.75f),
+    stripes(std::make_unique<Stripe[]>(STRIPES)),
+    map(std::make_unique<linkedlist::LinkedList<K, T>[]>(ARRAY_SIZE)) {}
+    
+    size_t getCurrentSize(){
+        std::shared_lock<std::shared_mutex> guard(stripes[0].lock);
+        return currentSize;
+    }
+    
+    size_t getCurrentMembers(){
+        return currentMembers.load();
+    }
+    
+    bool insert(K key, T val){
+        Stripe& stripe = getStripe(key);
+        bool inserted;
+        size_t size;
+        {
+            std::unique_lock<std::shared_mutex> guard(stripe.lock);
+            inserted = map[getIndex(key)].insert(key, val, &stripe.pool);
+            size = currentSize;
+        }
+        if(inserted){
+            size_t members = currentMembers.fetch_add(1) + 1;
+            if((float) members / (float) size > allowedLoadFactor){
+                reHash();
+            }
+        }
+        return inserted;
+    }
+    
+    // copies the value out, a node pointer would not be safe to hand out
+    bool find(K key, T& out){
+        Stripe& stripe = getStripe(key);
+        std::shared_lock<std::shared_mutex> guard(stripe.lock);
+        auto it = map[getIndex(key)].find(key);
+        if(it){
+            out = it->data;
+            return true;
+        }
+        return false;
+    }
+    
+    bool contains(K key){
+        Stripe& stripe = getStripe(key);
+        std::shared_lock<std::shared_mutex> guard(stripe.lock);
+        return map[getIndex(key)].find(key) != nullptr;
+    }
+    
+    bool deleteNode(K key){
+        Stripe& stripe = getStripe(key);
+        std::unique_lock<std::shared_mutex> guard(stripe.lock);
+        if(map[getIndex(key)].deleteNodeKey(key)){
+            currentMembers.fetch_sub(1);
+            return true;
+        }
+        return false;
+    }
+    
+    // takes every stripe in index order, so two resizing threads can't deadlock;
+    // the load factor is checked again since another thread may have resized first
+    void reHash(){
+        std::vector<std::unique_lock<std::shared_mutex>> guards;
+        guards.reserve(STRIPES);
+        for(size_t i = 0; i < STRIPES; i++){
+            guards.emplace_back(stripes[i].lock);
+        }
+        if((float) currentMembers.load() / (float) currentSize <= allowedLoadFactor){
+            return;
+        }
+        
+        auto newMap = std::make_unique<linkedlist::LinkedList<K, T>[]>(2 * currentSize);
+        currentSize *= 2;
+        for(size_t i = 0; i < currentSize/2; i++){
+            while(auto node = map[i].popFront()){
+                size_t index = getIndex(node->key);
+                newMap[index].pushFront(std::move(node));
+            }
+        }
+        map = std::move(newMap);
+    }
+    
 };
 
 bool testInsertAndFind() {
@@ -177,7 +483,8 @@ bool testReset() {
 }
 
 bool testSize() {
-    HashMap<int, std::string> map;
+    // sizes below assume the plain modulo index policy
+    HashMap<int, std::string, hashing::DefaultHash<int>, hashing::Modulo> map;
 
     // Initial insertions and size checks
     map.insert(1, "one");
@@ -206,10 +513,137 @@ bool testSize() {
     return true;
 }
 
+bool testPowerOfTwoSize() {
+    HashMap<int, std::string> map;
+    
+    // the default index policy rounds 100 up to 128 buckets and masks
+    if(map.getCurrentSize() != 128) return false;
+    for(int i = 1; i <= 96; i++) {
+        map.insert(i, std::to_string(i));
+    }
+    if(map.getCurrentSize() != 128) return false;
+    map.insert(97, "97");
+    if(map.getCurrentSize() != 256 || map.getCurrentMembers() != 97) return false;
+    
+    // prime capacities go through the constant-divisor table
+    HashMap<int, std::string, hashing::DefaultHash<int>, hashing::PrimeModulo> primeMap;
+    if(primeMap.getCurrentSize() != 193) return false;
+    for(int i = 1; i <= 200; i++) {
+        primeMap.insert(i, std::to_string(i));
+    }
+    if(primeMap.getCurrentSize() != 389 || primeMap.find(150)->data != "150") return false;
+    return true;
+}
+
+bool testIncrementalReHash() {
+    HashMap<int, int> map(true);
+    
+    for(int i = 0; i < 10000; i++) {
+        map.insert(i, i);
+        // every key inserted so far must be visible, whichever table it is in
+        if(i % 97 == 0) {
+            for(int j = 0; j <= i; j += 13) {
+                if(map.find(j) == nullptr || map.find(j)->data != j) return false;
+            }
+        }
+    }
+    for(int i = 0; i < 10000; i += 2) {
+        if(map.deleteNode(i) != true) return false;
+    }
+    if(map.getCurrentMembers() != 5000) return false;
+    for(int i = 0; i < 10000; i++) {
+        if((map.find(i) != nullptr) != (i % 2 == 1)) return false;
+    }
+    return true;
+}
+
+bool testConcurrentInsertAndFind() {
+    ConcurrentHashMap<int, int> map;
+    const int threads = 4;
+    const int perThread = 20000;
+    
+    // every thread writes its own key range while reading the others
+    std::vector<std::thread> workers;
+    for(int t = 0; t < threads; t++) {
+        workers.emplace_back([&map, t]{
+            int value;
+            for(int i = 0; i < perThread; i++) {
+                map.insert(t * perThread + i, i);
+                map.find(((t + 1) % threads) * perThread + i, value);
+            }
+        });
+    }
+    for(auto& worker : workers) {
+        worker.join();
+    }
+    
+    if(map.getCurrentMembers() != threads * perThread) return false;
+    int value;
+    for(int key = 0; key < threads * perThread; key++) {
+        if(!map.find(key, value) || value != key % perThread) return false;
+    }
+    if(map.deleteNode(5) != true || map.contains(5)) return false;
+    return true;
+}
+
+bool testBatch() {
+    HashMap<int, int> map;
+    std::vector<int> keys(1000), vals(1000);
+    for(int i = 0; i < 1000; i++) {
+        keys[i] = i * 7;
+        vals[i] = i;
+    }
+    map.insertBatch(keys.data(), vals.data(), keys.size());
+    if(map.getCurrentMembers() != 1000) return false;
+    
+    // every other lookup is a miss
+    std::vector<int> lookups(2000);
+    for(int i = 0; i < 2000; i++) {
+        lookups[i] = (i % 2 == 0) ? keys[i / 2] : -i;
+    }
+    std::vector<int*> out(lookups.size());
+    map.findBatch(lookups.data(), lookups.size(), out.data());
+    for(int i = 0; i < 2000; i++) {
+        if(i % 2 == 0 && (out[i] == nullptr || *out[i] != i / 2)) return false;
+        if(i % 2 == 1 && out[i] != nullptr) return false;
+    }
+    return true;
+}
+
+#if defined(HASHMAP_STATS)
+bool testStats() {
+    HashMap<int, int> map;
+    for(int i = 0; i < 1000; i++) {
+        map.insert(i, i);
+    }
+    for(int i = 0; i < 1000; i++) {
+        map.find(i);
+        map.find(-1 - i);
+    }
+    hashing::Stats stats = map.getStats();
+    if(stats.hits != 1000 || stats.misses != 1000) return false;
+    // a hit compares at least the key itself
+    if(stats.averageHitProbes() < 1.0 || stats.rehashes == 0) return false;
+    // one histogram entry per bucket
+    size_t buckets = 0;
+    for(size_t count : stats.histogram) {
+        buckets += count;
+    }
+    if(buckets != map.getCurrentSize()) return false;
+    map.resetStats();
+    if(map.getStats().hits != 0) return false;
+    return true;
+}
+#endif
+
 void runTests() {
     
     int count = 0;
-    int total = 5;  // Updated total count
+#if defined(HASHMAP_STATS)
+    int total = 10;
+#else
+    int total = 9;  // Updated total count
+#endif
     
     
     
@@ -218,6 +652,13 @@ void runTests() {
     tests::test(count, "Testing Duplicate Inserts", testDuplicateInserts);
     tests::test(count, "Testing Reset", testReset);
     tests::test(count, "Testing Size", testSize);
+    tests::test(count, "Testing Power of Two Size", testPowerOfTwoSize);
+    tests::test(count, "Testing Batch Insert and Find", testBatch);
+    tests::test(count, "Testing Incremental ReHash", testIncrementalReHash);
+    tests::test(count, "Testing Concurrent Insert and Find", testConcurrentInsertAndFind);
+#if defined(HASHMAP_STATS)
+    tests::test(count, "Testing Stats", testStats);
+#endif
     
     std::cout << std::string(40, '-') << "\n";
     std::cout << " -- Chaining::HashMap: Passed [" << count << "/" << total << "] tests -- " << std::endl;
@@ -225,6 +666,59 @@ void runTests() {
     std::cout << std::string(40, '-') << "\n\n";
 }
 
+// the single global lock setup ConcurrentHashMap replaces
+template <class K, class T>
+class MutexHashMap{
+    std::mutex lock;
+    HashMap<K, T> map;
+    
+public:
+    bool insert(K key, T val){
+        std::lock_guard<std::mutex> guard(lock);
+        return map.insert(key, val);
+    }
+    
+    bool find(K key, T& out){
+        std::lock_guard<std::mutex> guard(lock);
+        auto it = map.find(key);
+        if(it){
+            out = it->data;
+            return true;
+        }
+        return false;
+    }
+};
+
+void runBenchmarks(size_t n = 1000000) {
+    bench::header("Chaining::HashMap benchmarks");
+    auto keys = bench::uniformKeys(n);
+    
+    {
+        HashMap<uint64_t, uint64_t> map;
+        bench::latency("HashMap insert latency", n, [&](size_t i){
+            map.insert(keys[i], keys[i]);
+        });
+    }
+    {
+        HashMap<uint64_t, uint64_t> map(true);
+        bench::latency("HashMap insert latency (incremental)", n, [&](size_t i){
+            map.insert(keys[i], keys[i]);
+        });
+        bench::run("HashMap find (incremental)", n, [&]{
+            for(auto k : keys) bench::doNotOptimize(map.find(k));
+        });
+    }
+    size_t maxThreads = std::max(1u, std::thread::hardware_concurrency());
+    for(int readPercent : {95, 50}){
+        for(size_t threads = 1; threads <= maxThreads; threads *= 2){
+            bench::concurrentMap<MutexHashMap<uint64_t, uint64_t>>("MutexHashMap", threads, readPercent, n, n);
+            bench::concurrentMap<ConcurrentHashMap<uint64_t, uint64_t>>("ConcurrentHashMap", threads, readPercent, n, n);
+        }
+    }
+    bench::batchFind<HashMap<uint64_t, uint64_t>>("HashMap", 8 * n);
+    std::cout << std::string(40, '-') << "\n\n";
+}
+
 }
 
 #endif /* HashMap_C_h */
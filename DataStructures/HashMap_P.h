@@ -8,16 +8,41 @@
 #ifndef HashMap_P_h
 #define HashMap_P_h
 #include "LinkedList.h"
+#include "Hashing.h"
 #include "Testing.h"
+#include "Benchmark.h"
+#include "Reclamation.h"
 #include <memory>
 #include <functional>
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <limits>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 namespace probing {
 
+// Robin Hood hashing: every slot remembers how far it sits from its home
+// slot (dist). Deletion shifts the following run back by one instead of
+// leaving a tombstone, so a slot is only ever EMPTY or OCCUPIED.
 enum class STATUS {
     EMPTY,
-    OCCUPIED,
-    TOMBSTONE
+    OCCUPIED
 };
 
 template <class K, class T>
@@ -25,34 +50,141 @@ struct Node {
     K key;
     T data;
     STATUS status;
+    uint32_t dist;
     
-    Node(): status(STATUS::EMPTY) {}
+    Node(): key(), data(), status(STATUS::EMPTY), dist(0) {}
 };
 
-template <class K, class T>
+template <class K, class T, class Hash = hashing::DefaultHash<K>, class Index = hashing::PowerOfTwo>
 class HashMap{
     
+    static const size_t ARRAY_SIZE = 100;
+    
     size_t currentSize, currentMembers;
     float allowedLoadFactor;
     
-    std::unique_ptr<Node<K, T>[]> map;
+    // Slots are on the heap, or in a private mapping of a snapshot file made
+    // by openMapped; the deleter knows which. Pages of the mapping are copied
+    // on the first write to them, so the file itself never changes.
+    struct Release {
+        void* base = nullptr;
+        size_t length = 0;
+        
+        void operator()(Node<K, T>* slots) const {
+            if(base){
+                munmap(base, length);
+            }else{
+                delete[] slots;
+            }
+        }
+    };
+    
+    using Slots = std::unique_ptr<Node<K, T>[], Release>;
+    
+    Slots map;
+    
+    Hash hashFunction;
+    Index indexer;
+    uint64_t hashId;
+    
+    // Snapshot file: this header, then the slot array exactly as it is in
+    // memory. The checksum covers the slot array; fingerprint catches a
+    // file written with another hash or index policy, which would otherwise
+    // open fine and then miss every lookup.
+    static constexpr uint32_t MAGIC = 0x48505331;   // "HPS1"
+    static constexpr uint32_t VERSION = 2;
+    static constexpr size_t HEADER_BYTES = 64;
+    
+    struct FileHeader {
+        uint32_t magic, version, keySize, valSize, nodeSize, reserved;
+        uint64_t capacity, members, hashId, fingerprint, checksum;
+    };
+    
+    static Slots allocateSlots(size_t size){
+        return Slots(new Node<K, T>[size]());
+    }
+    
+    // Integer keys are hashed at a spread of sample keys, since two hashes
+    // can agree at any one key (both are 0 at 0 for std::hash and a
+    // multiplicative hash). Other key types can't be made up here, so their
+    // snapshots rely on hashId naming the hash instead.
+    uint64_t fingerprint(const Index& policy){
+        uint64_t result = hashing::mix(hashId ^ (uint64_t) hashFunction(K()));
+        if constexpr (std::is_integral<K>::value){
+            for(uint64_t i = 0; i < 8; i++){
+                K sample = (K) hashing::mix(i, hashId);
+                result = hashing::mix(result ^ (uint64_t) hashFunction(sample), i);
+            }
+        }
+        for(uint64_t i = 0; i < 8; i++){
+            result = hashing::mix(result ^ (uint64_t) policy.index((size_t) hashing::mix(i)), i);
+        }
+        return result;
+    }
+    
+    static bool writeAll(int fd, const void* data, size_t n){
+        const char* bytes = static_cast<const char*>(data);
+        while(n > 0){
+            ssize_t written = ::write(fd, bytes, std::min(n, (size_t) 1 << 30));
+            if(written <= 0){
+                return false;
+            }
+            bytes += written;
+            n -= (size_t) written;
+        }
+        return true;
+    }
     
-    using hashFuncType = std::function<size_t(const K)>;
+#if defined(HASHMAP_STATS)
+    hashing::Stats stats;
+#endif
     
-    static size_t defaultHash(const K key) {
-        return std::hash<K>()(key);
+    size_t getIndex(const K& key){
+        return indexer.index(hashFunction(key));
     }
     
-    size_t getIndex(const K key){
-        return defaultHash(key) % currentSize;
+    size_t nextIndex(size_t index){
+        index += 1;
+        return (index == currentSize) ? 0 : index;
     }
     
-    hashFuncType hashFunction;
+    // probes counts the slots compared; insert and deleteNode come through
+    // here directly so only lookups by callers show up in the statistics
+    Node<K, T>* lookup(const K& key, size_t index, size_t& probes){
+        uint32_t dist = 0;
+        // once we are further from home than the slot's own entry, robin hood
+        // placement guarantees the key would have been stored before here
+        while(map[index].status == STATUS::OCCUPIED && map[index].dist >= dist){
+            probes += 1;
+            if(map[index].key == key){
+                return &map[index];
+            }
+            index = nextIndex(index);
+            dist += 1;
+        }
+        return nullptr;
+    }
+    
+    // robin hood placement: an entry that is further from home than the
+    // current occupant takes the slot, and the occupant moves on instead
+    void place(Node<K, T>&& entry){
+        size_t index = getIndex(entry.key);
+        entry.status = STATUS::OCCUPIED;
+        entry.dist = 0;
+        while(map[index].status == STATUS::OCCUPIED){
+            if(map[index].dist < entry.dist){
+                std::swap(map[index], entry);
+            }
+            index = nextIndex(index);
+            entry.dist += 1;
+        }
+        map[index] = std::move(entry);
+    }
     
 public:
-    HashMap(hashFuncType customHash = defaultHash): currentSize(100), allowedLoadFactor(0.5f),
-    map(std::make_unique<Node<K, T>[]>(100)),
-    hashFunction(customHash) {}
+    HashMap(Hash customHash = Hash()): currentSize(Index(ARRAY_SIZE).capacity()), currentMembers(0), allowedLoadFactor(0.5f),
+    map(allocateSlots(currentSize)),
+    hashFunction(customHash), indexer(ARRAY_SIZE), hashId(0) {}
 
     size_t getCurrentSize(){
         return currentSize;
@@ -74,52 +206,465 @@ public:
     }
     
     bool insert(K key, T val){
-        // insert should only avoid occupied
-        size_t index = hashFunction(key);
-        while(map[index].status == STATUS::OCCUPIED){
-            if(map[index].key == key){
-                map[index].data = val;
-                return true;
-            }
-            index += 1;
+        size_t probes = 0;
+        auto it = lookup(key, getIndex(key), probes);
+        if(it){
+            it->data = val;
+            return true;
         }
-        // found the right index
-        map[index].key = key;
-        map[index].data = val;
-        map[index].status = STATUS::OCCUPIED;
+        Node<K, T> entry;
+        entry.key = key;
+        entry.data = val;
+        place(std::move(entry));
         currentMembers += 1;
-        if(getLoadFactor() > allowedLoadFactor){
+        if(shouldReHash()){
             rehash();
         }
         return true;
     }
     
     Node<K, T>* find(K key){
-        // search should be over tombstones
-        size_t index = hashFunction(key);
-        while(map[index].status != STATUS::EMPTY){
-            if(map[index].key == key){
-                return &map[index];
+        return findFrom(key, getIndex(key));
+    }
+    
+    // resolves n keys in groups: all home slots of a group are hashed and
+    // prefetched first, so their cache misses overlap instead of queueing.
+    // out[i] points at the value for keys[i], or is nullptr if it is missing.
+    void findBatch(const K* keys, size_t n, T** out){
+        size_t index[hashing::BATCH_SIZE];
+        for(size_t base = 0; base < n; base += hashing::BATCH_SIZE){
+            size_t count = std::min(hashing::BATCH_SIZE, n - base);
+            for(size_t i = 0; i < count; i++){
+                index[i] = getIndex(keys[base + i]);
+                hashing::prefetch(&map[index[i]]);
+            }
+            for(size_t i = 0; i < count; i++){
+                auto it = findFrom(keys[base + i], index[i]);
+                out[base + i] = it ? &it->data : nullptr;
             }
-            index += 1;
         }
-        return nullptr;
+    }
+    
+    // inserts keys[i] -> vals[i], prefetching each group's home slots first
+    void insertBatch(const K* keys, const T* vals, size_t n){
+        for(size_t base = 0; base < n; base += hashing::BATCH_SIZE){
+            size_t count = std::min(hashing::BATCH_SIZE, n - base);
+            for(size_t i = 0; i < count; i++){
+                hashing::prefetch(&map[getIndex(keys[base + i])]);
+            }
+            for(size_t i = 0; i < count; i++){
+                insert(keys[base + i], vals[base + i]);
+            }
+        }
+    }
+    
+    Node<K, T>* findFrom(const K& key, size_t index){
+        size_t probes = 0;
+        auto it = lookup(key, index, probes);
+        HASHMAP_STAT(stats.recordFind(it != nullptr, probes));
+        return it;
     }
     
     bool deleteNode(K key){
+        size_t probes = 0;
+        auto it = lookup(key, getIndex(key), probes);
+        if(!it){
+            return false;
+        }
+        // backward shift: pull every displaced successor one slot closer to home
+        size_t index = it - map.get();
+        size_t next = nextIndex(index);
+        while(map[next].status == STATUS::OCCUPIED && map[next].dist > 0){
+            map[index] = std::move(map[next]);
+            map[index].dist -= 1;
+            index = next;
+            next = nextIndex(next);
+        }
+        map[index] = Node<K, T>();
+        currentMembers -= 1;
+        return true;
+    }
+    
+    bool reset(){
+        try{
+            map = allocateSlots(currentSize);
+            currentMembers = 0;
+            return true;
+        }catch(...){
+            return false;
+        }
+    }
+    
+    void rehash(){
+        HASHMAP_STAT(stats.rehashes += 1);
+#if defined(HASHMAP_STATS)
+        hashing::ScopedTimer timer(stats.rehashNanos);
+#endif
+        Slots oldMap = std::move(map);
+        size_t oldSize = currentSize;
+        
+        indexer = indexer.grown();
+        currentSize = indexer.capacity();
+        map = allocateSlots(currentSize);
+        
+        for(size_t i = 0; i < oldSize; i++){
+            if(oldMap[i].status == STATUS::OCCUPIED){
+                place(std::move(oldMap[i]));
+            }
+        }
+    }
+    
+    // Names the hash function in snapshots; save and openMapped only agree
+    // on files written under the same id. Required for non-integer keys,
+    // whose hash the fingerprint can't sample, and a way to tell seeded
+    // hashes apart for integer ones.
+    void setSnapshotHashId(uint64_t id){
+        hashId = id;
+    }
+    
+    // Writes the table to path as a snapshot for openMapped: a header, then
+    // the slot array byte for byte. The file is written beside path and
+    // renamed over it, so a crash leaves either the old snapshot or the new.
+    // Returns false for non-integer keys until a hash id is set.
+    bool save(const std::string& path){
+        static_assert(std::is_trivially_copyable<K>::value && std::is_trivially_copyable<T>::value,
+                      "snapshots store keys and values as raw bytes");
+        static_assert(alignof(Node<K, T>) <= HEADER_BYTES, "slots must stay aligned behind the header");
+        static_assert(sizeof(FileHeader) <= HEADER_BYTES, "header must fit its reserved bytes");
+        if(!std::is_integral<K>::value && hashId == 0){
+            return false;
+        }
+        size_t bytes = currentSize * sizeof(Node<K, T>);
+        FileHeader h{MAGIC, VERSION, (uint32_t) sizeof(K), (uint32_t) sizeof(T), (uint32_t) sizeof(Node<K, T>), 0,
+                     currentSize, currentMembers, hashId, fingerprint(indexer), hashing::checksum(map.get(), bytes)};
+        char header[HEADER_BYTES] = {};
+        std::memcpy(header, &h, sizeof(h));
+        std::string temp = path + ".tmp";
+        int fd = ::open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if(fd < 0){
+            return false;
+        }
+        bool written = writeAll(fd, header, HEADER_BYTES) && writeAll(fd, map.get(), bytes) && fsync(fd) == 0;
+        written = ::close(fd) == 0 && written;
+        if(!written || std::rename(temp.c_str(), path.c_str()) != 0){
+            std::remove(temp.c_str());
+            return false;
+        }
+        return true;
+    }
+    
+    // Replaces the contents with a snapshot written by save, served from a
+    // private mapping of the file: nothing is parsed or rehashed, and pages
+    // are only read in as lookups touch them. verify checksums the slots
+    // first, which reads the whole file. Returns false, leaving the map as
+    // it was, if the file cannot be mapped or holds another layout, or for
+    // non-integer keys until a hash id is set.
+    bool openMapped(const std::string& path, bool verify = false){
+        static_assert(std::is_trivially_copyable<K>::value && std::is_trivially_copyable<T>::value,
+                      "snapshots store keys and values as raw bytes");
+        if(!std::is_integral<K>::value && hashId == 0){
+            return false;
+        }
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if(fd < 0){
+            return false;
+        }
+        struct stat st;
+        if(fstat(fd, &st) != 0 || (size_t) st.st_size < HEADER_BYTES){
+            ::close(fd);
+            return false;
+        }
+        size_t length = (size_t) st.st_size;
+        void* base = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if(base == MAP_FAILED){
+            return false;
+        }
+        FileHeader h;
+        std::memcpy(&h, base, sizeof(h));
+        Node<K, T>* slots = reinterpret_cast<Node<K, T>*>(static_cast<char*>(base) + HEADER_BYTES);
+        size_t bytes = length - HEADER_BYTES;
+        Index restored((size_t) h.capacity);
+        bool valid = h.magic == MAGIC && h.version == VERSION && h.keySize == sizeof(K) && h.valSize == sizeof(T)
+            && h.nodeSize == sizeof(Node<K, T>) && h.capacity > 0 && restored.capacity() == h.capacity
+            && bytes % sizeof(Node<K, T>) == 0 && bytes / sizeof(Node<K, T>) == h.capacity
+            && h.members <= h.capacity && h.hashId == hashId && h.fingerprint == fingerprint(restored);
+        if(valid && verify){
+            valid = hashing::checksum(slots, bytes) == h.checksum;
+        }
+        if(!valid){
+            munmap(base, length);
+            return false;
+        }
+        map = Slots(slots, Release{base, length});
+        currentSize = (size_t) h.capacity;
+        currentMembers = (size_t) h.members;
+        indexer = restored;
+        return true;
+    }
+    
+    // true while the slots are still those of a mapped snapshot; a rehash or
+    // reset moves them back to the heap
+    bool isMapped(){
+        return map.get_deleter().base != nullptr;
+    }
+    
+#if defined(HASHMAP_STATS)
+    // the counters so far plus a histogram of every entry's probe distance
+    hashing::Stats getStats(){
+        hashing::Stats result = stats;
+        for(size_t i = 0; i < currentSize; i++){
+            if(map[i].status == STATUS::OCCUPIED){
+                result.addToHistogram(map[i].dist);
+            }
+        }
+        return result;
+    }
+    
+    void resetStats(){
+        stats = hashing::Stats();
+    }
+#endif
+    
+};
+
+
+// Swiss-table mode: one control byte per slot (7 hash bits, or EMPTY/DELETED)
+// kept in its own array, so a probe scans a whole group of control bytes with
+// a single compare and only touches the slots whose tag matches.
+
+namespace group {
+
+using ctrl_t = int8_t;
+
+constexpr ctrl_t EMPTY = -128;   // 0b10000000
+constexpr ctrl_t DELETED = -2;   // 0b11111110
+constexpr size_t WIDTH = 16;
+
+// bit i is set if control byte i of the group matched
+struct BitMask {
+    uint32_t mask;
+    
+    explicit operator bool() const {
+        return mask != 0;
+    }
+    
+    int lowest() const {
+        return __builtin_ctz(mask);
+    }
+    
+    void clearLowest() {
+        mask &= mask - 1;
+    }
+};
+
+#if defined(__SSE2__)
+
+struct Group {
+    __m128i ctrl;
+    
+    explicit Group(const ctrl_t* pos): ctrl(_mm_load_si128(reinterpret_cast<const __m128i*>(pos))) {}
+    
+    BitMask match(ctrl_t h2) const {
+        return BitMask{(uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8(h2), ctrl))};
+    }
+    
+    BitMask matchEmpty() const {
+        return match(EMPTY);
+    }
+    
+    // EMPTY and DELETED are the only tags with the sign bit set
+    BitMask matchEmptyOrDeleted() const {
+        return BitMask{(uint32_t) _mm_movemask_epi8(ctrl)};
+    }
+};
+
+#else
+
+struct Group {
+    const ctrl_t* ctrl;
+    
+    explicit Group(const ctrl_t* pos): ctrl(pos) {}
+    
+    BitMask match(ctrl_t h2) const {
+        uint32_t mask = 0;
+        for(size_t i = 0; i < WIDTH; i++){
+            mask |= (uint32_t) (ctrl[i] == h2) << i;
+        }
+        return BitMask{mask};
+    }
+    
+    BitMask matchEmpty() const {
+        return match(EMPTY);
+    }
+    
+    BitMask matchEmptyOrDeleted() const {
+        uint32_t mask = 0;
+        for(size_t i = 0; i < WIDTH; i++){
+            mask |= (uint32_t) (ctrl[i] < 0) << i;
+        }
+        return BitMask{mask};
+    }
+};
+
+#endif
+
+}
+
+template <class K, class T>
+struct Slot {
+    K key;
+    T data;
+};
+
+template <class K, class T, class Hash = hashing::DefaultHash<K>>
+class SwissHashMap{
+    
+    static const size_t ARRAY_SIZE = 128;
+    
+    size_t currentSize, currentMembers, growthLeft;
+    
+    // control bytes are 16-byte aligned so every group is a single aligned load
+    struct alignas(group::WIDTH) CtrlBlock {
+        group::ctrl_t bytes[group::WIDTH];
+    };
+    
+    std::unique_ptr<CtrlBlock[]> ctrl;
+    std::unique_ptr<Slot<K, T>[]> slots;
+    
+    Hash hashFunction;
+    
+    // the hash is split into the probe start (h1) and the control tag (h2),
+    // so both ends of it need to be well mixed
+    size_t hash(const K& key) {
+        return hashFunction(key);
+    }
+    
+    static size_t h1(size_t h) {
+        return h >> 7;
+    }
+    
+    static group::ctrl_t h2(size_t h) {
+        return (group::ctrl_t) (h & 0x7F);
+    }
+    
+    group::ctrl_t* ctrlBytes() {
+        return ctrl[0].bytes;
+    }
+    
+    size_t groupCount() {
+        return currentSize / group::WIDTH;
+    }
+    
+    static size_t maxMembers(size_t size) {
+        return size - size / 8;
+    }
+    
+    // returns the index of the first EMPTY or DELETED slot on key's probe sequence
+    size_t findFreeSlot(size_t h) {
+        size_t mask = groupCount() - 1;
+        size_t g = h1(h) & mask;
+        for(size_t step = 1; ; step++){
+            group::Group grp(ctrl[g].bytes);
+            if(auto m = grp.matchEmptyOrDeleted()){
+                return g * group::WIDTH + m.lowest();
+            }
+            // triangular probing visits every group when the count is a power of two
+            g = (g + step) & mask;
+        }
+    }
+    
+    void allocate(size_t size) {
+        currentSize = size;
+        ctrl = std::make_unique<CtrlBlock[]>(size / group::WIDTH);
+        std::memset(ctrlBytes(), (unsigned char) group::EMPTY, size);
+        slots = std::make_unique<Slot<K, T>[]>(size);
+        growthLeft = maxMembers(size);
+    }
+    
+public:
+    SwissHashMap(Hash customHash = Hash()): currentSize(ARRAY_SIZE), currentMembers(0), hashFunction(customHash) {
+        allocate(ARRAY_SIZE);
+    }
+    
+    size_t getCurrentSize(){
+        return currentSize;
+    }
+    
+    size_t getCurrentMembers(){
+        return currentMembers;
+    }
+    
+    float getLoadFactor(){
+        return (float) currentMembers / (float) currentSize;
+    }
+    
+    bool insert(K key, T val){
         auto it = find(key);
         if(it){
-            *it = Node<K, T>();
-            currentMembers -= 1;
+            it->data = val;
             return true;
         }
-        return false;
+        if(growthLeft == 0){
+            rehash();
+        }
+        size_t h = hash(key);
+        size_t index = findFreeSlot(h);
+        // reusing a DELETED slot does not use up any growth
+        if(ctrlBytes()[index] == group::EMPTY){
+            growthLeft -= 1;
+        }
+        ctrlBytes()[index] = h2(h);
+        slots[index].key = key;
+        slots[index].data = val;
+        currentMembers += 1;
+        return true;
+    }
+    
+    Slot<K, T>* find(K key){
+        size_t h = hash(key);
+        size_t mask = groupCount() - 1;
+        size_t g = h1(h) & mask;
+        for(size_t step = 1; ; step++){
+            group::Group grp(ctrl[g].bytes);
+            for(auto m = grp.match(h2(h)); m; m.clearLowest()){
+                size_t index = g * group::WIDTH + m.lowest();
+                if(slots[index].key == key){
+                    return &slots[index];
+                }
+            }
+            // an empty slot ends the probe sequence
+            if(grp.matchEmpty()){
+                return nullptr;
+            }
+            g = (g + step) & mask;
+        }
+    }
+    
+    bool deleteNode(K key){
+        auto it = find(key);
+        if(!it){
+            return false;
+        }
+        size_t index = it - slots.get();
+        size_t g = index / group::WIDTH;
+        // a probe that reaches a group holding an EMPTY stops there anyway,
+        // so the slot can go straight back to EMPTY instead of DELETED
+        if(group::Group(ctrl[g].bytes).matchEmpty()){
+            ctrlBytes()[index] = group::EMPTY;
+            growthLeft += 1;
+        }else{
+            ctrlBytes()[index] = group::DELETED;
+        }
+        slots[index] = Slot<K, T>();
+        currentMembers -= 1;
+        return true;
     }
     
     bool reset(){
         try{
-            map = std::make_unique<Node<K, T>[]>(currentSize);
             currentMembers = 0;
+            allocate(currentSize);
             return true;
         }catch(...){
             return false;
@@ -127,23 +672,332 @@ public:
     }
     
     void rehash(){
-        std::unique_ptr<Node<K, T>[]> newMap = std::make_unique<Node<K, T>[]>(2* currentSize);
+        auto oldCtrl = std::move(ctrl);
+        auto oldSlots = std::move(slots);
+        size_t oldSize = currentSize;
         
-        currentSize *= 2;
+        // if the table is mostly tombstones, rebuilding in place is enough
+        size_t newSize = (currentMembers * 2 < maxMembers(oldSize)) ? oldSize : oldSize * 2;
+        allocate(newSize);
         
-        for(int i = 0; i < currentSize/2; i++){
-            if(map[i].status == STATUS::OCCUPIED){
-                newMap[getIndex(map[i].key)].key = map[i].key;
-                newMap[getIndex(map[i].key)].data = map[i].data;
-                newMap[getIndex(map[i].key)].status = STATUS::OCCUPIED;
+        const group::ctrl_t* oldBytes = oldCtrl[0].bytes;
+        for(size_t i = 0; i < oldSize; i++){
+            if(oldBytes[i] >= 0){
+                size_t h = hash(oldSlots[i].key);
+                size_t index = findFreeSlot(h);
+                ctrlBytes()[index] = h2(h);
+                slots[index].key = std::move(oldSlots[i].key);
+                slots[index].data = std::move(oldSlots[i].data);
+                growthLeft -= 1;
             }
         }
-        
-        map = std::move(newMap);
-        newMap = nullptr;
     }
+    
+};
+
+
+// Lock-free sibling of HashMap for integral keys and values. Slots are
+// claimed with a CAS on the key and never released; values are published
+// and deleted with a CAS on the value, so readers never block.
+//
+// Resizing is cooperative: once a table passes half full a larger one is
+// linked behind it and every insert migrates a chunk of slots. A migrated
+// slot holds MOVED, which sends readers and writers on to the next table.
+// Deleted keys keep their slots, so churn alone fills a table and has it
+// rebuilt at the same size. Every operation runs inside an epoch, and a
+// drained table is retired once the map has moved past it, so it is freed
+// when no operation can still be inside it. At most
+// EpochDomain::MAX_READERS threads may use a map at once.
+template <class K, class T>
+class ConcurrentHashMap{
+    static_assert(std::is_integral<K>::value && std::is_integral<T>::value,
+                  "ConcurrentHashMap needs integral keys and values");
+    
+public:
+    // reserved, these can't be stored
+    static constexpr K EMPTY_KEY = std::numeric_limits<K>::max();
+    static constexpr T NO_VALUE = std::numeric_limits<T>::max();
+    static constexpr T MOVED = std::numeric_limits<T>::max() - 1;
+    
+private:
+    static const size_t ARRAY_SIZE = 128;
+    static const size_t MIGRATE_CHUNK = 256;
+    
+    struct Slot {
+        std::atomic<K> key;
+        std::atomic<T> value;
+    };
+    
+    struct Table {
+        size_t size;
+        std::unique_ptr<Slot[]> slots;
+        std::atomic<size_t> used;
+        std::atomic<Table*> next;
+        std::atomic<size_t> migrateCursor;
+        std::atomic<size_t> migrated;
+        // the owning map's count of allocated tables
+        std::atomic<size_t>& allocated;
         
+        Table(size_t s, std::atomic<size_t>& count): size(s), slots(std::make_unique<Slot[]>(s)), used(0), next(nullptr),
+        migrateCursor(0), migrated(0), allocated(count) {
+            for(size_t i = 0; i < size; i++){
+                slots[i].key.store(EMPTY_KEY, std::memory_order_relaxed);
+                slots[i].value.store(NO_VALUE, std::memory_order_relaxed);
+            }
+            allocated.fetch_add(1);
+        }
         
+        ~Table(){
+            allocated.fetch_sub(1);
+        }
+    };
+    
+    std::atomic<Table*> current;
+    std::atomic<size_t> currentMembers;
+    std::atomic<size_t> tableCount;
+    
+    // declared after tableCount, since it frees the retired tables last
+    reclaim::EpochDomain epochs;
+    // retire and collect are for one thread at a time
+    std::mutex retireLock;
+    // retired tables not yet freed, readable without the lock
+    std::atomic<size_t> retiredTables;
+    
+    static size_t hash(K key){
+        return (size_t) hashing::mix((uint64_t) key);
+    }
+    
+    // returns key's slot in t, or the empty slot that ends its probe; with
+    // claim set the empty slot is taken for key. nullptr means t is full.
+    Slot* locate(Table* t, K key, bool claim){
+        size_t mask = t->size - 1;
+        size_t index = hash(key) & mask;
+        for(size_t n = 0; n < t->size; n++){
+            Slot& slot = t->slots[index];
+            K k = slot.key.load();
+            if(k == EMPTY_KEY){
+                if(!claim){
+                    return &slot;
+                }
+                if(slot.key.compare_exchange_strong(k, key)){
+                    t->used.fetch_add(1);
+                    return &slot;
+                }
+                // lost the race, k now holds the winner's key
+            }
+            if(k == key){
+                return &slot;
+            }
+            index = (index + 1) & mask;
+        }
+        return nullptr;
+    }
+    
+    Table* startResize(Table* t){
+        Table* next = t->next.load();
+        if(next){
+            return next;
+        }
+        // tables full of deleted keys are rebuilt at the same size
+        size_t newSize = (currentMembers.load() * 4 > t->size) ? 2 * t->size : t->size;
+        Table* fresh = new Table(newSize, tableCount);
+        if(t->next.compare_exchange_strong(next, fresh)){
+            return fresh;
+        }
+        delete fresh;
+        return next;
+    }
+    
+    // stores key's value from an old table into dst; until the old slot is
+    // MOVED nobody else writes key in a newer table, so a plain CAS loop is enough
+    void copyInto(Table* dst, K key, T val){
+        while(true){
+            Slot* slot = locate(dst, key, true);
+            if(!slot){
+                dst = startResize(dst);
+                continue;
+            }
+            T v = slot->value.load();
+            while(v != MOVED && !slot->value.compare_exchange_weak(v, val)) {}
+            if(v != MOVED){
+                return;
+            }
+            dst = dst->next.load();
+        }
+    }
+    
+    void migrateSlot(Table* t, Slot& slot){
+        T v = slot.value.load();
+        bool copied = false;
+        while(v != MOVED){
+            K k = slot.key.load();
+            // once a value was copied, a later delete has to be copied too
+            if(k != EMPTY_KEY && (v != NO_VALUE || copied)){
+                copyInto(t->next.load(), k, v);
+                copied = true;
+            }
+            if(slot.value.compare_exchange_strong(v, MOVED)){
+                return;
+            }
+        }
+    }
+    
+    // migrates one chunk of t and promotes its successor once t is drained
+    void helpMigrate(Table* t){
+        Table* next = t->next.load();
+        if(!next){
+            return;
+        }
+        size_t start = t->migrateCursor.fetch_add(MIGRATE_CHUNK);
+        if(start >= t->size){
+            return;
+        }
+        size_t end = std::min(start + MIGRATE_CHUNK, t->size);
+        for(size_t i = start; i < end; i++){
+            migrateSlot(t, t->slots[i]);
+        }
+        if(t->migrated.fetch_add(end - start) + (end - start) == t->size){
+            if(current.compare_exchange_strong(t, next)){
+                retire(t);
+            }
+        }
+    }
+    
+    // t is drained and current has moved past it; operations that started
+    // before may still be inside it, so it is freed epochs later
+    void retire(Table* t){
+        std::lock_guard<std::mutex> lock(retireLock);
+        epochs.retire(t, [](void* p){ delete static_cast<Table*>(p); });
+        epochs.collect();
+        retiredTables.store(epochs.getPending());
+    }
+    
+    // Every operation calls this before it enters its epoch, so a retired
+    // table is freed a couple of operations after the last reader leaves it
+    // rather than at the next resize. A thread that finds the lock taken
+    // skips it instead of waiting.
+    void tryCollect(){
+        if(retiredTables.load(std::memory_order_relaxed) == 0 || !retireLock.try_lock()){
+            return;
+        }
+        epochs.collect();
+        retiredTables.store(epochs.getPending());
+        retireLock.unlock();
+    }
+    
+public:
+    ConcurrentHashMap(): current(nullptr), currentMembers(0), tableCount(0), retiredTables(0) {
+        current.store(new Table(ARRAY_SIZE, tableCount));
+    }
+    
+    ConcurrentHashMap(const ConcurrentHashMap&) = delete;
+    ConcurrentHashMap& operator=(const ConcurrentHashMap&) = delete;
+    
+    // retired tables go with epochs
+    ~ConcurrentHashMap(){
+        Table* t = current.load();
+        while(t){
+            Table* next = t->next.load();
+            delete t;
+            t = next;
+        }
+    }
+    
+    size_t getCurrentSize(){
+        reclaim::EpochDomain::Guard guard(epochs);
+        return current.load()->size;
+    }
+    
+    // tables still allocated: the live one, any linked behind it, and the
+    // retired ones not yet freed
+    size_t getTableCount(){
+        return tableCount.load();
+    }
+    
+    size_t getCurrentMembers(){
+        return currentMembers.load();
+    }
+    
+    // returns true if key was not present before
+    bool insert(K key, T val){
+        tryCollect();
+        reclaim::EpochDomain::Guard guard(epochs);
+        Table* t = current.load();
+        helpMigrate(t);
+        while(true){
+            Slot* slot = locate(t, key, true);
+            if(!slot){
+                t = startResize(t);
+                continue;
+            }
+            T v = slot->value.load();
+            while(v != MOVED && !slot->value.compare_exchange_weak(v, val)) {}
+            if(v == MOVED){
+                t = t->next.load();
+                continue;
+            }
+            if(t == current.load() && t->used.load() > t->size / 2){
+                startResize(t);
+            }
+            if(v == NO_VALUE){
+                currentMembers.fetch_add(1);
+                return true;
+            }
+            return false;
+        }
+    }
+    
+    bool find(K key, T& out){
+        tryCollect();
+        reclaim::EpochDomain::Guard guard(epochs);
+        Table* t = current.load();
+        while(t){
+            Slot* slot = locate(t, key, false);
+            if(!slot){
+                t = t->next.load();
+                continue;
+            }
+            T v = slot->value.load();
+            if(v == MOVED){
+                t = t->next.load();
+                continue;
+            }
+            if(v == NO_VALUE || slot->key.load() != key){
+                return false;
+            }
+            out = v;
+            return true;
+        }
+        return false;
+    }
+    
+    bool deleteNode(K key){
+        tryCollect();
+        reclaim::EpochDomain::Guard guard(epochs);
+        Table* t = current.load();
+        while(t){
+            Slot* slot = locate(t, key, false);
+            if(!slot){
+                t = t->next.load();
+                continue;
+            }
+            T v = slot->value.load();
+            if(slot->key.load() != key && v != MOVED){
+                return false;
+            }
+            while(v != MOVED && v != NO_VALUE && !slot->value.compare_exchange_weak(v, NO_VALUE)) {}
+            if(v == MOVED){
+                t = t->next.load();
+                continue;
+            }
+            if(v == NO_VALUE){
+                return false;
+            }
+            currentMembers.fetch_sub(1);
+            return true;
+        }
+        return false;
+    }
     
 };
 
@@ -203,7 +1057,8 @@ bool testReset() {
 }
 
 bool testSize() {
-    HashMap<int, std::string> map;
+    // sizes below assume the plain modulo index policy
+    HashMap<int, std::string, hashing::DefaultHash<int>, hashing::Modulo> map;
 
     // Initial insertions and size checks
     map.insert(1, "one");
@@ -236,9 +1091,378 @@ bool testSize() {
     return true;
 }
 
+bool testPowerOfTwoSize() {
+    HashMap<int, std::string> map;
+    
+    // the default index policy rounds 100 up to 128 slots and masks
+    if(map.getCurrentSize() != 128) return false;
+    for(int i = 1; i <= 64; i++) {
+        map.insert(i, std::to_string(i));
+    }
+    if(map.getCurrentSize() != 128) return false;
+    map.insert(65, "65");
+    if(map.getCurrentSize() != 256 || map.getCurrentMembers() != 65) return false;
+    
+    HashMap<int, std::string, hashing::DefaultHash<int>, hashing::FastRange> rangeMap;
+    for(int i = 1; i <= 200; i++) {
+        rangeMap.insert(i, std::to_string(i));
+    }
+    if(rangeMap.getCurrentSize() != 400 || rangeMap.find(150)->data != "150") return false;
+    return true;
+}
+
+bool testDeleteChurn() {
+    HashMap<int, int> map;
+    
+    for(int i = 0; i < 1000; i++) {
+        map.insert(i, i);
+    }
+    // backward-shift deletion must keep every remaining key reachable
+    for(int round = 0; round < 4; round++) {
+        for(int i = round; i < 1000; i += 3) {
+            map.deleteNode(i);
+        }
+        for(int i = round; i < 1000; i += 3) {
+            map.insert(i, i + round);
+        }
+    }
+    if(map.getCurrentMembers() != 1000) return false;
+    for(int i = 0; i < 1000; i++) {
+        if(map.find(i) == nullptr) return false;
+    }
+    if(map.find(1000) != nullptr) return false;
+    return true;
+}
+
+bool testSwissInsertAndFind() {
+    SwissHashMap<int, std::string> map;
+    
+    map.insert(1, "one");
+    map.insert(2, "two");
+    map.insert(3, "three");
+    if(map.find(1)->data != "one") return false;
+    if(map.find(2)->data != "two") return false;
+    if(map.find(3)->data != "three") return false;
+    
+    map.insert(3, "third");
+    if(map.find(3)->data != "third" || map.getCurrentMembers() != 3) return false;
+    
+    if(map.find(4) != nullptr) return false;
+    return true;
+}
+
+bool testSwissDelete() {
+    SwissHashMap<int, int> map;
+    
+    for(int i = 0; i < 1000; i++) {
+        map.insert(i, i * 2);
+    }
+    // delete every other key, then make sure the survivors are still reachable
+    for(int i = 0; i < 1000; i += 2) {
+        if(map.deleteNode(i) != true) return false;
+    }
+    if(map.deleteNode(0) != false) return false;
+    if(map.getCurrentMembers() != 500) return false;
+    
+    for(int i = 0; i < 1000; i++) {
+        auto it = map.find(i);
+        if(i % 2 == 0 && it != nullptr) return false;
+        if(i % 2 == 1 && (it == nullptr || it->data != i * 2)) return false;
+    }
+    return true;
+}
+
+bool testSwissSize() {
+    SwissHashMap<int, std::string> map;
+    
+    // 7/8 of 128 slots can be filled before the table grows
+    for(int i = 1; i <= 112; i++) {
+        map.insert(i, std::to_string(i));
+    }
+    if(map.getCurrentSize() != 128 || map.getCurrentMembers() != 112) return false;
+    
+    map.insert(113, "113");
+    if(map.getCurrentSize() != 256 || map.getCurrentMembers() != 113) return false;
+    
+    if(map.find(49)->data != "49") return false;
+    if(map.find(113)->data != "113") return false;
+    return true;
+}
+
+bool testLockFreeStress() {
+    ConcurrentHashMap<int64_t, int64_t> map;
+    const int threads = 4;
+    const int64_t perThread = 20000;
+    std::atomic<bool> badRead(false);
+    
+    // each thread owns a key range: insert it all, delete multiples of 3 and
+    // put back multiples of 6, while reading a neighbour's range. Any value
+    // seen must be the one the owner writes, 2 * key.
+    std::vector<std::thread> workers;
+    for(int t = 0; t < threads; t++) {
+        workers.emplace_back([&, t]{
+            int64_t base = t * perThread;
+            int64_t other = ((t + 1) % threads) * perThread;
+            int64_t value;
+            for(int64_t i = 0; i < perThread; i++) {
+                map.insert(base + i, 2 * (base + i));
+                if(map.find(other + i, value) && value != 2 * (other + i)) badRead = true;
+            }
+            for(int64_t i = 0; i < perThread; i += 3) {
+                map.deleteNode(base + i);
+                if(map.find(other + i, value) && value != 2 * (other + i)) badRead = true;
+            }
+            for(int64_t i = 0; i < perThread; i += 6) {
+                map.insert(base + i, 2 * (base + i));
+            }
+        });
+    }
+    for(auto& worker : workers) {
+        worker.join();
+    }
+    if(badRead) return false;
+    
+    int64_t value;
+    size_t expected = 0;
+    for(int64_t key = 0; key < threads * perThread; key++) {
+        int64_t i = key % perThread;
+        bool present = (i % 3 != 0) || (i % 6 == 0);
+        expected += present;
+        if(map.find(key, value) != present) return false;
+        if(present && value != 2 * key) return false;
+    }
+    return map.getCurrentMembers() == expected;
+}
+
+bool testLockFreeGrowth() {
+    ConcurrentHashMap<int64_t, int64_t> map;
+    for(int64_t i = 0; i < 200000; i++) map.insert(i, i);
+    // a few reads move the epoch on and free the last drained table
+    int64_t value;
+    for(int64_t i = 0; i < 4; i++) {
+        if(!map.find(i, value) || value != i) return false;
+    }
+    return map.getTableCount() == 1 && map.getCurrentMembers() == 200000;
+}
+
+bool testLockFreeChurn() {
+    ConcurrentHashMap<int64_t, int64_t> map;
+    const int threads = 4;
+    const int64_t live = 5000;
+    const int64_t steps = 500000;
+    std::atomic<size_t> maxTables(0);
+    
+    // every thread keeps live keys of its own and swaps its oldest for a new
+    // one each step; deleted keys keep their slots, so the map is rebuilt at
+    // the same size over and over, and the drained tables have to be freed
+    std::vector<std::thread> workers;
+    for(int t = 0; t < threads; t++) {
+        workers.emplace_back([&, t]{
+            for(int64_t i = 0; i < live + steps; i++) {
+                int64_t key = i * threads + t;
+                map.insert(key, 2 * key);
+                if(i >= live) map.deleteNode(key - live * threads);
+                if(i % 4096 == 0) {
+                    size_t tables = map.getTableCount();
+                    size_t seen = maxTables.load();
+                    while(tables > seen && !maxTables.compare_exchange_weak(seen, tables)) {}
+                }
+            }
+        });
+    }
+    for(auto& worker : workers) {
+        worker.join();
+    }
+    // a preempted thread holds its epoch, and the tables retired meanwhile,
+    // for a while; without reclamation there would be one per rebuild
+    if(maxTables > 16 || map.getTableCount() > 4 || map.getCurrentSize() > 16 * threads * live) return false;
+    
+    int64_t value;
+    int64_t end = (live + steps) * threads;
+    for(int64_t key = 0; key < end; key += 7) {
+        bool present = key >= end - live * threads;
+        if(map.find(key, value) != present) return false;
+        if(present && value != 2 * key) return false;
+    }
+    return map.getCurrentMembers() == (size_t) (threads * live);
+}
+
+bool testBatch() {
+    HashMap<int, int> map;
+    std::vector<int> keys(1000), vals(1000);
+    for(int i = 0; i < 1000; i++) {
+        keys[i] = i * 7;
+        vals[i] = i;
+    }
+    map.insertBatch(keys.data(), vals.data(), keys.size());
+    if(map.getCurrentMembers() != 1000) return false;
+    
+    // every other lookup is a miss
+    std::vector<int> lookups(2000);
+    for(int i = 0; i < 2000; i++) {
+        lookups[i] = (i % 2 == 0) ? keys[i / 2] : -i;
+    }
+    std::vector<int*> out(lookups.size());
+    map.findBatch(lookups.data(), lookups.size(), out.data());
+    for(int i = 0; i < 2000; i++) {
+        if(i % 2 == 0 && (out[i] == nullptr || *out[i] != i / 2)) return false;
+        if(i % 2 == 1 && out[i] != nullptr) return false;
+    }
+    return true;
+}
+
+std::string snapshotPath(const char* name) {
+    return (std::filesystem::temp_directory_path() / name).string();
+}
+
+bool testSnapshot() {
+    std::string path = snapshotPath("advanceddsa_probing_snapshot.bin");
+    HashMap<uint64_t, uint64_t> map;
+    for(uint64_t i = 0; i < 100000; i++) map.insert(i, 3 * i);
+    for(uint64_t i = 0; i < 100000; i += 7) map.deleteNode(i);
+    if(!map.save(path)) return false;
+    
+    HashMap<uint64_t, uint64_t> mapped;
+    if(!mapped.openMapped(path, true) || !mapped.isMapped()) return false;
+    if(mapped.getCurrentMembers() != map.getCurrentMembers() || mapped.getCurrentSize() != map.getCurrentSize()) return false;
+    for(uint64_t i = 0; i < 100000; i++) {
+        auto it = mapped.find(i);
+        if((i % 7 == 0) != (it == nullptr)) return false;
+        if(it && it->data != 3 * i) return false;
+    }
+    // writes land in private copies of the pages; the file is untouched
+    for(uint64_t i = 1; i < 100000; i += 7) mapped.insert(i, 0);
+    for(uint64_t i = 2; i < 100000; i += 7) mapped.deleteNode(i);
+    if(!mapped.isMapped()) return false;
+    HashMap<uint64_t, uint64_t> again;
+    if(!again.openMapped(path, true) || again.find(1)->data != 3 || again.find(2)->data != 6) return false;
+    
+    // growing past the load factor moves the slots back to the heap
+    for(uint64_t i = 100000; i < 200000; i++) mapped.insert(i, i);
+    if(mapped.isMapped()) return false;
+    for(uint64_t i = 0; i < 200000; i++) {
+        auto it = mapped.find(i);
+        uint64_t expected = i >= 100000 ? i : (i % 7 == 1 ? 0 : 3 * i);
+        bool present = i >= 100000 || (i % 7 != 0 && i % 7 != 2);
+        if(present != (it != nullptr) || (it && it->data != expected)) return false;
+    }
+    std::remove(path.c_str());
+    return true;
+}
+
+// Knuth's multiplicative hash: 0 at 0, like std::hash, and nowhere else alike
+struct MultiplicativeHash {
+    size_t operator()(uint64_t key) const {
+        return (size_t) (key * 0x9E3779B97F4A7C15ull);
+    }
+};
+
+struct PointKey {
+    int32_t x, y;
+    
+    bool operator==(const PointKey& other) const {
+        return x == other.x && y == other.y;
+    }
+};
+
+struct PointHash {
+    size_t operator()(const PointKey& p) const {
+        return (size_t) hashing::mix((uint64_t) (uint32_t) p.x << 32 | (uint32_t) p.y);
+    }
+};
+
+bool testSnapshotRejects() {
+    std::string path = snapshotPath("advanceddsa_probing_reject.bin");
+    HashMap<uint64_t, uint64_t> map;
+    if(map.openMapped(snapshotPath("advanceddsa_probing_missing.bin"))) return false;
+    for(uint64_t i = 0; i < 1000; i++) map.insert(i, i);
+    if(!map.save(path)) return false;
+    
+    // another value type, index policy or hash is refused outright
+    HashMap<uint64_t, uint32_t> otherValue;
+    HashMap<uint64_t, uint64_t, hashing::DefaultHash<uint64_t>, hashing::FastRange> otherIndex;
+    HashMap<uint64_t, uint64_t, std::hash<uint64_t>> otherHash;
+    if(otherValue.openMapped(path) || otherIndex.openMapped(path) || otherHash.openMapped(path)) return false;
+    // even one that agrees with the saved hash at the default key
+    HashMap<uint64_t, uint64_t, MultiplicativeHash> multiplicative;
+    for(uint64_t i = 0; i < 1000; i++) multiplicative.insert(i, i);
+    if(!multiplicative.save(path) || otherHash.openMapped(path)) return false;
+    HashMap<uint64_t, uint64_t, MultiplicativeHash> seeded;
+    seeded.setSnapshotHashId(1);
+    if(seeded.openMapped(path) || !map.save(path)) return false;
+    
+    // a flipped byte in the slots is only caught when verifying
+    FILE* file = std::fopen(path.c_str(), "r+b");
+    if(!file) return false;
+    long offset = 64 + 100 * (long) sizeof(Node<uint64_t, uint64_t>);
+    std::fseek(file, offset, SEEK_SET);
+    int byte = std::fgetc(file);
+    std::fseek(file, offset, SEEK_SET);
+    std::fputc(byte ^ 1, file);
+    std::fclose(file);
+    HashMap<uint64_t, uint64_t> corrupt;
+    corrupt.insert(42, 1);
+    if(corrupt.openMapped(path, true)) return false;
+    // and the map keeps what it had
+    if(corrupt.getCurrentMembers() != 1 || corrupt.find(42)->data != 1) return false;
+    if(!corrupt.openMapped(path)) return false;
+    std::remove(path.c_str());
+    return true;
+}
+
+bool testSnapshotHashId() {
+    // the fingerprint can't sample a struct key's hash, so an id has to name it
+    std::string path = snapshotPath("advanceddsa_probing_hashid.bin");
+    HashMap<PointKey, int, PointHash> map;
+    for(int i = 0; i < 1000; i++) map.insert(PointKey{i, -i}, i);
+    if(map.save(path)) return false;
+    map.setSnapshotHashId(7);
+    if(!map.save(path)) return false;
+    HashMap<PointKey, int, PointHash> unnamed, otherId, sameId;
+    otherId.setSnapshotHashId(8);
+    sameId.setSnapshotHashId(7);
+    if(unnamed.openMapped(path) || otherId.openMapped(path) || !sameId.openMapped(path, true)) return false;
+    std::remove(path.c_str());
+    for(int i = 0; i < 1000; i++) {
+        auto it = sameId.find(PointKey{i, -i});
+        if(!it || it->data != i) return false;
+    }
+    return sameId.find(PointKey{1, 1}) == nullptr;
+}
+
+#if defined(HASHMAP_STATS)
+bool testStats() {
+    HashMap<int, int> map;
+    for(int i = 0; i < 1000; i++) {
+        map.insert(i, i);
+    }
+    for(int i = 0; i < 1000; i++) {
+        map.find(i);
+        map.find(-1 - i);
+    }
+    hashing::Stats stats = map.getStats();
+    if(stats.hits != 1000 || stats.misses != 1000) return false;
+    // a hit compares at least the key itself
+    if(stats.averageHitProbes() < 1.0 || stats.rehashes == 0) return false;
+    // one histogram entry per stored key
+    size_t entries = 0;
+    for(size_t count : stats.histogram) {
+        entries += count;
+    }
+    if(entries != map.getCurrentMembers()) return false;
+    map.resetStats();
+    if(map.getStats().hits != 0) return false;
+    return true;
+}
+#endif
+
 void runTests() {
     int count = 0;
-    int total = 5;  // Updated total count
+#if defined(HASHMAP_STATS)
+    int total = 18;
+#else
+    int total = 17;  // Updated total count
+#endif
     
     
     
@@ -247,12 +1471,150 @@ void runTests() {
     tests::test(count, "Testing Duplicate Inserts", testDuplicateInserts);
     tests::test(count, "Testing Reset", testReset);
     tests::test(count, "Testing Size", testSize);
+    tests::test(count, "Testing Power of Two Size", testPowerOfTwoSize);
+    tests::test(count, "Testing Batch Insert and Find", testBatch);
+    tests::test(count, "Testing Delete Churn", testDeleteChurn);
+    tests::test(count, "Testing Swiss Insert and Find", testSwissInsertAndFind);
+    tests::test(count, "Testing Swiss Delete", testSwissDelete);
+    tests::test(count, "Testing Swiss Size", testSwissSize);
+    tests::test(count, "Testing Lock-Free Stress", testLockFreeStress);
+    tests::test(count, "Testing Lock-Free Growth", testLockFreeGrowth);
+    tests::test(count, "Testing Lock-Free Churn", testLockFreeChurn);
+    tests::test(count, "Testing Snapshot Save and Map", testSnapshot);
+    tests::test(count, "Testing Snapshot Rejects", testSnapshotRejects);
+    tests::test(count, "Testing Snapshot Hash Id", testSnapshotHashId);
+#if defined(HASHMAP_STATS)
+    tests::test(count, "Testing Stats", testStats);
+#endif
     
     std::cout << std::string(40, '-') << "\n";
     std::cout << " -- Probing::HashMap: Passed [" << count << "/" << total << "] tests -- " << std::endl;
     std::cout << std::string(40, '-') << "\n\n";
 }
 
+// steady-state trace: every step erases a live key, inserts a fresh one and
+// finds a recent one, which is where tombstones used to pile up
+template <class Map>
+void benchMixed(const char* name, size_t n, size_t steps) {
+    auto keys = bench::uniformKeys(n + steps);
+    Map map;
+    for(size_t i = 0; i < n; i++){
+        map.insert(keys[i], keys[i]);
+    }
+    bench::run(name, 3 * steps, [&]{
+        for(size_t i = 0; i < steps; i++){
+            map.deleteNode(keys[i]);
+            map.insert(keys[n + i], keys[n + i]);
+            bench::doNotOptimize(map.find(keys[n + i / 2]));
+        }
+    });
+}
+
+template <class Index>
+void benchIndex(const char* name, const std::vector<uint64_t>& keys) {
+    HashMap<uint64_t, uint64_t, hashing::DefaultHash<uint64_t>, Index> map;
+    for(auto k : keys){
+        map.insert(k, k);
+    }
+    bench::run(name, keys.size(), [&]{
+        for(auto k : keys) bench::doNotOptimize(map.find(k));
+    });
+}
+
+// restart paths for a table of n entries: rebuilding it one insert at a
+// time against opening a snapshot, then the first lookups on the mapping
+void benchSnapshot(size_t n) {
+    std::string path = snapshotPath("advanceddsa_probing_bench.bin");
+    auto keys = bench::uniformKeys(n);
+    auto millis = [](bench::Clock::time_point start){
+        return std::chrono::duration<double, std::milli>(bench::Clock::now() - start).count();
+    };
+    {
+        auto start = bench::Clock::now();
+        HashMap<uint64_t, uint64_t> map;
+        for(auto k : keys) map.insert(k, k);
+        std::cout << "Running HashMap rebuild by insert [" << n << "] ... " << millis(start) << " ms\n";
+        start = bench::Clock::now();
+        if(!map.save(path)) return;
+        std::cout << "Running HashMap save [" << n << "] ... " << millis(start) << " ms\n";
+    }
+    for(bool verify : {false, true}){
+        auto start = bench::Clock::now();
+        HashMap<uint64_t, uint64_t> map;
+        map.openMapped(path, verify);
+        std::cout << "Running HashMap openMapped" << (verify ? " (verify)" : "") << " [" << n << "] ... " << millis(start) << " ms\n";
+        if(!verify){
+            bench::run("HashMap find on a fresh mapping", n, [&]{
+                for(auto k : keys) bench::doNotOptimize(map.find(k));
+            });
+            bench::run("HashMap find on a warm mapping", n, [&]{
+                for(auto k : keys) bench::doNotOptimize(map.find(k));
+            });
+        }
+    }
+    std::remove(path.c_str());
+}
+
+void runBenchmarks(size_t n = 1000000) {
+    bench::header("Probing::HashMap benchmarks");
+    auto keys = bench::uniformKeys(n);
+    auto misses = bench::uniformKeys(n, 7);
+    
+    {
+        HashMap<uint64_t, uint64_t> map;
+        bench::run("HashMap insert", n, [&]{
+            for(auto k : keys) map.insert(k, k);
+        });
+        bench::run("HashMap find (hit)", n, [&]{
+            for(auto k : keys) bench::doNotOptimize(map.find(k));
+        });
+        bench::run("HashMap find (miss)", n, [&]{
+            for(auto k : misses) bench::doNotOptimize(map.find(k));
+        });
+    }
+    {
+        SwissHashMap<uint64_t, uint64_t> map;
+        bench::run("SwissHashMap insert", n, [&]{
+            for(auto k : keys) map.insert(k, k);
+        });
+        bench::run("SwissHashMap find (hit)", n, [&]{
+            for(auto k : keys) bench::doNotOptimize(map.find(k));
+        });
+        bench::run("SwissHashMap find (miss)", n, [&]{
+            for(auto k : misses) bench::doNotOptimize(map.find(k));
+        });
+    }
+    {
+        std::unordered_map<uint64_t, uint64_t> map;
+        bench::run("std::unordered_map insert", n, [&]{
+            for(auto k : keys) map[k] = k;
+        });
+        bench::run("std::unordered_map find (hit)", n, [&]{
+            for(auto k : keys) bench::doNotOptimize(map.find(k));
+        });
+        bench::run("std::unordered_map find (miss)", n, [&]{
+            for(auto k : misses) bench::doNotOptimize(map.find(k));
+        });
+    }
+    benchIndex<hashing::Modulo>("HashMap find, Modulo index", keys);
+    benchIndex<hashing::PrimeModulo>("HashMap find, PrimeModulo index", keys);
+    benchIndex<hashing::FastRange>("HashMap find, FastRange index", keys);
+    benchIndex<hashing::PowerOfTwo>("HashMap find, PowerOfTwo index", keys);
+    
+    benchMixed<HashMap<uint64_t, uint64_t>>("HashMap mixed insert/erase", n, 4 * n);
+    benchMixed<SwissHashMap<uint64_t, uint64_t>>("SwissHashMap mixed insert/erase", n, 4 * n);
+    
+    // read-mostly scaling; benchmark.cpp runs it against the chaining maps
+    size_t maxThreads = std::max(1u, std::thread::hardware_concurrency());
+    for(int readPercent : {95, 50}){
+        for(size_t threads = 1; threads <= maxThreads; threads *= 2){
+            bench::concurrentMap<ConcurrentHashMap<uint64_t, uint64_t>>("probing::ConcurrentHashMap", threads, readPercent, n, n);
+        }
+    }
+    bench::batchFind<HashMap<uint64_t, uint64_t>>("HashMap", 8 * n);
+    benchSnapshot(8 * n);
+    std::cout << std::string(40, '-') << "\n\n";
+}
 
 }
 
@@ -0,0 +1,278 @@
+//
+//  Hashing.h
+//  AdvancedDSA
+//
+//
+
+#ifndef Hashing_h
+#define Hashing_h
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Hash and index-reduction policies shared by the hash maps. Both are plain
+// template parameters, so the calls inline instead of going through a
+// std::function, and no policy needs an integer division on the hot path.
+
+namespace hashing {
+
+// wyhash-style finalizer: one 64x64->128 multiply, folded back to 64 bits
+constexpr uint64_t mix(uint64_t x, uint64_t seed = 0) {
+#if defined(__SIZEOF_INT128__)
+    __uint128_t r = (__uint128_t) (x ^ seed ^ 0x2d358dccaa6c78a5ULL) * 0x8bb84b93962eacc9ULL;
+    return (uint64_t) (r >> 64) ^ (uint64_t) r;
+#else
+    x ^= seed;
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+#endif
+}
+
+// hint that addr will be read soon; a no-op where the builtin is missing
+inline void prefetch(const void* addr) {
+#if defined(__GNUC__) || defined(__clang__)
+    __builtin_prefetch(addr, 0, 3);
+#else
+    (void) addr;
+#endif
+}
+
+// checksum of a byte range, for snapshot files: four lanes of 8-byte words
+// run independently, so it is not bound by one multiply's latency per word
+inline uint64_t checksum(const void* data, size_t n) {
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    uint64_t lanes[4] = {1, 2, 3, 4};
+    size_t i = 0;
+    for(; i + 32 <= n; i += 32){
+        for(size_t j = 0; j < 4; j++){
+            uint64_t word;
+            std::memcpy(&word, bytes + i + 8 * j, sizeof(word));
+            lanes[j] = mix(lanes[j] ^ word, j);
+        }
+    }
+    uint64_t result = mix(n);
+    for(size_t j = 0; j < 4; j++){
+        result = mix(result ^ lanes[j], j);
+    }
+    for(; i < n; i++){
+        result = mix(result ^ bytes[i]);
+    }
+    return result;
+}
+
+// keys resolved together by the batched map operations: enough misses in
+// flight to hide memory latency without spilling the per-batch state
+constexpr size_t BATCH_SIZE = 16;
+
+// std::hash is the identity for integers, which clusters badly once the
+// index is taken from the low bits, so integers are mixed instead
+template <class K, class Enable = void>
+struct DefaultHash {
+    size_t operator()(const K& key) const {
+        return std::hash<K>()(key);
+    }
+};
+
+template <class K>
+struct DefaultHash<K, typename std::enable_if<std::is_integral<K>::value || std::is_enum<K>::value>::type> {
+    size_t operator()(K key) const {
+        return (size_t) mix((uint64_t) key);
+    }
+};
+
+// Index policies turn a hash into a bucket index for their capacity.
+// capacity() is the table size to allocate, grown() the policy for the
+// next (roughly doubled) table.
+
+// capacities are powers of two and the index is a bit mask
+class PowerOfTwo {
+    size_t mask;
+
+public:
+    explicit PowerOfTwo(size_t requested = 1) {
+        size_t capacity = 1;
+        while(capacity < requested){
+            capacity <<= 1;
+        }
+        mask = capacity - 1;
+    }
+
+    size_t capacity() const {
+        return mask + 1;
+    }
+
+    size_t index(size_t hash) const {
+        return hash & mask;
+    }
+
+    PowerOfTwo grown() const {
+        return PowerOfTwo(2 * capacity());
+    }
+};
+
+// Lemire's fastrange: any capacity, the index is the high half of hash * capacity.
+// It uses the high bits of the hash, so pair it with a mixing hash.
+class FastRange {
+    size_t size;
+
+public:
+    explicit FastRange(size_t requested = 1): size(requested ? requested : 1) {}
+
+    size_t capacity() const {
+        return size;
+    }
+
+    size_t index(size_t hash) const {
+#if defined(__SIZEOF_INT128__)
+        return (size_t) (((__uint128_t) hash * (__uint128_t) size) >> 64);
+#else
+        return hash % size;
+#endif
+    }
+
+    FastRange grown() const {
+        return FastRange(2 * size);
+    }
+};
+
+// prime capacities, each reduced through a function with the divisor baked
+// in as a constant, which compiles to a multiply and shift instead of a div
+class PrimeModulo {
+    static const size_t COUNT = 40;
+
+    static constexpr size_t PRIMES[COUNT] = {
+        5ul, 11ul, 23ul, 53ul, 97ul, 193ul, 389ul, 769ul, 1543ul, 3079ul,
+        6151ul, 12289ul, 24593ul, 49157ul, 98317ul, 196613ul, 393241ul, 786433ul, 1572869ul, 3145739ul,
+        6291469ul, 12582917ul, 25165843ul, 50331653ul, 100663319ul, 201326611ul, 402653189ul, 805306457ul, 1610612741ul, 3221225473ul,
+        6442450939ul, 12884901893ul, 25769803799ul, 51539607551ul, 103079215111ul, 206158430209ul, 412316860441ul, 824633720831ul, 1649267441651ul, 3298534883309ul
+    };
+
+    template <size_t I>
+    static size_t mod(size_t hash) {
+        return hash % PRIMES[I];
+    }
+
+    template <size_t... I>
+    static constexpr auto modTable(std::index_sequence<I...>) {
+        return std::array<size_t (*)(size_t), COUNT>{ &mod<I>... };
+    }
+
+    size_t prime;
+
+    explicit PrimeModulo(size_t primeIndex, bool): prime(primeIndex) {}
+
+public:
+    explicit PrimeModulo(size_t requested = 1): prime(0) {
+        while(prime + 1 < COUNT && PRIMES[prime] < requested){
+            prime += 1;
+        }
+    }
+
+    size_t capacity() const {
+        return PRIMES[prime];
+    }
+
+    size_t index(size_t hash) const {
+        static constexpr auto MODS = modTable(std::make_index_sequence<COUNT>());
+        return MODS[prime](hash);
+    }
+
+    PrimeModulo grown() const {
+        return PrimeModulo(prime + 1 < COUNT ? prime + 1 : prime, true);
+    }
+};
+
+// the plain modulo the maps used before the policies, kept for comparison
+class Modulo {
+    size_t size;
+
+public:
+    explicit Modulo(size_t requested = 1): size(requested ? requested : 1) {}
+
+    size_t capacity() const {
+        return size;
+    }
+
+    size_t index(size_t hash) const {
+        return hash % size;
+    }
+
+    Modulo grown() const {
+        return Modulo(2 * size);
+    }
+};
+
+// Structural statistics, compiled in with -DHASHMAP_STATS. Without the flag
+// the counters are not members of the maps and HASHMAP_STAT(...) expands to
+// nothing, so the default build pays nothing for them.
+#if defined(HASHMAP_STATS)
+#define HASHMAP_STAT(statement) do { statement; } while(0)
+#else
+#define HASHMAP_STAT(statement) do {} while(0)
+#endif
+
+struct Stats {
+    // histogram bins; the last one also counts everything longer
+    static const size_t BINS = 32;
+    
+    // lookups through find/findBatch, and the slots or nodes they compared
+    uint64_t hits, hitProbes;
+    uint64_t misses, missProbes;
+    
+    uint64_t rehashes, rehashNanos;
+    
+    // probing: entries per probe distance; chaining: buckets per chain length
+    std::vector<size_t> histogram;
+    
+    Stats(): hits(0), hitProbes(0), misses(0), missProbes(0), rehashes(0), rehashNanos(0), histogram(BINS, 0) {}
+    
+    void recordFind(bool found, size_t probes) {
+        if(found){
+            hits += 1;
+            hitProbes += probes;
+        }else{
+            misses += 1;
+            missProbes += probes;
+        }
+    }
+    
+    void addToHistogram(size_t length) {
+        histogram[std::min(length, BINS - 1)] += 1;
+    }
+    
+    double averageHitProbes() const {
+        return hits ? (double) hitProbes / (double) hits : 0.0;
+    }
+    
+    double averageMissProbes() const {
+        return misses ? (double) missProbes / (double) misses : 0.0;
+    }
+};
+
+// adds the lifetime of the scope to total, in nanoseconds
+class ScopedTimer {
+    uint64_t& total;
+    std::chrono::steady_clock::time_point start;
+    
+public:
+    explicit ScopedTimer(uint64_t& counter): total(counter), start(std::chrono::steady_clock::now()) {}
+    
+    ~ScopedTimer() {
+        total += (uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    }
+};
+
+}
+
+#endif /* Hashing_h */
@@ -8,47 +8,181 @@
 #ifndef LinkedList_h
 #define LinkedList_h
 
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <list>
 #include <memory>
+#include <new>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
 #include "Testing.h"
+#include "Benchmark.h"
 
 namespace linkedlist {
 
+template <typename K, typename T>
+struct Node;
+
+template <typename K, typename T>
+class NodePool;
+
+// nodes from a pool go back to it, nodes without one go back to the heap
+template <typename K, typename T>
+struct NodeDeleter {
+    void operator()(Node<K, T>* node) const;
+};
+
+template <typename K, typename T>
+using NodePtr = std::unique_ptr<Node<K, T>, NodeDeleter<K, T>>;
+
 template <typename K, typename T>
 struct Node {
     K key;
     T data;
-    std::unique_ptr<Node<K, T>> next;
-    Node(K k, T d): key(k), data(d), next(nullptr) {}
+    NodePtr<K, T> next;
+    NodePool<K, T>* pool;
+    Node(K k, T d, NodePool<K, T>* p = nullptr): key(k), data(d), next(nullptr), pool(p) {}
+};
+
+// hands out nodes from fixed-size slabs and keeps freed nodes on a freelist,
+// so a map allocates once per SLAB_SIZE nodes instead of once per insert
+template <typename K, typename T>
+class NodePool {
+    static const size_t SLAB_SIZE = 1024;
+    
+    union Cell {
+        Cell* nextFree;
+        alignas(Node<K, T>) unsigned char storage[sizeof(Node<K, T>)];
+    };
+    
+    std::vector<std::unique_ptr<Cell[]>> slabs;
+    Cell* freeList;
+    size_t slabUsed;
+    
+public:
+    NodePool(): freeList(nullptr), slabUsed(SLAB_SIZE) {}
+    NodePool(const NodePool&) = delete;
+    NodePool& operator=(const NodePool&) = delete;
+    
+    size_t getSlabCount(){
+        return slabs.size();
+    }
+    
+    Node<K, T>* acquire(K key, T data){
+        Cell* cell;
+        if(freeList){
+            cell = freeList;
+            freeList = freeList->nextFree;
+        }else{
+            if(slabUsed == SLAB_SIZE){
+                slabs.push_back(std::unique_ptr<Cell[]>(new Cell[SLAB_SIZE]));
+                slabUsed = 0;
+            }
+            cell = &slabs.back()[slabUsed];
+            slabUsed += 1;
+        }
+        return new (cell->storage) Node<K, T>(key, data, this);
+    }
+    
+    void release(Node<K, T>* node){
+        node->~Node();
+        Cell* cell = reinterpret_cast<Cell*>(node);
+        cell->nextFree = freeList;
+        freeList = cell;
+    }
 };
 
+template <typename K, typename T>
+void NodeDeleter<K, T>::operator()(Node<K, T>* node) const {
+    if(node->pool){
+        node->pool->release(node);
+    }else{
+        delete node;
+    }
+}
+
+// a list is just its head pointer; buckets of a map stay one word each,
+// so the node pool is passed to insert rather than stored per list
 template <typename K, typename T>
 class LinkedList{
-    std::unique_ptr<Node<K, T>> head;
+    NodePtr<K, T> head;
+    
+    static NodePtr<K, T> makeNode(K key, T data, NodePool<K, T>* pool){
+        if(pool){
+            return NodePtr<K, T>(pool->acquire(key, data));
+        }
+        return NodePtr<K, T>(new Node<K, T>(key, data));
+    }
     
 public:
+    LinkedList() = default;
+
+    LinkedList(LinkedList&& other) noexcept: head(std::move(other.head)) {}
+
+    LinkedList& operator=(LinkedList&& other) noexcept {
+        if(this != &other){
+            clear();
+            head = std::move(other.head);
+        }
+        return *this;
+    }
+
+    ~LinkedList(){
+        clear();
+    }
+
+    // Frees the nodes front to back. Left to the unique_ptr chain, every
+    // node's destructor would call the next one's, one stack frame per
+    // node, which overflows the stack on lists of a few million.
+    void clear(){
+        while(head){
+            head = std::move(head->next);
+        }
+    }
     
     Node<K, T>* getHead(){
         return head.get();
     }
     
-    bool insert(K key, T data) {
+    // unlinks the first node without freeing it
+    NodePtr<K, T> popFront(){
+        NodePtr<K, T> node = std::move(head);
+        if(node){
+            head = std::move(node->next);
+        }
+        return node;
+    }
+    
+    // links an existing node in at the front, no allocation or copy
+    void pushFront(NodePtr<K, T> node){
+        node->next = std::move(head);
+        head = std::move(node);
+    }
+    
+    // new nodes come from pool when given; the pool has to outlive them
+    bool insert(K key, T data, NodePool<K, T>* pool = nullptr) {
         if(!head){
-            head = std::make_unique<Node<K, T>>(key, data);
+            head = makeNode(key, data, pool);
             return true;
         }
         
-        auto it = find(key);
-        if(it){
-            // key already exists, replace the value
-            it->data = data;
-            return false;
-        }
-        
+        // one walk both looks for the key and finds the last node
         auto temp = head.get();
-        while(temp->next){
+        while(true){
+            if(temp->key == key){
+                // key already exists, replace the value
+                temp->data = data;
+                return false;
+            }
+            if(!temp->next){
+                break;
+            }
             temp = temp->next.get();
         }
-        temp->next = std::make_unique<Node<K, T>>(key, data);
+        temp->next = makeNode(key, data, pool);
         return true;
     }
     
@@ -66,7 +200,20 @@ public:
         }
         return nullptr;
     };
-    
+
+    // same search, adding the number of nodes compared to probes
+    Node<K, T>* find(K key, size_t& probes) {
+        auto temp = head.get();
+        while(temp){
+            probes += 1;
+            if(temp->key == key){
+                return temp;
+            }
+            temp = temp->next.get();
+        }
+        return nullptr;
+    }
+
     // delete by key, returns status if deleted or not
     bool deleteNodeKey(K key){
         if(!head){
@@ -129,6 +276,180 @@ public:
     }
 };
 
+// An unrolled list: entries are packed several to a chunk, keys apart from
+// values so a search reads keys only, and a chunk is CHUNK_BYTES (a cache
+// line unless asked otherwise). A walk takes one miss per chunk rather
+// than one per entry. Entries stay in insertion order, a tail pointer
+// makes append O(1), and a chunk left with room for its successor's
+// entries after a delete takes them in, so chunks stay about half full.
+template <typename K, typename T, size_t CHUNK_BYTES = 64>
+class UnrolledList {
+    static constexpr size_t HEADER = sizeof(void*) + sizeof(uint32_t);
+    static constexpr size_t CAPACITY = CHUNK_BYTES >= HEADER + sizeof(K) + sizeof(T)
+        ? (CHUNK_BYTES - HEADER) / (sizeof(K) + sizeof(T)) : 1;
+
+    struct alignas(64) Chunk {
+        K keys[CAPACITY];
+        T data[CAPACITY];
+        Chunk* next;
+        uint32_t count;
+    };
+
+    // chunks are linked by plain pointers and freed in a loop
+    Chunk* head;
+    Chunk* tail;
+    size_t currentMembers;
+    size_t chunkCount;
+
+public:
+    UnrolledList(): head(nullptr), tail(nullptr), currentMembers(0), chunkCount(0) {}
+
+    UnrolledList(const UnrolledList&) = delete;
+    UnrolledList& operator=(const UnrolledList&) = delete;
+
+    UnrolledList(UnrolledList&& other) noexcept: head(other.head), tail(other.tail), currentMembers(other.currentMembers), chunkCount(other.chunkCount) {
+        other.head = other.tail = nullptr;
+        other.currentMembers = other.chunkCount = 0;
+    }
+
+    UnrolledList& operator=(UnrolledList&& other) noexcept {
+        if(this != &other){
+            clear();
+            std::swap(head, other.head);
+            std::swap(tail, other.tail);
+            std::swap(currentMembers, other.currentMembers);
+            std::swap(chunkCount, other.chunkCount);
+        }
+        return *this;
+    }
+
+    ~UnrolledList(){
+        clear();
+    }
+
+    void clear(){
+        while(head){
+            Chunk* next = head->next;
+            delete head;
+            head = next;
+        }
+        tail = nullptr;
+        currentMembers = 0;
+        chunkCount = 0;
+    }
+
+    size_t getCurrentMembers(){
+        return currentMembers;
+    }
+
+    size_t getChunkCount(){
+        return chunkCount;
+    }
+
+    static constexpr size_t getChunkCapacity(){
+        return CAPACITY;
+    }
+
+    // Replaces the value if key is there and returns false, else appends.
+    // One walk: a search that fails has reached the tail anyway.
+    bool insert(K key, T data){
+        if(T* found = find(key)){
+            *found = data;
+            return false;
+        }
+        append(key, data);
+        return true;
+    }
+
+    // adds at the end without looking for key first, in O(1); for keys the
+    // caller knows are new
+    void append(K key, T data){
+        if(!tail || tail->count == CAPACITY){
+            Chunk* chunk = new Chunk();
+            chunk->next = nullptr;
+            chunk->count = 0;
+            if(tail){
+                tail->next = chunk;
+            }else{
+                head = chunk;
+            }
+            tail = chunk;
+            chunkCount += 1;
+        }
+        tail->keys[tail->count] = key;
+        tail->data[tail->count] = data;
+        tail->count += 1;
+        currentMembers += 1;
+    }
+
+    // the value stored under key, or nullptr
+    T* find(K key){
+        for(Chunk* chunk = head; chunk; chunk = chunk->next){
+            for(uint32_t i = 0; i < chunk->count; i++){
+                if(chunk->keys[i] == key){
+                    return &chunk->data[i];
+                }
+            }
+        }
+        return nullptr;
+    }
+
+    bool deleteNodeKey(K key){
+        Chunk* prev = nullptr;
+        for(Chunk* chunk = head; chunk; prev = chunk, chunk = chunk->next){
+            for(uint32_t i = 0; i < chunk->count; i++){
+                if(!(chunk->keys[i] == key)){
+                    continue;
+                }
+                for(uint32_t j = i + 1; j < chunk->count; j++){
+                    chunk->keys[j - 1] = std::move(chunk->keys[j]);
+                    chunk->data[j - 1] = std::move(chunk->data[j]);
+                }
+                chunk->count -= 1;
+                currentMembers -= 1;
+                if(chunk->count == 0){
+                    unlink(prev, chunk);
+                }else if(chunk->next && chunk->count + chunk->next->count <= CAPACITY){
+                    Chunk* next = chunk->next;
+                    for(uint32_t j = 0; j < next->count; j++){
+                        chunk->keys[chunk->count] = std::move(next->keys[j]);
+                        chunk->data[chunk->count] = std::move(next->data[j]);
+                        chunk->count += 1;
+                    }
+                    unlink(chunk, next);
+                }
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // calls f(key, value) on every entry in order
+    template <class F>
+    void forEach(F&& f){
+        for(Chunk* chunk = head; chunk; chunk = chunk->next){
+            for(uint32_t i = 0; i < chunk->count; i++){
+                f(chunk->keys[i], chunk->data[i]);
+            }
+        }
+    }
+
+private:
+    // frees chunk, which follows prev (or is the head when prev is null)
+    void unlink(Chunk* prev, Chunk* chunk){
+        if(prev){
+            prev->next = chunk->next;
+        }else{
+            head = chunk->next;
+        }
+        if(tail == chunk){
+            tail = prev;
+        }
+        delete chunk;
+        chunkCount -= 1;
+    }
+};
+
 // Tests for LinkedList
 
 bool testInsertAndFind() {
@@ -188,11 +509,102 @@ bool testEmptyListOperations() {
     return true;
 }
 
+bool testPooledNodes() {
+    NodePool<int, int> pool;
+    LinkedList<int, int> linkedList;
+    
+    for(int round = 0; round < 10; round++) {
+        for(int i = 0; i < 1000; i++) {
+            linkedList.insert(i, i, &pool);
+        }
+        if(linkedList.find(999)->data != 999) return false;
+        for(int i = 0; i < 1000; i++) {
+            if(linkedList.deleteNodeKey(i) != true) return false;
+        }
+    }
+    // freed nodes are reused, so ten rounds still fit in a single slab
+    return pool.getSlabCount() == 1;
+}
+
+bool testLongListDestruction() {
+    // a recursive destructor would need a stack frame per node here
+    LinkedList<int, int> linkedList;
+    for(int i = 0; i < 5000000; i++) {
+        linkedList.pushFront(NodePtr<int, int>(new Node<int, int>(i, i)));
+    }
+    if(linkedList.getHead()->key != 4999999) return false;
+    LinkedList<int, int> moved(std::move(linkedList));
+    linkedList = std::move(moved);
+    linkedList.clear();
+    UnrolledList<int, int> unrolled;
+    for(int i = 0; i < 5000000; i++) {
+        unrolled.append(i, i);
+    }
+    return linkedList.getHead() == nullptr && unrolled.getCurrentMembers() == 5000000;
+}
+
+bool testUnrolledList() {
+    UnrolledList<int, std::string> list;
+    std::vector<std::pair<int, std::string>> reference;
+    std::mt19937 rng(12);
+    for(int i = 0; i < 20000; i++) {
+        int key = (int) (rng() % 300);
+        auto it = std::find_if(reference.begin(), reference.end(), [&](const std::pair<int, std::string>& p){ return p.first == key; });
+        if(rng() % 3 == 0) {
+            if(list.deleteNodeKey(key) != (it != reference.end())) return false;
+            if(it != reference.end()) reference.erase(it);
+        } else {
+            std::string value = std::to_string(i);
+            if(list.insert(key, value) != (it == reference.end())) return false;
+            if(it == reference.end()) reference.push_back({key, value});
+            else it->second = value;
+        }
+    }
+    // insertion order survives deletes and merges
+    std::vector<std::pair<int, std::string>> seen;
+    list.forEach([&](int key, const std::string& value){ seen.push_back({key, value}); });
+    if(seen != reference || list.getCurrentMembers() != reference.size()) return false;
+    for(auto& entry : reference) {
+        if(!list.find(entry.first) || *list.find(entry.first) != entry.second) return false;
+    }
+    // chunks stay at least half full on average
+    size_t capacity = UnrolledList<int, std::string>::getChunkCapacity();
+    if(list.getChunkCount() > 2 * reference.size() / capacity + 1) return false;
+    for(auto& entry : reference) {
+        if(!list.deleteNodeKey(entry.first)) return false;
+    }
+    if(list.getChunkCount() != 0 || list.find(reference.front().first)) return false;
+    list.insert(1, "one");
+    return *list.find(1) == "one";
+}
+
+bool testUnrolledAppend() {
+    UnrolledList<uint64_t, uint64_t> list;
+    const size_t capacity = UnrolledList<uint64_t, uint64_t>::getChunkCapacity();
+    for(uint64_t i = 0; i < 10000; i++) {
+        list.append(i, 2 * i);
+    }
+    // every chunk but the last is full
+    if(list.getChunkCount() != (10000 + capacity - 1) / capacity) return false;
+    // deleting the tail's entries moves the tail back, and appends go on there
+    for(uint64_t i = 9990; i < 10000; i++) {
+        if(!list.deleteNodeKey(i)) return false;
+    }
+    list.append(20000, 1);
+    uint64_t expected = 0;
+    bool ordered = true;
+    list.forEach([&](uint64_t key, uint64_t value){
+        if(expected == 9990) expected = 20000;
+        if(key != expected || (key != 20000 && value != 2 * key)) ordered = false;
+        expected += 1;
+    });
+    return ordered && list.getCurrentMembers() == 9991 && *list.find(20000) == 1;
+}
 
 void runTests() {
     
     int count = 0;
-    int total = 5;
+    int total = 9;
     
     
     
@@ -201,12 +613,99 @@ void runTests() {
     tests::test(count, "Delete by Value Test", testDeleteByValue);
     tests::test(count, "Insert Duplicates Test", testInsertDuplicates);
     tests::test(count, "Empty List Test", testEmptyListOperations);
+    tests::test(count, "Pooled Nodes Test", testPooledNodes);
+    tests::test(count, "Long List Destruction Test", testLongListDestruction);
+    tests::test(count, "Unrolled List Test", testUnrolledList);
+    tests::test(count, "Unrolled Append Test", testUnrolledAppend);
     
     std::cout << std::string(40, '-') << "\n";
     std::cout << " -- LinkedList: Passed [" << count << "/" << total << "] tests -- " << std::endl;
     std::cout << std::string(40, '-') << "\n\n";
 }
 
+// Insert (a search, then an append) over `searched` fresh keys, which is
+// quadratic, then appends, full traversals and teardown over n entries, for
+// LinkedList, UnrolledList at one and four cache lines per chunk, and
+// std::list.
+template <class List>
+void benchUnrolled(const char* name, const std::vector<uint64_t>& keys, size_t searched) {
+    std::string prefix = name;
+    {
+        List list;
+        bench::run((prefix + " insert").c_str(), searched, [&]{
+            for(size_t i = 0; i < searched; i++) list.insert(keys[i], i);
+        });
+    }
+    List* list = new List();
+    bench::run((prefix + " append").c_str(), keys.size(), [&]{
+        for(size_t i = 0; i < keys.size(); i++) list->append(keys[i], i);
+    });
+    bench::run((prefix + " traversal").c_str(), keys.size(), [&]{
+        uint64_t sum = 0;
+        list->forEach([&](uint64_t, uint64_t value){ sum += value; });
+        bench::doNotOptimize(sum);
+    });
+    std::cout << "  chunks: " << list->getChunkCount() << " of " << List::getChunkCapacity() << " entries\n";
+    bench::run((prefix + " destroy").c_str(), keys.size(), [&]{
+        delete list;
+    });
+}
+
+void runBenchmarks(size_t n = 1000000, size_t searched = 20000) {
+    bench::header("LinkedList benchmarks");
+    auto keys = bench::uniformKeys(n);
+    searched = std::min(searched, n);
+    {
+        LinkedList<uint64_t, uint64_t> list;
+        bench::run("LinkedList insert", searched, [&]{
+            for(size_t i = 0; i < searched; i++) list.insert(keys[i], i);
+        });
+    }
+    {
+        // LinkedList has no tail, so the O(1) build is at the front
+        LinkedList<uint64_t, uint64_t>* list = new LinkedList<uint64_t, uint64_t>();
+        bench::run("LinkedList pushFront", n, [&]{
+            for(size_t i = n; i-- > 0;) list->pushFront(NodePtr<uint64_t, uint64_t>(new Node<uint64_t, uint64_t>(keys[i], i)));
+        });
+        bench::run("LinkedList traversal", n, [&]{
+            uint64_t sum = 0;
+            for(auto node = list->getHead(); node; node = node->next.get()) sum += node->data;
+            bench::doNotOptimize(sum);
+        });
+        bench::run("LinkedList destroy", n, [&]{
+            delete list;
+        });
+    }
+    benchUnrolled<UnrolledList<uint64_t, uint64_t>>("UnrolledList<64B>", keys, searched);
+    benchUnrolled<UnrolledList<uint64_t, uint64_t, 256>>("UnrolledList<256B>", keys, searched);
+    {
+        using Entry = std::pair<uint64_t, uint64_t>;
+        {
+            std::list<Entry> list;
+            bench::run("std::list insert", searched, [&]{
+                for(size_t i = 0; i < searched; i++){
+                    auto it = std::find_if(list.begin(), list.end(), [&](const Entry& e){ return e.first == keys[i]; });
+                    if(it == list.end()) list.push_back({keys[i], i});
+                    else it->second = i;
+                }
+            });
+        }
+        std::list<Entry>* list = new std::list<Entry>();
+        bench::run("std::list push_back", n, [&]{
+            for(size_t i = 0; i < n; i++) list->push_back({keys[i], i});
+        });
+        bench::run("std::list traversal", n, [&]{
+            uint64_t sum = 0;
+            for(const Entry& e : *list) sum += e.second;
+            bench::doNotOptimize(sum);
+        });
+        bench::run("std::list destroy", n, [&]{
+            delete list;
+        });
+    }
+    std::cout << std::string(40, '-') << "\n\n";
+}
+
 
 
 
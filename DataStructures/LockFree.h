@@ -0,0 +1,639 @@
+//
+//  LockFree.h
+//  AdvancedDSA
+//
+//
+
+#ifndef LockFree_h
+#define LockFree_h
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Testing.h"
+#include "Benchmark.h"
+#include "Reclamation.h"
+
+// Lock-free work queues: a Michael-Scott MPMC queue and a Treiber stack,
+// both on hazard pointers, and a bounded ring for a single producer and a
+// single consumer. Threads using the queue or the stack each hold a Handle.
+
+namespace lockfree {
+
+// Nodes for the queue and the stack, like linkedlist::NodePool: slabs that
+// only go back to the heap with the pool, and a freelist of nodes to reuse,
+// so once the pool has grown to the working set nothing is allocated. The
+// freelist is a stack of node indices whose head carries a 32-bit tag,
+// bumped on every change, so a pop that raced with a pop and a push of the
+// same node fails its CAS instead of corrupting the list. Slabs are
+// installed into a fixed directory, so a node's address never changes and
+// any index ever handed out stays readable.
+template <class NodeT>
+class NodePool {
+    static const uint32_t SLAB_BITS = 12;
+    static const uint32_t SLAB_SIZE = 1u << SLAB_BITS;
+    static const uint32_t MAX_SLABS = 4096;
+
+    std::unique_ptr<std::atomic<NodeT*>[]> slabs;
+    // tag in the high half, index in the low half; index 0 means empty
+    alignas(64) std::atomic<uint64_t> freeHead;
+    alignas(64) std::atomic<uint32_t> used;
+
+    NodeT* at(uint32_t i){
+        return slabs[i >> SLAB_BITS].load(std::memory_order_acquire) + (i & (SLAB_SIZE - 1));
+    }
+
+    // every thread that takes the first index of a slab, or finds the slab
+    // missing, races to install one; the losers free theirs
+    NodeT* slabFor(uint32_t i){
+        std::atomic<NodeT*>& slot = slabs[i >> SLAB_BITS];
+        NodeT* slab = slot.load(std::memory_order_acquire);
+        if(!slab){
+            NodeT* fresh = new NodeT[SLAB_SIZE];
+            uint32_t base = i & ~(SLAB_SIZE - 1);
+            for(uint32_t j = 0; j < SLAB_SIZE; j++){
+                fresh[j].index = base + j;
+            }
+            if(slot.compare_exchange_strong(slab, fresh, std::memory_order_acq_rel)){
+                slab = fresh;
+            }else{
+                delete[] fresh;
+            }
+        }
+        return slab + (i & (SLAB_SIZE - 1));
+    }
+
+public:
+    NodePool(): slabs(new std::atomic<NodeT*>[MAX_SLABS]), freeHead(0), used(1) {
+        for(uint32_t i = 0; i < MAX_SLABS; i++){
+            slabs[i].store(nullptr, std::memory_order_relaxed);
+        }
+    }
+
+    NodePool(const NodePool&) = delete;
+    NodePool& operator=(const NodePool&) = delete;
+
+    ~NodePool(){
+        for(uint32_t i = 0; i < MAX_SLABS; i++){
+            delete[] slabs[i].load(std::memory_order_relaxed);
+        }
+    }
+
+    // nodes ever handed out, so the most the pool has had in use at once
+    size_t getNodeCount(){
+        return used.load(std::memory_order_relaxed) - 1;
+    }
+
+    // throws std::length_error past MAX_SLABS * SLAB_SIZE nodes
+    NodeT* acquire(){
+        uint64_t head = freeHead.load(std::memory_order_acquire);
+        while((uint32_t) head){
+            // the node may be taken by now, but its slab is still there
+            uint32_t next = at((uint32_t) head)->freeNext.load(std::memory_order_relaxed);
+            uint64_t replaced = ((head >> 32) + 1) << 32 | next;
+            if(freeHead.compare_exchange_weak(head, replaced, std::memory_order_acquire, std::memory_order_acquire)){
+                return at((uint32_t) head);
+            }
+        }
+        uint32_t i = used.fetch_add(1, std::memory_order_relaxed);
+        if(i >= MAX_SLABS * SLAB_SIZE){
+            used.fetch_sub(1, std::memory_order_relaxed);
+            throw std::length_error("lockfree::NodePool: out of nodes");
+        }
+        return slabFor(i);
+    }
+
+    void release(NodeT* node){
+        uint64_t head = freeHead.load(std::memory_order_relaxed);
+        while(true){
+            node->freeNext.store((uint32_t) head, std::memory_order_relaxed);
+            uint64_t replaced = ((head >> 32) + 1) << 32 | node->index;
+            if(freeHead.compare_exchange_weak(head, replaced, std::memory_order_release, std::memory_order_relaxed)){
+                return;
+            }
+        }
+    }
+
+    // for HazardDomain::retire
+    static void recycle(void* pool, void* node){
+        static_cast<NodePool*>(pool)->release(static_cast<NodeT*>(node));
+    }
+};
+
+template <class T>
+struct Node {
+    std::atomic<Node*> next{nullptr};
+    T value{};
+    uint32_t index = 0;
+    std::atomic<uint32_t> freeNext{0};
+};
+
+// Michael-Scott queue. head points at a dummy node whose successor is the
+// front; enqueue links at the tail, and any thread that finds tail lagging
+// behind the last node swings it forward first, so nobody waits on a
+// stalled enqueuer. A dequeuer protects the head and its successor with
+// hazards, copies the value out and retires the old dummy.
+template <class T>
+class MSQueue {
+    using NodeT = Node<T>;
+
+    alignas(64) std::atomic<NodeT*> head;
+    alignas(64) std::atomic<NodeT*> tail;
+    // declared before the hazards so retired nodes can still go back to it
+    NodePool<NodeT> pool;
+    reclaim::HazardDomain hazards;
+
+public:
+    MSQueue(){
+        NodeT* dummy = pool.acquire();
+        head.store(dummy, std::memory_order_relaxed);
+        tail.store(dummy, std::memory_order_relaxed);
+    }
+
+    MSQueue(const MSQueue&) = delete;
+    MSQueue& operator=(const MSQueue&) = delete;
+
+    size_t getNodeCount(){
+        return pool.getNodeCount();
+    }
+
+    // A thread's hazard record, claimed for as long as the Handle lives.
+    class Handle {
+        MSQueue& queue;
+        size_t id;
+
+    public:
+        // throws std::length_error past HazardDomain::MAX_THREADS handles
+        explicit Handle(MSQueue& q): queue(q), id(q.hazards.claim()) {}
+
+        Handle(const Handle&) = delete;
+        Handle& operator=(const Handle&) = delete;
+
+        ~Handle(){
+            queue.hazards.unclaim(id);
+        }
+
+        void enqueue(const T& value){
+            NodeT* node = queue.pool.acquire();
+            node->value = value;
+            node->next.store(nullptr, std::memory_order_relaxed);
+            while(true){
+                NodeT* last = queue.hazards.protect(id, 0, queue.tail);
+                NodeT* next = last->next.load(std::memory_order_acquire);
+                if(last != queue.tail.load(std::memory_order_acquire)){
+                    continue;
+                }
+                if(next){
+                    queue.tail.compare_exchange_weak(last, next, std::memory_order_release, std::memory_order_relaxed);
+                    continue;
+                }
+                if(last->next.compare_exchange_weak(next, node, std::memory_order_release, std::memory_order_relaxed)){
+                    queue.tail.compare_exchange_strong(last, node, std::memory_order_release, std::memory_order_relaxed);
+                    break;
+                }
+            }
+            queue.hazards.clear(id, 0);
+        }
+
+        // returns false if the queue was empty
+        bool dequeue(T& out){
+            while(true){
+                NodeT* first = queue.hazards.protect(id, 0, queue.head);
+                NodeT* last = queue.tail.load(std::memory_order_acquire);
+                NodeT* next = first->next.load(std::memory_order_acquire);
+                // next cannot have been retired if first is still the head
+                queue.hazards.set(id, 1, next);
+                if(first != queue.head.load(std::memory_order_seq_cst)){
+                    continue;
+                }
+                if(!next){
+                    queue.hazards.clear(id, 0);
+                    queue.hazards.clear(id, 1);
+                    return false;
+                }
+                if(first == last){
+                    queue.tail.compare_exchange_weak(last, next, std::memory_order_release, std::memory_order_relaxed);
+                    continue;
+                }
+                // copied before the CAS: once next is the dummy, its value
+                // may be overwritten as soon as it is dequeued in turn
+                T value = next->value;
+                if(queue.head.compare_exchange_strong(first, next, std::memory_order_acq_rel, std::memory_order_relaxed)){
+                    out = std::move(value);
+                    queue.hazards.clear(id, 0);
+                    queue.hazards.clear(id, 1);
+                    queue.hazards.retire(id, first, NodePool<NodeT>::recycle, &queue.pool);
+                    return true;
+                }
+            }
+        }
+    };
+};
+
+// Treiber stack. push needs no hazard, since it never reads another
+// thread's node; pop protects the top so that the node it reads next from
+// cannot be recycled and pushed back in between, which is what would let
+// its CAS succeed on a stale next.
+template <class T>
+class TreiberStack {
+    using NodeT = Node<T>;
+
+    alignas(64) std::atomic<NodeT*> top;
+    NodePool<NodeT> pool;
+    reclaim::HazardDomain hazards;
+
+public:
+    TreiberStack(): top(nullptr) {}
+
+    TreiberStack(const TreiberStack&) = delete;
+    TreiberStack& operator=(const TreiberStack&) = delete;
+
+    size_t getNodeCount(){
+        return pool.getNodeCount();
+    }
+
+    class Handle {
+        TreiberStack& stack;
+        size_t id;
+
+    public:
+        // throws std::length_error past HazardDomain::MAX_THREADS handles
+        explicit Handle(TreiberStack& s): stack(s), id(s.hazards.claim()) {}
+
+        Handle(const Handle&) = delete;
+        Handle& operator=(const Handle&) = delete;
+
+        ~Handle(){
+            stack.hazards.unclaim(id);
+        }
+
+        void push(const T& value){
+            NodeT* node = stack.pool.acquire();
+            node->value = value;
+            NodeT* first = stack.top.load(std::memory_order_relaxed);
+            do{
+                node->next.store(first, std::memory_order_relaxed);
+            }while(!stack.top.compare_exchange_weak(first, node, std::memory_order_release, std::memory_order_relaxed));
+        }
+
+        // returns false if the stack was empty
+        bool pop(T& out){
+            while(true){
+                NodeT* first = stack.hazards.protect(id, 0, stack.top);
+                if(!first){
+                    return false;
+                }
+                NodeT* next = first->next.load(std::memory_order_acquire);
+                if(stack.top.compare_exchange_weak(first, next, std::memory_order_acquire, std::memory_order_relaxed)){
+                    // the node is ours now; other poppers only read its next
+                    out = std::move(first->value);
+                    stack.hazards.clear(id, 0);
+                    stack.hazards.retire(id, first, NodePool<NodeT>::recycle, &stack.pool);
+                    return true;
+                }
+            }
+        }
+    };
+};
+
+// Bounded ring for exactly one producer thread and one consumer thread.
+// Each side owns its index and keeps a cached copy of the other's, only
+// reloading it when the ring looks full (or empty), so in steady state a
+// push or pop touches no cache line the other side is writing.
+template <class T>
+class SPSCRing {
+    size_t mask;
+    std::unique_ptr<T[]> slots;
+    alignas(64) std::atomic<size_t> head;
+    size_t cachedTail;
+    alignas(64) std::atomic<size_t> tail;
+    size_t cachedHead;
+
+public:
+    // capacity is rounded up to a power of two
+    explicit SPSCRing(size_t capacity = 1024): head(0), cachedTail(0), tail(0), cachedHead(0) {
+        size_t size = 1;
+        while(size < capacity){
+            size *= 2;
+        }
+        mask = size - 1;
+        slots.reset(new T[size]);
+    }
+
+    SPSCRing(const SPSCRing&) = delete;
+    SPSCRing& operator=(const SPSCRing&) = delete;
+
+    size_t getCapacity(){
+        return mask + 1;
+    }
+
+    // producer only; returns false if the ring is full
+    bool tryPush(const T& value){
+        size_t t = tail.load(std::memory_order_relaxed);
+        if(t - cachedHead > mask){
+            cachedHead = head.load(std::memory_order_acquire);
+            if(t - cachedHead > mask){
+                return false;
+            }
+        }
+        slots[t & mask] = value;
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    // consumer only; returns false if the ring is empty
+    bool tryPop(T& out){
+        size_t h = head.load(std::memory_order_relaxed);
+        if(h == cachedTail){
+            cachedTail = tail.load(std::memory_order_acquire);
+            if(h == cachedTail){
+                return false;
+            }
+        }
+        out = std::move(slots[h & mask]);
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+};
+
+// Tests
+
+bool testQueueSingleThread() {
+    MSQueue<int> queue;
+    MSQueue<int>::Handle handle(queue);
+    int value;
+    if(handle.dequeue(value)) return false;
+    for(int i = 0; i < 1000; i++) handle.enqueue(i);
+    for(int i = 0; i < 1000; i++) {
+        if(!handle.dequeue(value) || value != i) return false;
+    }
+    if(handle.dequeue(value)) return false;
+    // a steady trickle reuses nodes: the pool stops growing once retired
+    // nodes start coming back from hazard scans
+    size_t grown = 0;
+    for(int round = 0; round < 100; round++) {
+        for(int i = 0; i < 100; i++) handle.enqueue(i);
+        for(int i = 0; i < 100; i++) handle.dequeue(value);
+        if(round == 50) grown = queue.getNodeCount();
+    }
+    return queue.getNodeCount() == grown && grown < 2000;
+}
+
+bool testStackSingleThread() {
+    TreiberStack<std::string> stack;
+    TreiberStack<std::string>::Handle handle(stack);
+    std::string value;
+    if(handle.pop(value)) return false;
+    for(int i = 0; i < 1000; i++) handle.push(std::to_string(i));
+    for(int i = 999; i >= 0; i--) {
+        if(!handle.pop(value) || value != std::to_string(i)) return false;
+    }
+    return !handle.pop(value);
+}
+
+// Producers send (producer << 32 | sequence); every item has to arrive
+// exactly once, and with a FIFO queue each consumer sees every producer's
+// items in order.
+template <class Q, class Push, class Pop>
+bool checkExactlyOnce(Q& container, size_t producers, size_t consumers, uint64_t perProducer, bool fifo, Push push, Pop pop) {
+    std::atomic<uint64_t> received(0);
+    std::atomic<bool> ok(true);
+    std::vector<std::vector<uint64_t>> seen(consumers);
+    std::vector<std::thread> threads;
+    for(size_t p = 0; p < producers; p++) {
+        threads.emplace_back([&, p]{
+            typename Q::Handle handle(container);
+            for(uint64_t i = 0; i < perProducer; i++) push(handle, (uint64_t) p << 32 | i);
+        });
+    }
+    for(size_t c = 0; c < consumers; c++) {
+        threads.emplace_back([&, c]{
+            typename Q::Handle handle(container);
+            std::vector<uint64_t> last(producers, UINT64_MAX);
+            uint64_t item;
+            while(received.load() < producers * perProducer) {
+                if(!pop(handle, item)) {
+                    std::this_thread::yield();
+                    continue;
+                }
+                received += 1;
+                seen[c].push_back(item);
+                uint64_t p = item >> 32;
+                uint64_t i = item & 0xffffffffu;
+                if(fifo && last[p] != UINT64_MAX && i <= last[p]) ok = false;
+                last[p] = i;
+            }
+        });
+    }
+    for(auto& t : threads) t.join();
+    std::vector<uint64_t> all;
+    for(auto& s : seen) all.insert(all.end(), s.begin(), s.end());
+    std::sort(all.begin(), all.end());
+    if(all.size() != producers * perProducer) return false;
+    for(size_t k = 0; k < all.size(); k++) {
+        if(all[k] != ((uint64_t) (k / perProducer) << 32 | (k % perProducer))) return false;
+    }
+    return ok;
+}
+
+bool testQueueConcurrent() {
+    MSQueue<uint64_t> queue;
+    auto push = [](MSQueue<uint64_t>::Handle& h, uint64_t v){ h.enqueue(v); };
+    auto pop = [](MSQueue<uint64_t>::Handle& h, uint64_t& v){ return h.dequeue(v); };
+    if(!checkExactlyOnce(queue, 3, 3, 30000, true, push, pop)) return false;
+    if(!checkExactlyOnce(queue, 1, 4, 50000, true, push, pop)) return false;
+    // a second run over the same queue runs on recycled nodes
+    size_t nodes = queue.getNodeCount();
+    return checkExactlyOnce(queue, 4, 1, 20000, true, push, pop) && queue.getNodeCount() <= nodes + 80000;
+}
+
+bool testStackConcurrent() {
+    TreiberStack<uint64_t> stack;
+    auto push = [](TreiberStack<uint64_t>::Handle& h, uint64_t v){ h.push(v); };
+    auto pop = [](TreiberStack<uint64_t>::Handle& h, uint64_t& v){ return h.pop(v); };
+    return checkExactlyOnce(stack, 3, 3, 30000, false, push, pop)
+        && checkExactlyOnce(stack, 1, 4, 50000, false, push, pop);
+}
+
+bool testSPSCRing() {
+    SPSCRing<uint64_t> ring(1000);
+    if(ring.getCapacity() != 1024) return false;
+    uint64_t value;
+    if(ring.tryPop(value)) return false;
+    for(uint64_t i = 0; i < 1024; i++) {
+        if(!ring.tryPush(i)) return false;
+    }
+    if(ring.tryPush(1024)) return false;
+    for(uint64_t i = 0; i < 1024; i++) {
+        if(!ring.tryPop(value) || value != i) return false;
+    }
+    const uint64_t items = 1000000;
+    std::thread producer([&]{
+        for(uint64_t i = 0; i < items; i++) {
+            while(!ring.tryPush(i)) std::this_thread::yield();
+        }
+    });
+    bool ordered = true;
+    for(uint64_t i = 0; i < items; i++) {
+        while(!ring.tryPop(value)) std::this_thread::yield();
+        if(value != i) ordered = false;
+    }
+    producer.join();
+    return ordered && !ring.tryPop(value);
+}
+
+void runTests() {
+    int count = 0;
+    int total = 5;
+
+    tests::test(count, "Testing MSQueue Single Thread", testQueueSingleThread);
+    tests::test(count, "Testing TreiberStack Single Thread", testStackSingleThread);
+    tests::test(count, "Testing MSQueue Concurrent", testQueueConcurrent);
+    tests::test(count, "Testing TreiberStack Concurrent", testStackConcurrent);
+    tests::test(count, "Testing SPSCRing", testSPSCRing);
+
+    std::cout << std::string(40, '-') << "\n";
+    std::cout << " -- LockFree: Passed [" << count << "/" << total << "] tests -- " << std::endl;
+    std::cout << std::string(40, '-') << "\n\n";
+}
+
+// the std::mutex + std::queue work queue the lock-free ones replace
+template <class T>
+class LockedQueue {
+    std::mutex lock;
+    std::queue<T> items;
+
+public:
+    void push(const T& value){
+        std::lock_guard<std::mutex> guard(lock);
+        items.push(value);
+    }
+
+    bool pop(T& out){
+        std::lock_guard<std::mutex> guard(lock);
+        if(items.empty()){
+            return false;
+        }
+        out = std::move(items.front());
+        items.pop();
+        return true;
+    }
+};
+
+inline uint64_t nowNanos() {
+    return (uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(bench::Clock::now().time_since_epoch()).count();
+}
+
+// Producers push perProducer timestamps each while consumers pop until all
+// have arrived. Prints the throughput and, from every 16th item, the time
+// from push to pop. makePush() and makePop() run on the thread that will
+// use what they return, so per-thread handles are claimed there.
+template <class MakePush, class MakePop>
+void pipeline(const std::string& name, size_t producers, size_t consumers, size_t perProducer, MakePush&& makePush, MakePop&& makePop) {
+    const size_t total = producers * perProducer;
+    std::atomic<size_t> received(0);
+    std::atomic<size_t> ready(0);
+    std::atomic<bool> go(false);
+    std::vector<std::vector<uint64_t>> samples(consumers);
+    std::vector<std::thread> threads;
+    for(size_t p = 0; p < producers; p++){
+        threads.emplace_back([&]{
+            auto push = makePush();
+            ready += 1;
+            while(!go.load(std::memory_order_acquire)) std::this_thread::yield();
+            for(size_t i = 0; i < perProducer; i++){
+                while(!push(nowNanos())) std::this_thread::yield();
+            }
+        });
+    }
+    for(size_t c = 0; c < consumers; c++){
+        threads.emplace_back([&, c]{
+            auto pop = makePop();
+            ready += 1;
+            while(!go.load(std::memory_order_acquire)) std::this_thread::yield();
+            uint64_t stamp;
+            size_t mine = 0;
+            while(received.load(std::memory_order_relaxed) < total){
+                if(!pop(stamp)){
+                    std::this_thread::yield();
+                    continue;
+                }
+                received.fetch_add(1, std::memory_order_relaxed);
+                if(mine++ % 16 == 0){
+                    samples[c].push_back(nowNanos() - stamp);
+                }
+            }
+        });
+    }
+    while(ready.load() < producers + consumers) std::this_thread::yield();
+    auto start = bench::Clock::now();
+    go.store(true, std::memory_order_release);
+    for(auto& t : threads) t.join();
+    double seconds = std::chrono::duration<double>(bench::Clock::now() - start).count();
+    std::vector<uint64_t> all;
+    for(auto& s : samples) all.insert(all.end(), s.begin(), s.end());
+    bench::Percentiles p = bench::percentiles(all);
+    std::cout << "Running " << name << " [" << producers << "P/" << consumers << "C] ... "
+              << (double) total / seconds / 1e6 << " Mops/s, p50 " << p.p50 << " ns, p99 " << p.p99 << " ns\n";
+}
+
+// every producer/consumer split from 1/1 up to the core count in powers of
+// two, then the ring on its one producer and one consumer
+void runBenchmarks(size_t items = 1000000) {
+    bench::header("LockFree benchmarks");
+    size_t maxThreads = std::max(1u, std::thread::hardware_concurrency());
+    for(size_t producers = 1; producers <= maxThreads; producers *= 2){
+        for(size_t consumers = 1; consumers <= maxThreads; consumers *= 2){
+            size_t perProducer = items / producers;
+            {
+                MSQueue<uint64_t> queue;
+                pipeline("MSQueue", producers, consumers, perProducer, [&]{
+                    auto handle = std::make_shared<MSQueue<uint64_t>::Handle>(queue);
+                    return [handle](uint64_t v){ handle->enqueue(v); return true; };
+                }, [&]{
+                    auto handle = std::make_shared<MSQueue<uint64_t>::Handle>(queue);
+                    return [handle](uint64_t& v){ return handle->dequeue(v); };
+                });
+                std::cout << "  nodes: " << queue.getNodeCount() << "\n";
+            }
+            {
+                TreiberStack<uint64_t> stack;
+                pipeline("TreiberStack (LIFO)", producers, consumers, perProducer, [&]{
+                    auto handle = std::make_shared<TreiberStack<uint64_t>::Handle>(stack);
+                    return [handle](uint64_t v){ handle->push(v); return true; };
+                }, [&]{
+                    auto handle = std::make_shared<TreiberStack<uint64_t>::Handle>(stack);
+                    return [handle](uint64_t& v){ return handle->pop(v); };
+                });
+            }
+            {
+                LockedQueue<uint64_t> locked;
+                pipeline("std::mutex + std::queue", producers, consumers, perProducer, [&]{
+                    return [&](uint64_t v){ locked.push(v); return true; };
+                }, [&]{
+                    return [&](uint64_t& v){ return locked.pop(v); };
+                });
+            }
+        }
+    }
+    SPSCRing<uint64_t> ring(4096);
+    pipeline("SPSCRing", 1, 1, items, [&]{
+        return [&](uint64_t v){ return ring.tryPush(v); };
+    }, [&]{
+        return [&](uint64_t& v){ return ring.tryPop(v); };
+    });
+    std::cout << std::string(40, '-') << "\n\n";
+}
+
+}
+
+#endif /* LockFree_h */
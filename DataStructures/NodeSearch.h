@@ -0,0 +1,448 @@
+//
+//  NodeSearch.h
+//  AdvancedDSA
+//
+//
+
+#ifndef NodeSearch_h
+#define NodeSearch_h
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include "Testing.h"
+#include "Benchmark.h"
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+// Search inside one sorted B-tree node. A binary search over a few dozen
+// keys mispredicts about every other step; instead, arithmetic keys are
+// compared a whole register at a time and the rank is read off the combined
+// "less than" movemask. Other key types get a branchless binary search. The
+// choice is made per key type by specializing KeySearch.
+
+namespace nodesearch {
+
+// Lanes<K> compares WIDTH keys at once: less()/greater() return one bit per
+// key that is below/above the splatted search key. AVAILABLE is false where
+// the instruction set has no compare for K.
+template <class K, class Enable = void>
+struct Lanes {
+    static const bool AVAILABLE = false;
+};
+
+template <class K>
+constexpr bool isInt(size_t bytes) {
+    return std::is_integral<K>::value && !std::is_same<K, bool>::value && sizeof(K) == bytes;
+}
+
+#if defined(__AVX2__)
+
+// unsigned keys are compared signed after flipping the top bit
+template <class K>
+struct Lanes<K, typename std::enable_if<isInt<K>(4)>::type> {
+    static const bool AVAILABLE = true;
+    static const size_t WIDTH = 8;
+    using Vec = __m256i;
+
+    static Vec bias() {
+        return std::is_signed<K>::value ? _mm256_setzero_si256() : _mm256_set1_epi32(std::numeric_limits<int32_t>::min());
+    }
+    static Vec load(const K* p) {
+        return _mm256_xor_si256(_mm256_loadu_si256((const __m256i*) p), bias());
+    }
+    static Vec splat(K key) {
+        return _mm256_xor_si256(_mm256_set1_epi32((int32_t) key), bias());
+    }
+    static uint32_t less(Vec v, Vec k) {
+        return (uint32_t) _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(k, v)));
+    }
+    static uint32_t greater(Vec v, Vec k) {
+        return (uint32_t) _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(v, k)));
+    }
+};
+
+template <class K>
+struct Lanes<K, typename std::enable_if<isInt<K>(8)>::type> {
+    static const bool AVAILABLE = true;
+    static const size_t WIDTH = 4;
+    using Vec = __m256i;
+
+    static Vec bias() {
+        return std::is_signed<K>::value ? _mm256_setzero_si256() : _mm256_set1_epi64x(std::numeric_limits<int64_t>::min());
+    }
+    static Vec load(const K* p) {
+        return _mm256_xor_si256(_mm256_loadu_si256((const __m256i*) p), bias());
+    }
+    static Vec splat(K key) {
+        return _mm256_xor_si256(_mm256_set1_epi64x((int64_t) key), bias());
+    }
+    static uint32_t less(Vec v, Vec k) {
+        return (uint32_t) _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(k, v)));
+    }
+    static uint32_t greater(Vec v, Vec k) {
+        return (uint32_t) _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(v, k)));
+    }
+};
+
+template <>
+struct Lanes<float> {
+    static const bool AVAILABLE = true;
+    static const size_t WIDTH = 8;
+    using Vec = __m256;
+
+    static Vec load(const float* p) {
+        return _mm256_loadu_ps(p);
+    }
+    static Vec splat(float key) {
+        return _mm256_set1_ps(key);
+    }
+    static uint32_t less(Vec v, Vec k) {
+        return (uint32_t) _mm256_movemask_ps(_mm256_cmp_ps(v, k, _CMP_LT_OQ));
+    }
+    static uint32_t greater(Vec v, Vec k) {
+        return (uint32_t) _mm256_movemask_ps(_mm256_cmp_ps(v, k, _CMP_GT_OQ));
+    }
+};
+
+template <>
+struct Lanes<double> {
+    static const bool AVAILABLE = true;
+    static const size_t WIDTH = 4;
+    using Vec = __m256d;
+
+    static Vec load(const double* p) {
+        return _mm256_loadu_pd(p);
+    }
+    static Vec splat(double key) {
+        return _mm256_set1_pd(key);
+    }
+    static uint32_t less(Vec v, Vec k) {
+        return (uint32_t) _mm256_movemask_pd(_mm256_cmp_pd(v, k, _CMP_LT_OQ));
+    }
+    static uint32_t greater(Vec v, Vec k) {
+        return (uint32_t) _mm256_movemask_pd(_mm256_cmp_pd(v, k, _CMP_GT_OQ));
+    }
+};
+
+#elif defined(__SSE2__)
+
+template <class K>
+struct Lanes<K, typename std::enable_if<isInt<K>(4)>::type> {
+    static const bool AVAILABLE = true;
+    static const size_t WIDTH = 4;
+    using Vec = __m128i;
+
+    static Vec bias() {
+        return std::is_signed<K>::value ? _mm_setzero_si128() : _mm_set1_epi32(std::numeric_limits<int32_t>::min());
+    }
+    static Vec load(const K* p) {
+        return _mm_xor_si128(_mm_loadu_si128((const __m128i*) p), bias());
+    }
+    static Vec splat(K key) {
+        return _mm_xor_si128(_mm_set1_epi32((int32_t) key), bias());
+    }
+    static uint32_t less(Vec v, Vec k) {
+        return (uint32_t) _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(k, v)));
+    }
+    static uint32_t greater(Vec v, Vec k) {
+        return (uint32_t) _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(v, k)));
+    }
+};
+
+// 64-bit integer compares arrived with SSE4.2
+#if defined(__SSE4_2__)
+template <class K>
+struct Lanes<K, typename std::enable_if<isInt<K>(8)>::type> {
+    static const bool AVAILABLE = true;
+    static const size_t WIDTH = 2;
+    using Vec = __m128i;
+
+    static Vec bias() {
+        return std::is_signed<K>::value ? _mm_setzero_si128() : _mm_set1_epi64x(std::numeric_limits<int64_t>::min());
+    }
+    static Vec load(const K* p) {
+        return _mm_xor_si128(_mm_loadu_si128((const __m128i*) p), bias());
+    }
+    static Vec splat(K key) {
+        return _mm_xor_si128(_mm_set1_epi64x((int64_t) key), bias());
+    }
+    static uint32_t less(Vec v, Vec k) {
+        return (uint32_t) _mm_movemask_pd(_mm_castsi128_pd(_mm_cmpgt_epi64(k, v)));
+    }
+    static uint32_t greater(Vec v, Vec k) {
+        return (uint32_t) _mm_movemask_pd(_mm_castsi128_pd(_mm_cmpgt_epi64(v, k)));
+    }
+};
+#endif
+
+template <>
+struct Lanes<float> {
+    static const bool AVAILABLE = true;
+    static const size_t WIDTH = 4;
+    using Vec = __m128;
+
+    static Vec load(const float* p) {
+        return _mm_loadu_ps(p);
+    }
+    static Vec splat(float key) {
+        return _mm_set1_ps(key);
+    }
+    static uint32_t less(Vec v, Vec k) {
+        return (uint32_t) _mm_movemask_ps(_mm_cmplt_ps(v, k));
+    }
+    static uint32_t greater(Vec v, Vec k) {
+        return (uint32_t) _mm_movemask_ps(_mm_cmpgt_ps(v, k));
+    }
+};
+
+template <>
+struct Lanes<double> {
+    static const bool AVAILABLE = true;
+    static const size_t WIDTH = 2;
+    using Vec = __m128d;
+
+    static Vec load(const double* p) {
+        return _mm_loadu_pd(p);
+    }
+    static Vec splat(double key) {
+        return _mm_set1_pd(key);
+    }
+    static uint32_t less(Vec v, Vec k) {
+        return (uint32_t) _mm_movemask_pd(_mm_cmplt_pd(v, k));
+    }
+    static uint32_t greater(Vec v, Vec k) {
+        return (uint32_t) _mm_movemask_pd(_mm_cmpgt_pd(v, k));
+    }
+};
+
+#endif
+
+// The branchless binary search narrows [base, base + count) to a window
+// that still holds the answer without a data-dependent branch; the ternary
+// compiles to a conditional move. UPPER finds the first key above key
+// (upper_bound) instead of the first one not below it (lower_bound).
+template <bool UPPER, class K>
+size_t narrow(const K* keys, size_t& count, const K& key, size_t limit) {
+    size_t base = 0;
+    while(count > limit){
+        size_t half = count / 2;
+        bool right = UPPER ? !(key < keys[base + half]) : keys[base + half] < key;
+        base = right ? base + half : base;
+        count -= half;
+    }
+    return base;
+}
+
+// keys per window left to the SIMD scan, at most one mask bit each. Wider
+// windows measured no faster than the branchless halvings that get a node
+// down to this, and touch more cache lines on the way.
+constexpr size_t SCAN_LIMIT = 16;
+
+template <bool UPPER, class K>
+size_t branchlessBound(const K* keys, size_t count, const K& key) {
+    if(count == 0){
+        return 0;
+    }
+    size_t base = narrow<UPPER>(keys, count, key, 1);
+    bool right = UPPER ? !(key < keys[base]) : keys[base] < key;
+    return base + right;
+}
+
+template <class K, class Enable = void>
+struct KeySearch {
+    template <bool UPPER>
+    static size_t bound(const K* keys, size_t count, const K& key) {
+        return branchlessBound<UPPER>(keys, count, key);
+    }
+};
+
+template <class K>
+struct KeySearch<K, typename std::enable_if<Lanes<K>::AVAILABLE>::type> {
+    using L = Lanes<K>;
+
+    // Every key in the window is compared and the lane masks are packed into
+    // one word. The keys are sorted, so the matching bits form a prefix and
+    // its length (the popcount) is the position of the first clear bit,
+    // which a single bit scan finds. No branch depends on the keys.
+    template <bool UPPER>
+    static size_t bound(const K* keys, size_t count, const K& key) {
+        size_t base = narrow<UPPER>(keys, count, key, SCAN_LIMIT);
+        const K* window = keys + base;
+        auto k = L::splat(key);
+        const uint64_t lanes = (1ull << L::WIDTH) - 1;
+        uint64_t bits = 0;
+        size_t i = 0;
+        for(; i + L::WIDTH <= count; i += L::WIDTH){
+            auto v = L::load(window + i);
+            uint64_t mask = UPPER ? (~(uint64_t) L::greater(v, k) & lanes) : L::less(v, k);
+            bits |= mask << i;
+        }
+        size_t rank = ~bits ? (size_t) __builtin_ctzll(~bits) : 64;
+        // the tail only counts once every full lane matched
+        for(; i < count; i++){
+            rank += UPPER ? !(key < window[i]) : window[i] < key;
+        }
+        return base + rank;
+    }
+};
+
+// first of the count sorted keys that is not less than key
+template <class K>
+size_t lowerBound(const K* keys, size_t count, const K& key) {
+    return KeySearch<K>::template bound<false>(keys, count, key);
+}
+
+// first of the count sorted keys that is greater than key
+template <class K>
+size_t upperBound(const K* keys, size_t count, const K& key) {
+    return KeySearch<K>::template bound<true>(keys, count, key);
+}
+
+template <class K>
+K randomKey(std::mt19937_64& rng);
+
+template <>
+int32_t randomKey<int32_t>(std::mt19937_64& rng) {
+    return (int32_t) (rng() % 200) - 100;
+}
+
+// values with the top bit set catch a signed compare on unsigned keys
+template <>
+uint32_t randomKey<uint32_t>(std::mt19937_64& rng) {
+    return (rng() % 2) ? (uint32_t) (rng() % 100) : 0xFFFFFF00u + (uint32_t) (rng() % 100);
+}
+
+template <>
+int64_t randomKey<int64_t>(std::mt19937_64& rng) {
+    return (int64_t) (rng() % 200) - 100;
+}
+
+template <>
+uint64_t randomKey<uint64_t>(std::mt19937_64& rng) {
+    return (rng() % 2) ? rng() % 100 : 0xFFFFFFFFFFFFFF00ull + rng() % 100;
+}
+
+template <>
+float randomKey<float>(std::mt19937_64& rng) {
+    return (float) ((int) (rng() % 200) - 100) / 4.0f;
+}
+
+template <>
+double randomKey<double>(std::mt19937_64& rng) {
+    return (double) ((int) (rng() % 200) - 100) / 4.0;
+}
+
+template <>
+std::string randomKey<std::string>(std::mt19937_64& rng) {
+    return std::to_string(rng() % 200);
+}
+
+// both bounds agree with std:: on sorted arrays of every length up to two
+// scan windows, duplicates included
+template <class K>
+bool matchesStd() {
+    std::mt19937_64 rng(3);
+    for(size_t count = 0; count <= 2 * SCAN_LIMIT + 3; count++){
+        std::vector<K> keys(count);
+        for(auto& key : keys){
+            key = randomKey<K>(rng);
+        }
+        std::sort(keys.begin(), keys.end());
+        for(int probe = 0; probe < 50; probe++){
+            K key = (probe % 2 && count) ? keys[rng() % count] : randomKey<K>(rng);
+            size_t lower = std::lower_bound(keys.begin(), keys.end(), key) - keys.begin();
+            size_t upper = std::upper_bound(keys.begin(), keys.end(), key) - keys.begin();
+            if(lowerBound(keys.data(), count, key) != lower || upperBound(keys.data(), count, key) != upper){
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+bool testIntegerKeys() {
+    return matchesStd<int32_t>() && matchesStd<uint32_t>() && matchesStd<int64_t>() && matchesStd<uint64_t>();
+}
+
+bool testFloatKeys() {
+    return matchesStd<float>() && matchesStd<double>();
+}
+
+bool testFallbackKeys() {
+    // strings have no lanes and take the branchless path
+    return !Lanes<std::string>::AVAILABLE && matchesStd<std::string>();
+}
+
+void runTests() {
+    int count = 0;
+    int total = 3;
+
+    tests::test(count, "Testing Integer Keys", testIntegerKeys);
+    tests::test(count, "Testing Float Keys", testFloatKeys);
+    tests::test(count, "Testing Fallback Keys", testFallbackKeys);
+
+    std::cout << std::string(40, '-') << "\n";
+    std::cout << " -- NodeSearch: Passed [" << count << "/" << total << "] tests -- " << std::endl;
+
+    std::cout << std::string(40, '-') << "\n\n";
+}
+
+// lower bound over many nodes of the given size, so every search starts
+// with a cache miss the way it does inside a tree
+template <class K>
+void benchNodeSize(size_t nodeSize, size_t lookups) {
+    const size_t nodes = 4096;
+    std::mt19937_64 rng(5);
+    std::vector<K> keys(nodes * nodeSize);
+    for(size_t i = 0; i < keys.size(); i++){
+        keys[i] = (K) (rng() >> 1);
+    }
+    for(size_t n = 0; n < nodes; n++){
+        std::sort(keys.begin() + n * nodeSize, keys.begin() + (n + 1) * nodeSize);
+    }
+    std::vector<std::pair<size_t, K>> queries(lookups);
+    for(auto& q : queries){
+        q = {rng() % nodes, (K) (rng() >> 1)};
+    }
+    std::string suffix = " [" + std::to_string(nodeSize) + " keys]";
+    size_t sum = 0;
+    bench::run(("std::lower_bound" + suffix).c_str(), lookups, [&]{
+        for(auto& q : queries){
+            const K* node = keys.data() + q.first * nodeSize;
+            sum += std::lower_bound(node, node + nodeSize, q.second) - node;
+        }
+    });
+    bench::run(("branchless binary search" + suffix).c_str(), lookups, [&]{
+        for(auto& q : queries){
+            sum += branchlessBound<false>(keys.data() + q.first * nodeSize, nodeSize, q.second);
+        }
+    });
+    bench::run(("nodesearch::lowerBound" + suffix).c_str(), lookups, [&]{
+        for(auto& q : queries){
+            sum += lowerBound(keys.data() + q.first * nodeSize, nodeSize, q.second);
+        }
+    });
+    bench::doNotOptimize(sum);
+}
+
+void runBenchmarks(size_t lookups = 10000000) {
+    bench::header("NodeSearch benchmarks");
+    for(size_t nodeSize : {16, 32, 64}){
+        benchNodeSize<uint64_t>(nodeSize, lookups);
+    }
+    for(size_t nodeSize : {16, 32, 64}){
+        benchNodeSize<uint32_t>(nodeSize, lookups);
+    }
+    std::cout << std::string(40, '-') << "\n\n";
+}
+
+}
+
+#endif /* NodeSearch_h */
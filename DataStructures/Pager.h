@@ -0,0 +1,410 @@
+//
+//  Pager.h
+//  AdvancedDSA
+//
+//
+
+#ifndef Pager_h
+#define Pager_h
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Fixed-size pages in a file, for structures that outgrow memory. The Pager
+// does the file I/O; the BufferPool caches a bounded number of pages in
+// frames, evicting with the clock algorithm and never touching pinned ones.
+// I/O errors after a successful open throw std::runtime_error.
+
+namespace storage {
+
+constexpr size_t PAGE_SIZE = 4096;
+
+using PageId = uint64_t;
+
+// page 0 is reserved for the owner's file header, so 0 doubles as "no page"
+constexpr PageId NO_PAGE = 0;
+
+class Pager {
+    int fd;
+    size_t pageCount;
+    size_t fileSize;
+    bool mmapReads;
+    char* map;
+    size_t mapLength;
+
+    void unmap(){
+        if(map){
+            munmap(map, mapLength);
+            map = nullptr;
+            mapLength = 0;
+        }
+    }
+
+    // maps the whole file; pages allocated later are picked up on demand
+    void remap(){
+        unmap();
+        if(fileSize == 0){
+            return;
+        }
+        void* p = mmap(nullptr, fileSize, PROT_READ, MAP_SHARED, fd, 0);
+        if(p == MAP_FAILED){
+            throw std::runtime_error("storage::Pager: mmap failed");
+        }
+        map = static_cast<char*>(p);
+        mapLength = fileSize;
+    }
+
+public:
+    Pager(): fd(-1), pageCount(0), fileSize(0), mmapReads(false), map(nullptr), mapLength(0) {}
+
+    Pager(const Pager&) = delete;
+    Pager& operator=(const Pager&) = delete;
+
+    ~Pager(){
+        close();
+    }
+
+    // creates the file if it is missing; with useMmap, reads of pages that
+    // are not cached can be served straight from a read-only mapping
+    bool open(const std::string& path, bool useMmap){
+        close();
+        fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+        if(fd < 0){
+            return false;
+        }
+        struct stat st;
+        if(fstat(fd, &st) != 0){
+            close();
+            return false;
+        }
+        fileSize = (size_t) st.st_size;
+        pageCount = fileSize / PAGE_SIZE;
+        mmapReads = useMmap;
+        if(mmapReads){
+            try{
+                remap();
+            }catch(...){
+                close();
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void close(){
+        unmap();
+        if(fd >= 0){
+            ::close(fd);
+            fd = -1;
+        }
+        pageCount = 0;
+        fileSize = 0;
+    }
+
+    bool isOpen(){
+        return fd >= 0;
+    }
+
+    // the size on disk, always a whole number of pages once this Pager has
+    // grown the file
+    size_t getFileSize(){
+        return fileSize;
+    }
+
+    // the file grows in chunks, so this is the owner's count of pages in
+    // use, which it persists itself and restores after reopening
+    size_t getPageCount(){
+        return pageCount;
+    }
+
+    void setPageCount(size_t count){
+        pageCount = count;
+    }
+
+    PageId allocate(){
+        size_t needed = (pageCount + 1) * PAGE_SIZE;
+        if(needed > fileSize){
+            // grow by half the file (at most 64MB) to keep ftruncate calls rare,
+            // in whole pages so a reopened file's size still checks out
+            size_t extra = std::min(fileSize / 2, (size_t) 64 << 20) / PAGE_SIZE * PAGE_SIZE;
+            size_t grown = std::max(needed, fileSize + extra);
+            if(ftruncate(fd, (off_t) grown) != 0){
+                throw std::runtime_error("storage::Pager: cannot grow file");
+            }
+            fileSize = grown;
+        }
+        pageCount += 1;
+        return pageCount - 1;
+    }
+
+    void read(PageId id, char* out){
+        if(pread(fd, out, PAGE_SIZE, (off_t) (id * PAGE_SIZE)) != (ssize_t) PAGE_SIZE){
+            throw std::runtime_error("storage::Pager: short read");
+        }
+    }
+
+    void write(PageId id, const char* data){
+        if(pwrite(fd, data, PAGE_SIZE, (off_t) (id * PAGE_SIZE)) != (ssize_t) PAGE_SIZE){
+            throw std::runtime_error("storage::Pager: short write");
+        }
+    }
+
+    // zero-copy view of a page as last written to the file, or nullptr when
+    // mmap reads are off. A later call may remap and move earlier views.
+    const char* mapped(PageId id){
+        if(!mmapReads){
+            return nullptr;
+        }
+        if((id + 1) * PAGE_SIZE > mapLength){
+            remap();
+        }
+        return map + id * PAGE_SIZE;
+    }
+
+    void sync(){
+        if(fd >= 0){
+            fsync(fd);
+        }
+    }
+};
+
+class BufferPool;
+
+// A page handed out by the pool. Frame pages stay pinned, and so in memory,
+// until the PageRef goes away; mapped pages are read-only views that need
+// no pin. markDirty() has the frame written back before it is reused.
+class PageRef {
+    BufferPool* pool;
+    size_t frame;
+    char* bytes;
+
+public:
+    static const size_t MAPPED = SIZE_MAX;
+
+    PageRef(): pool(nullptr), frame(MAPPED), bytes(nullptr) {}
+    PageRef(BufferPool* p, size_t f, char* b): pool(p), frame(f), bytes(b) {}
+
+    PageRef(const PageRef&) = delete;
+    PageRef& operator=(const PageRef&) = delete;
+
+    PageRef(PageRef&& other) noexcept: pool(other.pool), frame(other.frame), bytes(other.bytes) {
+        other.pool = nullptr;
+    }
+
+    PageRef& operator=(PageRef&& other) noexcept {
+        if(this != &other){
+            release();
+            pool = other.pool;
+            frame = other.frame;
+            bytes = other.bytes;
+            other.pool = nullptr;
+        }
+        return *this;
+    }
+
+    ~PageRef(){
+        release();
+    }
+
+    char* data() const {
+        return bytes;
+    }
+
+    inline void markDirty();
+    inline void release();
+};
+
+class BufferPool {
+public:
+    struct Stats {
+        uint64_t hits, misses, mappedReads, evictions, writeBacks;
+    };
+
+private:
+    struct Frame {
+        PageId id;
+        uint32_t pins;
+        bool used, dirty, referenced;
+    };
+
+    Pager& pager;
+    size_t capacity;
+    std::unique_ptr<char[]> memory;
+    std::vector<Frame> frames;
+    std::unordered_map<PageId, size_t> table;
+    size_t hand;
+    Stats stats;
+    std::function<void()> firstWriteBack;
+    bool wroteBack;
+
+    char* frameData(size_t f){
+        return memory.get() + f * PAGE_SIZE;
+    }
+
+    // clock: sweep the frames, giving every recently used one a second
+    // chance; two full sweeps without a candidate means all are pinned
+    size_t victim(){
+        for(size_t step = 0; step < 2 * capacity; step++){
+            size_t f = hand;
+            hand = (hand + 1) % capacity;
+            Frame& frame = frames[f];
+            if(!frame.used){
+                return f;
+            }
+            if(frame.pins > 0){
+                continue;
+            }
+            if(frame.referenced){
+                frame.referenced = false;
+                continue;
+            }
+            return f;
+        }
+        throw std::runtime_error("storage::BufferPool: every frame is pinned");
+    }
+
+    void writeBack(size_t f){
+        if(!wroteBack){
+            if(firstWriteBack){
+                firstWriteBack();
+            }
+            wroteBack = true;
+        }
+        pager.write(frames[f].id, frameData(f));
+        frames[f].dirty = false;
+        stats.writeBacks += 1;
+    }
+
+    size_t load(PageId id, bool fresh){
+        auto it = table.find(id);
+        if(it != table.end()){
+            stats.hits += 1;
+            return it->second;
+        }
+        stats.misses += 1;
+        size_t f = victim();
+        Frame& frame = frames[f];
+        if(frame.used){
+            if(frame.dirty){
+                writeBack(f);
+            }
+            table.erase(frame.id);
+            stats.evictions += 1;
+        }
+        if(fresh){
+            std::memset(frameData(f), 0, PAGE_SIZE);
+        }else{
+            pager.read(id, frameData(f));
+        }
+        frame = Frame{id, 0, true, fresh, false};
+        table[id] = f;
+        return f;
+    }
+
+    PageRef pinFrame(size_t f){
+        frames[f].pins += 1;
+        frames[f].referenced = true;
+        return PageRef(this, f, frameData(f));
+    }
+
+    friend class PageRef;
+
+    void unpin(size_t f){
+        frames[f].pins -= 1;
+    }
+
+    void setDirty(size_t f){
+        frames[f].dirty = true;
+    }
+
+public:
+    // capacity is in pages; a tree operation keeps at most a few pinned
+    BufferPool(Pager& p, size_t pages): pager(p), capacity(std::max(pages, (size_t) 8)),
+    memory(new char[capacity * PAGE_SIZE]), frames(capacity, Frame{NO_PAGE, 0, false, false, false}), hand(0), stats{0, 0, 0, 0, 0}, wroteBack(false) {}
+
+    BufferPool(const BufferPool&) = delete;
+    BufferPool& operator=(const BufferPool&) = delete;
+
+    size_t getCapacity(){
+        return capacity;
+    }
+
+    Stats getStats(){
+        return stats;
+    }
+
+    // for reading: a cached frame if there is one, else the mapped page,
+    // else the page is loaded into a frame
+    PageRef read(PageId id){
+        auto it = table.find(id);
+        if(it == table.end()){
+            const char* view = pager.mapped(id);
+            if(view){
+                stats.mappedReads += 1;
+                return PageRef(nullptr, PageRef::MAPPED, const_cast<char*>(view));
+            }
+        }
+        return pinFrame(load(id, false));
+    }
+
+    // for updating: always a pinned frame
+    PageRef pin(PageId id){
+        return pinFrame(load(id, false));
+    }
+
+    // a new zeroed page at the end of the file
+    PageRef allocate(PageId& id){
+        id = pager.allocate();
+        return pinFrame(load(id, true));
+    }
+
+    // f runs before the first page is written back, and again before the
+    // first one after each checkpoint(), so the owner can mark its file as
+    // being modified before any page in it changes
+    void beforeWriteBack(std::function<void()> f){
+        firstWriteBack = std::move(f);
+    }
+
+    // writes every dirty frame back, leaving the frames cached
+    void flush(){
+        for(size_t f = 0; f < capacity; f++){
+            if(frames[f].used && frames[f].dirty){
+                writeBack(f);
+            }
+        }
+    }
+
+    // called by the owner once the file is consistent again
+    void checkpoint(){
+        wroteBack = false;
+    }
+};
+
+inline void PageRef::markDirty(){
+    if(pool){
+        pool->setDirty(frame);
+    }
+}
+
+inline void PageRef::release(){
+    if(pool){
+        pool->unpin(frame);
+        pool = nullptr;
+    }
+}
+
+}
+
+#endif /* Pager_h */
@@ -0,0 +1,383 @@
+//
+//  Reclamation.h
+//  AdvancedDSA
+//
+//
+
+#ifndef Reclamation_h
+#define Reclamation_h
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+
+// Safe memory reclamation for structures that readers traverse without
+// locks: a node unlinked by a writer may still be in a reader's hands, so it
+// is retired rather than freed, and freed once no reader can reach it.
+
+namespace reclaim {
+
+// Epoch-based reclamation. Readers announce the global epoch on entry and
+// clear it on exit; the epoch only advances once every active reader has
+// announced the current one. Anything retired in epoch e was unlinked
+// before any reader still in epoch e + 1 started, so it is freed once the
+// epoch reaches e + 2. Reading costs two stores to the reader's own cache
+// line; a reader that stays inside holds back everything retired since.
+//
+// Readers claim one of MAX_READERS slots, or let threadSlot() claim one for
+// the calling thread. retire and collect are for one thread at a time, the
+// writer, or callers that serialize them.
+class EpochDomain {
+public:
+    static const size_t MAX_READERS = 64;
+
+private:
+    static const uint64_t IDLE = 0;
+
+    // retiring this many nodes triggers a collect
+    static const size_t COLLECT_EVERY = 256;
+
+    struct alignas(64) Slot {
+        std::atomic<uint64_t> epoch{IDLE};
+        std::atomic<bool> claimed{false};
+    };
+
+    struct Retired {
+        uint64_t epoch;
+        void* p;
+        void (*free)(void*);
+    };
+
+    alignas(64) std::atomic<uint64_t> global{1};
+    Slot slots[MAX_READERS];
+    std::vector<Retired> limbo;
+    size_t sinceCollect = 0;
+
+    // Domains that threads may hold slots in, by an id that is never reused,
+    // so a thread that outlives a domain only finds its entry gone.
+    uint64_t id;
+
+    static std::mutex& liveLock(){
+        static std::mutex lock;
+        return lock;
+    }
+
+    static std::unordered_map<uint64_t, EpochDomain*>& live(){
+        static std::unordered_map<uint64_t, EpochDomain*> domains;
+        return domains;
+    }
+
+    static uint64_t nextId(){
+        static std::atomic<uint64_t> ids{1};
+        return ids.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // the slots a thread holds, handed back when the thread exits
+    struct ThreadSlots {
+        std::vector<std::pair<uint64_t, size_t>> held;
+
+        ~ThreadSlots(){
+            std::lock_guard<std::mutex> guard(liveLock());
+            for(auto& entry : held){
+                auto it = live().find(entry.first);
+                if(it != live().end()){
+                    it->second->unclaim(entry.second);
+                }
+            }
+        }
+    };
+
+public:
+    EpochDomain(): id(nextId()) {
+        std::lock_guard<std::mutex> guard(liveLock());
+        live()[id] = this;
+    }
+
+    EpochDomain(const EpochDomain&) = delete;
+    EpochDomain& operator=(const EpochDomain&) = delete;
+
+    // no reader may be left when the domain goes away
+    ~EpochDomain(){
+        {
+            std::lock_guard<std::mutex> guard(liveLock());
+            live().erase(id);
+        }
+        for(Retired& r : limbo){
+            r.free(r.p);
+        }
+    }
+
+    // throws std::length_error when every slot is taken
+    size_t claim(){
+        for(size_t i = 0; i < MAX_READERS; i++){
+            bool expected = false;
+            if(!slots[i].claimed.load(std::memory_order_relaxed)
+               && slots[i].claimed.compare_exchange_strong(expected, true, std::memory_order_acquire)){
+                return i;
+            }
+        }
+        throw std::length_error("reclaim::EpochDomain: too many readers");
+    }
+
+    void unclaim(size_t slot){
+        slots[slot].epoch.store(IDLE, std::memory_order_release);
+        slots[slot].claimed.store(false, std::memory_order_release);
+    }
+
+    // the announcement is seq_cst, as is the reader's next load of the
+    // shared root: either the writer's scan sees this reader, or the reader
+    // sees the root the writer published before unlinking anything
+    void enter(size_t slot){
+        slots[slot].epoch.store(global.load(std::memory_order_seq_cst), std::memory_order_seq_cst);
+    }
+
+    void exit(size_t slot){
+        slots[slot].epoch.store(IDLE, std::memory_order_release);
+    }
+
+    // The calling thread's slot, claimed on its first call and kept until
+    // the thread exits, for structures whose API has no per-thread handle.
+    // Throws std::length_error once MAX_READERS threads hold one.
+    size_t threadSlot(){
+        static thread_local ThreadSlots mine;
+        for(auto& entry : mine.held){
+            if(entry.first == id){
+                return entry.second;
+            }
+        }
+        std::lock_guard<std::mutex> guard(liveLock());
+        // drop what domains gone since the last claim left behind
+        size_t kept = 0;
+        for(auto& entry : mine.held){
+            if(live().count(entry.first)){
+                mine.held[kept++] = entry;
+            }
+        }
+        mine.held.resize(kept);
+        mine.held.reserve(kept + 1);
+        size_t slot = claim();
+        mine.held.emplace_back(id, slot);
+        return slot;
+    }
+
+    // enters on the calling thread's slot for as long as it lives
+    class Guard {
+        EpochDomain& domain;
+        size_t slot;
+
+    public:
+        explicit Guard(EpochDomain& d): domain(d), slot(d.threadSlot()) {
+            domain.enter(slot);
+        }
+
+        Guard(const Guard&) = delete;
+        Guard& operator=(const Guard&) = delete;
+
+        ~Guard(){
+            domain.exit(slot);
+        }
+    };
+
+    // makes room for n more retires, which then cannot throw; a writer that
+    // must retire after publishing reserves before it publishes
+    void reserve(size_t n){
+        if(limbo.capacity() - limbo.size() < n){
+            limbo.reserve(std::max(limbo.size() + n, 2 * limbo.capacity()));
+        }
+    }
+
+    // p has been unlinked; free(p) runs once no reader can hold it. Throws
+    // only if room for it has not been reserved.
+    void retire(void* p, void (*free)(void*)){
+        limbo.push_back(Retired{global.load(std::memory_order_relaxed), p, free});
+        sinceCollect += 1;
+        if(sinceCollect >= COLLECT_EVERY){
+            collect();
+        }
+    }
+
+    // advances the epoch if every active reader is in the current one, then
+    // frees what was retired two epochs back; returns how many were freed
+    size_t collect(){
+        sinceCollect = 0;
+        uint64_t e = global.load(std::memory_order_seq_cst);
+        bool quiet = true;
+        for(size_t i = 0; i < MAX_READERS && quiet; i++){
+            uint64_t seen = slots[i].epoch.load(std::memory_order_seq_cst);
+            quiet = seen == IDLE || seen == e;
+        }
+        if(quiet){
+            e += 1;
+            global.store(e, std::memory_order_seq_cst);
+        }
+        size_t kept = 0;
+        size_t freed = 0;
+        for(Retired& r : limbo){
+            if(r.epoch + 2 <= e){
+                r.free(r.p);
+                freed += 1;
+            }else{
+                limbo[kept++] = r;
+            }
+        }
+        limbo.resize(kept);
+        return freed;
+    }
+
+    // retired and not yet freed
+    size_t getPending(){
+        return limbo.size();
+    }
+};
+
+// Hazard pointers, for structures where any thread may unlink nodes. A
+// thread publishes the nodes it is about to dereference in its record's
+// HAZARDS slots; a retired node is handed back, through reclaim(ctx, p),
+// only once a scan finds it in no slot. Unlike epochs, a stalled thread
+// holds back at most HAZARDS nodes.
+//
+// Threads claim one of MAX_THREADS records and pass its id to every call.
+// Each record's retired list belongs to whoever holds the record.
+class HazardDomain {
+public:
+    static const size_t MAX_THREADS = 64;
+    static const size_t HAZARDS = 2;
+
+    using Reclaim = void (*)(void* ctx, void* p);
+
+private:
+    // a record scans once it has this many retired nodes, so every scan
+    // hands back at least half of them
+    static const size_t SCAN_AT = 2 * MAX_THREADS * HAZARDS;
+
+    struct Retired {
+        void* p;
+        Reclaim reclaim;
+        void* ctx;
+    };
+
+    struct alignas(64) Record {
+        std::atomic<const void*> hazards[HAZARDS];
+        std::atomic<bool> claimed{false};
+        std::vector<Retired> retired;
+        // scratch for scan, kept so steady-state scans do not allocate
+        std::vector<const void*> held;
+    };
+
+    Record records[MAX_THREADS];
+
+public:
+    HazardDomain(){
+        for(Record& r : records){
+            for(auto& h : r.hazards){
+                h.store(nullptr, std::memory_order_relaxed);
+            }
+        }
+    }
+
+    HazardDomain(const HazardDomain&) = delete;
+    HazardDomain& operator=(const HazardDomain&) = delete;
+
+    // no thread may be left when the domain goes away
+    ~HazardDomain(){
+        for(Record& r : records){
+            for(Retired& x : r.retired){
+                x.reclaim(x.ctx, x.p);
+            }
+        }
+    }
+
+    // throws std::length_error when every record is taken
+    size_t claim(){
+        for(size_t i = 0; i < MAX_THREADS; i++){
+            bool expected = false;
+            if(!records[i].claimed.load(std::memory_order_relaxed)
+               && records[i].claimed.compare_exchange_strong(expected, true, std::memory_order_acquire)){
+                return i;
+            }
+        }
+        throw std::length_error("reclaim::HazardDomain: too many threads");
+    }
+
+    // whatever is still retired stays with the record for its next holder
+    void unclaim(size_t id){
+        for(auto& h : records[id].hazards){
+            h.store(nullptr, std::memory_order_release);
+        }
+        scan(id);
+        records[id].claimed.store(false, std::memory_order_release);
+    }
+
+    // Loads src into hazard slot `slot` and returns it once the slot is
+    // known to have been published while src still held it. The store and
+    // the reload are seq_cst, as are the loads in scan.
+    template<class N>
+    N* protect(size_t id, size_t slot, const std::atomic<N*>& src){
+        N* p = src.load(std::memory_order_relaxed);
+        while(true){
+            records[id].hazards[slot].store(p, std::memory_order_seq_cst);
+            N* again = src.load(std::memory_order_seq_cst);
+            if(again == p){
+                return p;
+            }
+            p = again;
+        }
+    }
+
+    // publishes p without checking it is still reachable; the caller does
+    void set(size_t id, size_t slot, const void* p){
+        records[id].hazards[slot].store(p, std::memory_order_seq_cst);
+    }
+
+    void clear(size_t id, size_t slot){
+        records[id].hazards[slot].store(nullptr, std::memory_order_release);
+    }
+
+    // p has been unlinked; reclaim(ctx, p) runs once no hazard holds it
+    void retire(size_t id, void* p, Reclaim reclaim, void* ctx){
+        records[id].retired.push_back(Retired{p, reclaim, ctx});
+        if(records[id].retired.size() >= SCAN_AT){
+            scan(id);
+        }
+    }
+
+    // hands back every retired node of record id that no hazard holds
+    size_t scan(size_t id){
+        std::vector<const void*>& held = records[id].held;
+        held.clear();
+        for(Record& r : records){
+            for(auto& h : r.hazards){
+                const void* p = h.load(std::memory_order_seq_cst);
+                if(p){
+                    held.push_back(p);
+                }
+            }
+        }
+        std::sort(held.begin(), held.end());
+        std::vector<Retired>& retired = records[id].retired;
+        size_t kept = 0;
+        size_t reclaimed = 0;
+        for(Retired& x : retired){
+            if(std::binary_search(held.begin(), held.end(), (const void*) x.p)){
+                retired[kept++] = x;
+            }else{
+                x.reclaim(x.ctx, x.p);
+                reclaimed += 1;
+            }
+        }
+        retired.resize(kept);
+        return reclaimed;
+    }
+
+    size_t getPending(size_t id){
+        return records[id].retired.size();
+    }
+};
+
+}
+
+#endif /* Reclamation_h */
@@ -0,0 +1,461 @@
+//
+//  benchmark.cpp
+//  AdvancedDSA
+//
+//
+//  Benchmark target, built separately from main.cpp:
+//      g++ -std=c++20 -O2 -pthread -o benchmark benchmark.cpp
+//      ./benchmark --sizes 1000,1000000 --format csv > results.csv
+//
+//  Every container runs the same workloads (uniform, zipfian, sequential
+//  keys; a load phase plus 100/0, 95/5 and 50/50 read/write mixes) with
+//  int and std::string keys, next to its STL counterpart.
+//
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <sstream>
+#include <cstdlib>
+#include <list>
+#include <memory>
+#include <map>
+#include <set>
+#include <unordered_map>
+#include "DataStructures/Benchmark.h"
+#include "DataStructures/LinkedList.h"
+#include "DataStructures/HashMap_C.h"
+#include "DataStructures/HashMap_P.h"
+#include "DataStructures/AVL.h"
+#include "DataStructures/BTree.h"
+#include "DataStructures/BPlusTree.h"
+#include "DataStructures/LockFree.h"
+
+#if defined(__APPLE__)
+#include <malloc/malloc.h>
+#define ALLOCATED_SIZE(p) malloc_size(p)
+#elif defined(__linux__)
+#include <malloc.h>
+#define ALLOCATED_SIZE(p) malloc_usable_size(p)
+#endif
+
+// live heap bytes, for bytes/key; counts every plain operator new
+static std::atomic<int64_t> liveBytes(0);
+
+#if defined(ALLOCATED_SIZE)
+void* operator new(size_t size) {
+    void* p = std::malloc(size ? size : 1);
+    if(!p){
+        throw std::bad_alloc();
+    }
+    liveBytes += (int64_t) ALLOCATED_SIZE(p);
+    return p;
+}
+
+void operator delete(void* p) noexcept {
+    if(p){
+        liveBytes -= (int64_t) ALLOCATED_SIZE(p);
+        std::free(p);
+    }
+}
+
+void operator delete(void* p, size_t) noexcept {
+    operator delete(p);
+}
+
+// over-aligned types (the B-tree nodes) take these instead
+void* operator new(size_t size, std::align_val_t align) {
+    void* p = nullptr;
+    if(posix_memalign(&p, std::max((size_t) align, sizeof(void*)), size ? size : 1) != 0){
+        throw std::bad_alloc();
+    }
+    liveBytes += (int64_t) ALLOCATED_SIZE(p);
+    return p;
+}
+
+void operator delete(void* p, std::align_val_t) noexcept {
+    operator delete(p);
+}
+
+void operator delete(void* p, size_t, std::align_val_t) noexcept {
+    operator delete(p);
+}
+#endif
+
+// Adapters give every container the same insert/find surface.
+
+template <class K>
+struct LinkedListAdapter {
+    linkedlist::LinkedList<K, uint64_t> list;
+    void insert(const K& key, uint64_t val) { list.insert(key, val); }
+    bool find(const K& key) { return list.find(key) != nullptr; }
+};
+
+template <class K>
+struct UnrolledListAdapter {
+    linkedlist::UnrolledList<K, uint64_t> list;
+    void insert(const K& key, uint64_t val) { list.insert(key, val); }
+    bool find(const K& key) { return list.find(key) != nullptr; }
+};
+
+template <class K>
+struct StdListAdapter {
+    std::list<std::pair<K, uint64_t>> list;
+    typename std::list<std::pair<K, uint64_t>>::iterator lookup(const K& key) {
+        return std::find_if(list.begin(), list.end(), [&](const std::pair<K, uint64_t>& p){ return p.first == key; });
+    }
+    void insert(const K& key, uint64_t val) {
+        auto it = lookup(key);
+        if(it != list.end()){
+            it->second = val;
+        }else{
+            list.emplace_back(key, val);
+        }
+    }
+    bool find(const K& key) { return lookup(key) != list.end(); }
+};
+
+template <class K>
+struct ChainingAdapter {
+    chaining::HashMap<K, uint64_t> map;
+    void insert(const K& key, uint64_t val) { map.insert(key, val); }
+    bool find(const K& key) { return map.find(key) != nullptr; }
+};
+
+template <class K>
+struct ProbingAdapter {
+    probing::HashMap<K, uint64_t> map;
+    void insert(const K& key, uint64_t val) { map.insert(key, val); }
+    bool find(const K& key) { return map.find(key) != nullptr; }
+};
+
+template <class K>
+struct SwissAdapter {
+    probing::SwissHashMap<K, uint64_t> map;
+    void insert(const K& key, uint64_t val) { map.insert(key, val); }
+    bool find(const K& key) { return map.find(key) != nullptr; }
+};
+
+template <class K>
+struct UnorderedMapAdapter {
+    std::unordered_map<K, uint64_t> map;
+    void insert(const K& key, uint64_t val) { map[key] = val; }
+    bool find(const K& key) { return map.find(key) != map.end(); }
+};
+
+template <class K>
+struct StdMapAdapter {
+    std::map<K, uint64_t> map;
+    void insert(const K& key, uint64_t val) { map[key] = val; }
+    bool find(const K& key) { return map.find(key) != map.end(); }
+};
+
+// AVL is a set, the value is dropped
+template <class K>
+struct AVLAdapter {
+    avl::AVL<K> tree;
+    void insert(const K& key, uint64_t) { tree.insert(key); }
+    bool find(const K& key) { return tree.find(key) != nullptr; }
+};
+
+template <class K>
+struct BTreeAdapter {
+    btree::BTree<K, uint64_t> tree;
+    void insert(const K& key, uint64_t val) { tree.insert(key, val); }
+    bool find(const K& key) { return tree.find(key) != nullptr; }
+};
+
+template <class K>
+struct BufferedBTreeAdapter {
+    btree::BufferedBTree<K, uint64_t> tree;
+    void insert(const K& key, uint64_t val) { tree.insert(key, val); }
+    bool find(const K& key) {
+        uint64_t val;
+        return tree.find(key, val);
+    }
+};
+
+template <class K>
+struct BPlusTreeAdapter {
+    bplustree::BPlusTree<K, uint64_t> tree;
+    void insert(const K& key, uint64_t val) { tree.insert(key, val); }
+    bool find(const K& key) { return tree.find(key) != nullptr; }
+};
+
+template <class K>
+struct StdSetAdapter {
+    std::set<K> set;
+    void insert(const K& key, uint64_t) { set.insert(key); }
+    bool find(const K& key) { return set.find(key) != set.end(); }
+};
+
+enum class Workload {
+    UNIFORM,
+    ZIPFIAN,
+    SEQUENTIAL
+};
+
+const char* workloadName(Workload w) {
+    switch(w){
+        case Workload::UNIFORM: return "uniform";
+        case Workload::ZIPFIAN: return "zipfian";
+        case Workload::SEQUENTIAL: return "sequential";
+    }
+    return "";
+}
+
+template <class K>
+K makeKey(uint64_t raw);
+
+template <>
+uint64_t makeKey<uint64_t>(uint64_t raw) {
+    return raw;
+}
+
+// 16 hex digits, long enough to defeat the small-string buffer
+template <>
+std::string makeKey<std::string>(uint64_t raw) {
+    static const char* digits = "0123456789abcdef";
+    std::string s(16, '0');
+    for(int i = 15; i >= 0; i--){
+        s[i] = digits[raw & 0xF];
+        raw >>= 4;
+    }
+    return s;
+}
+
+template <class K>
+const char* keyTypeName();
+
+template <>
+const char* keyTypeName<uint64_t>() {
+    return "int";
+}
+
+template <>
+const char* keyTypeName<std::string>() {
+    return "string";
+}
+
+// the n distinct keys loaded into the container
+template <class K>
+std::vector<K> makeKeys(size_t n, Workload w) {
+    std::vector<K> keys(n);
+    std::mt19937_64 rng(42);
+    for(size_t i = 0; i < n; i++){
+        keys[i] = makeKey<K>(w == Workload::SEQUENTIAL ? i : rng());
+    }
+    return keys;
+}
+
+// which loaded key every operation touches
+std::vector<uint32_t> makeAccessPattern(size_t n, size_t ops, Workload w) {
+    std::vector<uint32_t> pattern(ops);
+    if(w == Workload::ZIPFIAN){
+        bench::Zipf zipf(n);
+        // scatter the hot ranks so they don't sit next to each other in memory
+        std::vector<uint32_t> permutation(n);
+        for(size_t i = 0; i < n; i++){
+            permutation[i] = (uint32_t) i;
+        }
+        std::shuffle(permutation.begin(), permutation.end(), std::mt19937_64(7));
+        for(size_t i = 0; i < ops; i++){
+            pattern[i] = permutation[zipf.next()];
+        }
+    }else if(w == Workload::SEQUENTIAL){
+        for(size_t i = 0; i < ops; i++){
+            pattern[i] = (uint32_t) (i % n);
+        }
+    }else{
+        std::mt19937_64 rng(7);
+        for(size_t i = 0; i < ops; i++){
+            pattern[i] = (uint32_t) (rng() % n);
+        }
+    }
+    return pattern;
+}
+
+struct Options {
+    std::vector<size_t> sizes;
+    size_t maxListSize;
+    size_t maxOps;
+    bench::Format format;
+    std::string filter;
+    bool strings;
+    bool micro;
+};
+
+template <class Adapter, class K>
+void runContainer(bench::Reporter& reporter, const Options& opts, const char* name, size_t n, Workload w) {
+    if(!opts.filter.empty() && std::string(name).find(opts.filter) == std::string::npos){
+        return;
+    }
+    auto keys = makeKeys<K>(n, w);
+    size_t ops = std::min(std::max(n, (size_t) 100000), opts.maxOps);
+    auto pattern = makeAccessPattern(n, ops, w);
+
+    bench::Record record;
+    record.container = name;
+    record.keyType = keyTypeName<K>();
+    record.workload = workloadName(w);
+    record.keys = n;
+
+    // load phase: n inserts, and the heap growth they cause
+    auto adapter = std::make_unique<Adapter>();
+    bench::PerfCounters counters;
+    int64_t before = liveBytes.load();
+    counters.start();
+    auto start = bench::Clock::now();
+    for(size_t i = 0; i < n; i++){
+        adapter->insert(keys[i], i);
+    }
+    auto end = bench::Clock::now();
+    record.counters = counters.stop();
+    record.bytesPerKey = (double) (liveBytes.load() - before) / (double) n;
+    record.mix = "load";
+    record.ops = n;
+    record.nsPerOp = std::chrono::duration<double, std::nano>(end - start).count() / (double) n;
+
+    // latency of the load phase comes from a second, separately timed build
+    {
+        auto again = std::make_unique<Adapter>();
+        record.latency = bench::sampleLatency(n, [&](size_t i){ again->insert(keys[i], i); });
+    }
+    reporter.report(record);
+
+    for(int readPercent : {100, 95, 50}){
+        auto step = [&](size_t i){
+            const K& key = keys[pattern[i]];
+            // a fixed hash of i decides read vs write, identical across containers
+            if((int) ((i * 0x9E3779B97F4A7C15ULL) >> 57) * 100 / 128 < readPercent){
+                bench::doNotOptimize(adapter->find(key));
+            }else{
+                adapter->insert(key, i);
+            }
+        };
+        counters.start();
+        start = bench::Clock::now();
+        for(size_t i = 0; i < ops; i++){
+            step(i);
+        }
+        end = bench::Clock::now();
+        record.counters = counters.stop();
+        record.mix = std::to_string(readPercent) + "/" + std::to_string(100 - readPercent);
+        record.ops = ops;
+        record.nsPerOp = std::chrono::duration<double, std::nano>(end - start).count() / (double) ops;
+        record.latency = bench::sampleLatency(ops, step);
+        reporter.report(record);
+    }
+}
+
+template <class K>
+void runKeyType(bench::Reporter& reporter, const Options& opts) {
+    for(size_t n : opts.sizes){
+        for(Workload w : {Workload::UNIFORM, Workload::ZIPFIAN, Workload::SEQUENTIAL}){
+            // lists are O(n) per lookup, only run them on small inputs
+            if(n <= opts.maxListSize){
+                runContainer<LinkedListAdapter<K>, K>(reporter, opts, "linkedlist::LinkedList", n, w);
+                runContainer<UnrolledListAdapter<K>, K>(reporter, opts, "linkedlist::UnrolledList", n, w);
+                runContainer<StdListAdapter<K>, K>(reporter, opts, "std::list", n, w);
+            }
+            runContainer<ChainingAdapter<K>, K>(reporter, opts, "chaining::HashMap", n, w);
+            runContainer<ProbingAdapter<K>, K>(reporter, opts, "probing::HashMap", n, w);
+            runContainer<SwissAdapter<K>, K>(reporter, opts, "probing::SwissHashMap", n, w);
+            runContainer<UnorderedMapAdapter<K>, K>(reporter, opts, "std::unordered_map", n, w);
+            runContainer<AVLAdapter<K>, K>(reporter, opts, "avl::AVL", n, w);
+            runContainer<BTreeAdapter<K>, K>(reporter, opts, "btree::BTree", n, w);
+            runContainer<BufferedBTreeAdapter<K>, K>(reporter, opts, "btree::BufferedBTree", n, w);
+            runContainer<BPlusTreeAdapter<K>, K>(reporter, opts, "bplustree::BPlusTree", n, w);
+            runContainer<StdSetAdapter<K>, K>(reporter, opts, "std::set", n, w);
+            runContainer<StdMapAdapter<K>, K>(reporter, opts, "std::map", n, w);
+        }
+    }
+}
+
+std::vector<size_t> parseSizes(const std::string& arg) {
+    std::vector<size_t> sizes;
+    std::stringstream stream(arg);
+    std::string item;
+    while(std::getline(stream, item, ',')){
+        sizes.push_back((size_t) std::stoull(item));
+    }
+    return sizes;
+}
+
+// the lock-free probing map against the lock-striped and single-mutex
+// chaining maps, on the same read-mostly mixes
+void runConcurrentMaps(size_t n = 1000000) {
+    bench::header("Concurrent hash map scaling");
+    size_t maxThreads = std::max(1u, std::thread::hardware_concurrency());
+    for(int readPercent : {95, 50}){
+        for(size_t threads = 1; threads <= maxThreads; threads *= 2){
+            bench::concurrentMap<chaining::MutexHashMap<uint64_t, uint64_t>>("chaining::MutexHashMap", threads, readPercent, n, n);
+            bench::concurrentMap<chaining::ConcurrentHashMap<uint64_t, uint64_t>>("chaining::ConcurrentHashMap", threads, readPercent, n, n);
+            bench::concurrentMap<probing::ConcurrentHashMap<uint64_t, uint64_t>>("probing::ConcurrentHashMap", threads, readPercent, n, n);
+        }
+    }
+    std::cout << std::string(40, '-') << "\n\n";
+}
+
+void usage() {
+    std::cout << "usage: benchmark [--sizes 1000,1000000] [--format text|csv|json] [--out file]\n"
+              << "                 [--filter name] [--max-list n] [--max-ops n] [--no-strings] [--micro]\n"
+              << "  sizes run from 1K to 100M keys; lists are skipped above --max-list (10000)\n"
+              << "  --micro also runs the per-container benchmarks from the headers\n";
+}
+
+int main(int argc, const char * argv[]) {
+    Options opts{{1000, 100000, 1000000}, 10000, 10000000, bench::Format::TEXT, "", true, false};
+    std::ofstream file;
+
+    for(int i = 1; i < argc; i++){
+        std::string arg = argv[i];
+        auto value = [&]() -> std::string {
+            if(i + 1 >= argc){
+                usage();
+                std::exit(1);
+            }
+            return argv[++i];
+        };
+        if(arg == "--sizes"){
+            opts.sizes = parseSizes(value());
+        }else if(arg == "--format"){
+            std::string f = value();
+            opts.format = (f == "csv") ? bench::Format::CSV : (f == "json") ? bench::Format::JSON : bench::Format::TEXT;
+        }else if(arg == "--out"){
+            file.open(value());
+        }else if(arg == "--filter"){
+            opts.filter = value();
+        }else if(arg == "--max-list"){
+            opts.maxListSize = (size_t) std::stoull(value());
+        }else if(arg == "--max-ops"){
+            opts.maxOps = (size_t) std::stoull(value());
+        }else if(arg == "--no-strings"){
+            opts.strings = false;
+        }else if(arg == "--micro"){
+            opts.micro = true;
+        }else{
+            usage();
+            return arg == "--help" ? 0 : 1;
+        }
+    }
+
+    bench::Reporter reporter(opts.format, file.is_open() ? (std::ostream&) file : std::cout);
+    runKeyType<uint64_t>(reporter, opts);
+    if(opts.strings){
+        runKeyType<std::string>(reporter, opts);
+    }
+
+    if(opts.micro){
+        linkedlist::runBenchmarks();
+        chaining::runBenchmarks();
+        probing::runBenchmarks();
+        runConcurrentMaps();
+        avl::runBenchmarks();
+        btree::runBenchmarks();
+        bplustree::runBenchmarks();
+        nodesearch::runBenchmarks();
+        lockfree::runBenchmarks();
+    }
+    return 0;
+}
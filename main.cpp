@@ -12,6 +12,11 @@
 #include "DataStructures/HashMap_C.h"
 #include "DataStructures/HashMap_P.h"
 #include "DataStructures/AVL.h"
+#include "DataStructures/BTree.h"
+#include "DataStructures/BPlusTree.h"
+#include "DataStructures/NodeSearch.h"
+#include "DataStructures/DiskBPlusTree.h"
+#include "DataStructures/LockFree.h"
 
 
 int main(int argc, const char * argv[]) {
@@ -22,6 +27,21 @@ int main(int argc, const char * argv[]) {
 //    probing::runTests();
     
     avl::runTests();
+//    btree::runTests();
+//    bplustree::runTests();
+//    nodesearch::runTests();
+//    diskbplustree::runTests();
+//    lockfree::runTests();
+    
+//    linkedlist::runBenchmarks();
+//    probing::runBenchmarks();
+//    chaining::runBenchmarks();
+//    avl::runBenchmarks();
+//    btree::runBenchmarks();
+//    bplustree::runBenchmarks();
+//    nodesearch::runBenchmarks();
+//    diskbplustree::runBenchmarks();
+//    lockfree::runBenchmarks();
     
     return 0;
 }